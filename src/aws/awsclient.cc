@@ -44,15 +44,19 @@ void AWSClient::install_rules( EventLoop& event_loop )
 
   rules_.push_back( event_loop.add_rule(
     "HTTP write",
-    [&] { http_.write( ssl_session_.outbound_plaintext() ); },
     [&] {
-      return ( not ssl_session_.outbound_plaintext().writable_region().empty() ) and ( not http_.requests_empty() );
-    } ) );
+      http_.write( ssl_session_.outbound_plaintext() );
+      ssl_session_.update_buffers();
+    },
+    [&] { return ( not ssl_session_.outbound_plaintext_full() ) and ( not http_.requests_empty() ); } ) );
 
   rules_.push_back( event_loop.add_rule(
     "HTTP read",
-    [&] { http_.read( ssl_session_.inbound_plaintext() ); },
-    [&] { return not ssl_session_.inbound_plaintext().readable_region().empty(); } ) );
+    [&] {
+      http_.read( ssl_session_.inbound_plaintext() );
+      ssl_session_.update_buffers();
+    },
+    [&] { return not ssl_session_.inbound_plaintext_empty(); } ) );
 
   rules_.push_back( event_loop.add_rule(
     "print HTTP response",
@@ -0,0 +1,87 @@
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include "timer.hh"
+
+using namespace std;
+
+// Measures the clocks behind timing instrumentation: the cost of reading
+// steady_clock and of Timer::ticks(), of timing a scope into a Timer::Record
+// (which reads the clock twice and does the global timer's bookkeeping), and
+// how closely ticks converted to nanoseconds track steady_clock.
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [ITERATIONS]\n";
+}
+
+template<class Clock>
+double per_read( const size_t iterations, Clock&& clock )
+{
+  uint64_t sum = 0;
+  const uint64_t start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    sum += clock();
+  }
+  const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+  // keep the reads from being optimized away
+  if ( sum == 0 ) {
+    cout << "";
+  }
+
+  return double( elapsed ) / iterations;
+}
+
+double per_scope( const size_t iterations )
+{
+  Timer::Record record {};
+  const uint64_t start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    RecordScopeTimer<Timer::Category::Nonblock> timer { record };
+  }
+  return double( Timer::timestamp_ns() - start ) / iterations;
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 2 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t iterations = argc > 1 ? stoul( argv[1] ) : 10'000'000;
+    const Timer::TickCalibration& calibration = Timer::tick_calibration();
+
+    cout << "Instrumentation clocks\n----------------------\n\n";
+    if ( calibration.tsc ) {
+      cout << "   Ticks: invariant TSC, calibrated at " << 1 / calibration.ns_per_tick << " GHz\n\n";
+    } else {
+      cout << "   Ticks: steady_clock (no invariant TSC)\n\n";
+    }
+
+    cout << "   steady_clock::now():        " << per_read( iterations, Timer::timestamp_ns ) << " ns\n";
+    cout << "   Timer::ticks():             " << per_read( iterations, Timer::ticks ) << " ns\n";
+    cout << "   RecordScopeTimer:           " << per_scope( iterations ) << " ns/scope\n\n";
+
+    // drift: a second of ticks, converted, against a second of steady_clock
+    const uint64_t start_ticks = Timer::ticks();
+    const uint64_t start_ns = Timer::timestamp_ns();
+    this_thread::sleep_for( chrono::seconds( 1 ) );
+    const uint64_t elapsed_ticks_ns = Timer::ticks_to_ns( Timer::ticks() - start_ticks );
+    const uint64_t elapsed_ns = Timer::timestamp_ns() - start_ns;
+    cout << "   Ticks vs. steady_clock over " << Timer::pp_ns( elapsed_ns ) << ": "
+         << ( double( elapsed_ticks_ns ) - double( elapsed_ns ) ) / elapsed_ns * 1e6 << " ppm\n";
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <list>
+
+#include <sys/resource.h>
+
+#include "exception.hh"
+#include "http_request.hh"
+#include "http_response_parser.hh"
+#include "socket.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Measures how much memory a running mycached spends per connection: opens
+// many connections, then compares the server's resident set size and number of
+// mappings against the baseline, first with the connections freshly accepted
+// and then after every connection has served a PUT and a GET.
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " SERVER_PID HOST PORT CONNECTIONS\n\n"
+       << "The server (and this program) must be allowed enough open files, e.g. `ulimit -n 200000`.\n";
+}
+
+struct ProcessMemory
+{
+  uint64_t rss_bytes;
+  uint64_t mappings;
+};
+
+ProcessMemory measure( const string& pid )
+{
+  ProcessMemory ret { 0, 0 };
+
+  ifstream status { "/proc/" + pid + "/status" };
+  for ( string line; getline( status, line ); ) {
+    if ( line.rfind( "VmRSS:", 0 ) == 0 ) {
+      ret.rss_bytes = stoull( line.substr( 6 ) ) * 1024;
+    }
+  }
+
+  ifstream maps { "/proc/" + pid + "/maps" };
+  for ( string line; getline( maps, line ); ) {
+    ret.mappings++;
+  }
+
+  if ( ret.rss_bytes == 0 ) {
+    throw runtime_error( "could not read memory usage of process " + pid );
+  }
+
+  return ret;
+}
+
+string round_trip( TCPSocket& sock, HTTPRequest&& request )
+{
+  HTTPResponseParser responses;
+  responses.new_request_arrived( request );
+
+  string headers;
+  request.serialize_headers( headers );
+  for ( string_view unsent = headers; not unsent.empty(); ) {
+    unsent.remove_prefix( sock.write( unsent ) );
+  }
+  for ( string_view unsent = request.body(); not unsent.empty(); ) {
+    unsent.remove_prefix( sock.write( unsent ) );
+  }
+
+  string buffer( 4096, 0 );
+  string unparsed;
+  while ( responses.empty() ) {
+    const size_t bytes_read = sock.read( { buffer.data(), buffer.size() } );
+    if ( bytes_read == 0 ) {
+      throw runtime_error( "server closed the connection" );
+    }
+    unparsed.append( buffer, 0, bytes_read );
+    unparsed.erase( 0, responses.parse( unparsed ) );
+  }
+
+  return string( responses.front().status_code() );
+}
+
+void report( const string& label, const ProcessMemory& before, const ProcessMemory& after, const size_t count )
+{
+  cout << "   " << label << ": " << string( 32 - label.size(), ' ' );
+  cout << ( double( after.rss_bytes ) - double( before.rss_bytes ) ) / count << " bytes/connection, ";
+  cout << ( double( after.mappings ) - double( before.mappings ) ) / count << " mappings/connection\n";
+}
+
+void program_body( const string& pid, const Address& server, const size_t count )
+{
+  rlimit limit;
+  CheckSystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  limit.rlim_cur = limit.rlim_max;
+  CheckSystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+
+  const ProcessMemory baseline = measure( pid );
+
+  const uint64_t start = Timer::timestamp_ns();
+  list<TCPSocket> connections;
+  for ( size_t i = 0; i < count; i++ ) {
+    connections.emplace_back();
+    connections.back().connect( server );
+  }
+
+  // once the last connection has been served, the server has accepted all of them
+  round_trip( connections.back(), { "GET /-connection-memory-sync HTTP/1.1", { { "Host", "mycached" } }, "" } );
+  const uint64_t connected = Timer::timestamp_ns();
+  const ProcessMemory after_accept = measure( pid );
+
+  const string value( 100, 'x' );
+  size_t i = 0;
+  for ( auto& sock : connections ) {
+    const string key = "/connection-memory-" + to_string( i++ );
+    round_trip( sock,
+                { "PUT " + key + " HTTP/1.1",
+                  { { "Host", "mycached" }, { "Content-Length", to_string( value.size() ) } },
+                  string( value ) } );
+    round_trip( sock, { "GET " + key + " HTTP/1.1", { { "Host", "mycached" } }, "" } );
+  }
+  const uint64_t served = Timer::timestamp_ns();
+  const ProcessMemory after_requests = measure( pid );
+
+  cout << "Connection memory summary\n-------------------------\n\n";
+  cout << "   Connections: " << count << " (connected in " << Timer::pp_ns( connected - start )
+       << ", served in " << Timer::pp_ns( served - connected ) << ")\n\n";
+  report( "Idle after accept", baseline, after_accept, count );
+  report( "Idle after PUT+GET", baseline, after_requests, count );
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc != 5 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    program_body( argv[1], { argv[2], argv[3] }, stoul( argv[4] ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <sys/eventfd.h>
+
+#include "eventloop.hh"
+#include "exception.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Measures EventLoop::post: the latency from post() on another thread until
+// the task runs on the loop's thread (one task in flight at a time, so the
+// loop is asleep in ppoll when each task arrives), and the throughput when one
+// or more threads post as fast as they can.
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [TASKS] [BUDGET]\n";
+}
+
+// Runs an EventLoop on the calling thread until a posted task asks it to stop.
+class LoopRunner
+{
+  FileDescriptor idle_ { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+  bool stop_ { false };
+
+public:
+  EventLoop event_loop {};
+
+  LoopRunner()
+  {
+    // keeps the loop from exiting while no task is outstanding
+    event_loop.add_rule( "idle", idle_, Direction::In, [] {} );
+  }
+
+  void run()
+  {
+    while ( not stop_ ) {
+      event_loop.wait_next_event( -1 );
+    }
+  }
+
+  void stop()
+  {
+    event_loop.post( [this] { stop_ = true; } );
+  }
+};
+
+void latency( const size_t tasks, const size_t budget )
+{
+  LoopRunner runner;
+  runner.event_loop.set_post_budget( budget );
+  vector<uint64_t> latencies;
+  latencies.reserve( tasks );
+  atomic<bool> done { false };
+
+  thread poster { [&] {
+    for ( size_t i = 0; i < tasks; i++ ) {
+      done.store( false, memory_order_relaxed );
+      const uint64_t posted = Timer::timestamp_ns();
+      runner.event_loop.post( [&, posted] {
+        latencies.push_back( Timer::timestamp_ns() - posted );
+        done.store( true, memory_order_release );
+      } );
+
+      while ( not done.load( memory_order_acquire ) ) {
+        this_thread::yield();
+      }
+    }
+    runner.stop();
+  } };
+
+  runner.run();
+  poster.join();
+
+  sort( latencies.begin(), latencies.end() );
+  cout << "   post-to-run latency:     median " << Timer::pp_ns( latencies[latencies.size() / 2] ) << ", p99 "
+       << Timer::pp_ns( latencies[latencies.size() * 99 / 100] ) << ", max " << Timer::pp_ns( latencies.back() )
+       << "\n";
+}
+
+void throughput( const size_t tasks, const size_t budget, const size_t threads )
+{
+  LoopRunner runner;
+  runner.event_loop.set_post_budget( budget );
+  size_t executed = 0;
+
+  const uint64_t start = Timer::timestamp_ns();
+  vector<thread> posters;
+  for ( size_t i = 0; i < threads; i++ ) {
+    posters.emplace_back( [&] {
+      for ( size_t j = 0; j < tasks / threads; j++ ) {
+        runner.event_loop.post( [&] { executed++; } );
+      }
+    } );
+  }
+
+  thread stopper { [&] {
+    for ( auto& poster : posters ) {
+      poster.join();
+    }
+    runner.stop(); // runs after every task posted before it
+  } };
+
+  runner.run();
+  stopper.join();
+  const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+  const string label = "throughput (" + to_string( threads ) + " poster" + ( threads == 1 ? "" : "s" ) + ")";
+  cout << "   " << label << ": " << string( 24 - label.size(), ' ' ) << double( executed ) / elapsed * 1000
+       << " M tasks/s (" << executed << " in " << Timer::pp_ns( elapsed ) << ")\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 3 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t tasks = argc > 1 ? stoul( argv[1] ) : 1000000;
+    const size_t budget = argc > 2 ? stoul( argv[2] ) : 256;
+
+    cout << "EventLoop::post\n---------------\n\n";
+    cout << "   Budget: " << budget << " tasks per wait_next_event\n\n";
+    latency( min( tasks, size_t( 10000 ) ), budget );
+    throughput( tasks, budget, 1 );
+    throughput( tasks, budget, 4 );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,179 @@
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include <sys/eventfd.h>
+
+#include "eventloop.hh"
+#include "exception.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Measures what one call to EventLoop::wait_next_event costs per installed
+// rule, for a large number of rules that are mostly idle (as with many open
+// but quiet connections) and for rules that all fire once per call. Each
+// scenario is run with the callables passed as lambdas and as std::function.
+// Idle wakeup-driven rules should cost nothing once they have been considered.
+// The polled fd is an eventfd that never becomes readable, so poll(2) returns
+// at once and the numbers are dominated by the loop's own bookkeeping.
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [RULES] [ITERATIONS]\n";
+}
+
+struct Lambdas
+{
+  static constexpr const char* name = "lambda";
+
+  template<class F>
+  F operator()( F&& f ) const
+  {
+    return f;
+  }
+};
+
+struct Functions
+{
+  static constexpr const char* name = "std::function";
+
+  template<class F>
+  function<invoke_result_t<F>()> operator()( F&& f ) const
+  {
+    return f;
+  }
+};
+
+FileDescriptor never_readable()
+{
+  return FileDescriptor { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+}
+
+template<class Wrap>
+double run( EventLoop& event_loop, const size_t rules, const size_t iterations, vector<char>& pending )
+{
+  const uint64_t start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    fill( pending.begin(), pending.end(), 1 );
+    if ( event_loop.wait_next_event( 0 ) != EventLoop::Result::Timeout ) {
+      throw runtime_error( "unexpected result from wait_next_event" );
+    }
+  }
+
+  return double( Timer::timestamp_ns() - start ) / iterations / rules;
+}
+
+// non-FD rules that are never interested
+template<class Wrap>
+double idle_non_fd( const size_t rules, const size_t iterations )
+{
+  const FileDescriptor fd = never_readable();
+  const Wrap wrap;
+  vector<char> pending;
+  size_t fired = 0;
+
+  EventLoop event_loop;
+  const size_t category = event_loop.add_category( "idle" );
+  event_loop.add_rule( category, fd, Direction::In, wrap( [] {} ), wrap( [] { return true; } ) );
+  for ( size_t i = 0; i < rules; i++ ) {
+    event_loop.add_rule( category, wrap( [&] { fired++; } ), wrap( [] { return false; } ) );
+  }
+
+  return run<Wrap>( event_loop, rules, iterations, pending );
+}
+
+// wakeup-driven rules that are never woken (they are considered once, when added)
+template<class Wrap>
+double idle_wakeup( const size_t rules, const size_t iterations )
+{
+  const FileDescriptor fd = never_readable();
+  const Wrap wrap;
+  vector<char> pending;
+  size_t fired = 0;
+
+  EventLoop event_loop;
+  const size_t category = event_loop.add_category( "idle" );
+  event_loop.add_rule( category, fd, Direction::In, wrap( [] {} ), wrap( [] { return true; } ) );
+  for ( size_t i = 0; i < rules; i++ ) {
+    event_loop.add_wakeup_rule( category, wrap( [&] { fired++; } ), wrap( [] { return false; } ) );
+  }
+
+  return run<Wrap>( event_loop, rules, iterations, pending );
+}
+
+// FD rules that are never interested (each still gets a pollfd so that errors are noticed)
+template<class Wrap>
+double idle_fd( const size_t rules, const size_t iterations )
+{
+  const FileDescriptor fd = never_readable();
+  const Wrap wrap;
+  vector<char> pending;
+
+  EventLoop event_loop;
+  const size_t category = event_loop.add_category( "idle" );
+  event_loop.add_rule( category, fd, Direction::In, wrap( [] {} ), wrap( [] { return true; } ) );
+  for ( size_t i = 0; i < rules; i++ ) {
+    event_loop.add_rule( category, fd, Direction::In, wrap( [] {} ), wrap( [] { return false; } ) );
+  }
+
+  return run<Wrap>( event_loop, rules, iterations, pending );
+}
+
+// non-FD rules that each fire once per call
+template<class Wrap>
+double active_non_fd( const size_t rules, const size_t iterations )
+{
+  const FileDescriptor fd = never_readable();
+  const Wrap wrap;
+  vector<char> pending( rules );
+
+  EventLoop event_loop;
+  const size_t category = event_loop.add_category( "active" );
+  event_loop.add_rule( category, fd, Direction::In, wrap( [] {} ), wrap( [] { return true; } ) );
+  for ( size_t i = 0; i < rules; i++ ) {
+    event_loop.add_rule(
+      category, wrap( [&pending, i] { pending[i] = 0; } ), wrap( [&pending, i] { return pending[i] != 0; } ) );
+  }
+
+  return run<Wrap>( event_loop, rules, iterations, pending );
+}
+
+template<class Wrap>
+void report( const size_t rules, const size_t iterations )
+{
+  cout << "   " << Wrap::name << ":" << string( 16 - string( Wrap::name ).size(), ' ' );
+  cout << idle_non_fd<Wrap>( rules, iterations ) << " ns (idle non-FD), ";
+  cout << idle_wakeup<Wrap>( rules, iterations ) << " ns (idle wakeup), ";
+  cout << idle_fd<Wrap>( rules, iterations ) << " ns (idle FD), ";
+  cout << active_non_fd<Wrap>( rules, iterations ) << " ns (active non-FD)\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 3 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t rules = argc > 1 ? stoul( argv[1] ) : 10000;
+    const size_t iterations = argc > 2 ? stoul( argv[2] ) : 1000;
+
+    cout << "EventLoop per-rule overhead\n---------------------------\n\n";
+    cout << "   Rules: " << rules << ", calls to wait_next_event: " << iterations << "\n\n";
+    report<Lambdas>( rules, iterations );
+    report<Functions>( rules, iterations );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "eventloop.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Measures EventLoop timers at scale: adding and cancelling timers while a
+// large number are pending, what wait_next_event costs with all of them
+// pending, firing timers that are all due at once, and the firing rate of
+// periodic timers.
+
+static constexpr uint64_t MILLION = 1'000'000;
+static constexpr uint64_t BILLION = 1'000'000'000;
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [TIMERS]\n";
+}
+
+void report( const string& label, const uint64_t elapsed_ns, const size_t count, const string& unit )
+{
+  cout << "   " << label << ": " << string( 32 - label.size(), ' ' );
+  cout << double( elapsed_ns ) / count << " ns/" << unit << " (" << count << " in " << Timer::pp_ns( elapsed_ns )
+       << ")\n";
+}
+
+void pending_timers( const size_t count )
+{
+  mt19937_64 prng;
+  EventLoop event_loop;
+  const size_t category = event_loop.add_category( "timer" );
+  size_t fired = 0;
+
+  // deadlines spread over the next hour, so none of them fires during the benchmark
+  const uint64_t now = Timer::timestamp_ns();
+  uniform_int_distribution<uint64_t> deadline { now + 60 * BILLION, now + 3600 * BILLION };
+
+  vector<EventLoop::RuleHandle> handles;
+  handles.reserve( count );
+
+  uint64_t start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < count; i++ ) {
+    handles.push_back( event_loop.add_timer( category, deadline( prng ), [&] { fired++; } ) );
+  }
+  report( "add", Timer::timestamp_ns() - start, count, "timer" );
+
+  constexpr size_t WAITS = 100000;
+  start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < WAITS; i++ ) {
+    if ( event_loop.wait_next_event( 0 ) != EventLoop::Result::Timeout ) {
+      throw runtime_error( "unexpected result from wait_next_event" );
+    }
+  }
+  report( "wait_next_event (none due)", Timer::timestamp_ns() - start, WAITS, "call" );
+
+  shuffle( handles.begin(), handles.end(), prng );
+  start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < count / 2; i++ ) {
+    handles[i].cancel();
+  }
+  report( "cancel half", Timer::timestamp_ns() - start, count / 2, "timer" );
+
+  start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < count / 2; i++ ) {
+    handles[i] = event_loop.add_timer( category, deadline( prng ), [&] { fired++; } );
+  }
+  report( "re-add half", Timer::timestamp_ns() - start, count / 2, "timer" );
+
+  if ( fired ) {
+    throw runtime_error( "timer fired early" );
+  }
+}
+
+void due_timers( const size_t count )
+{
+  mt19937_64 prng;
+  EventLoop event_loop;
+  const size_t category = event_loop.add_category( "timer" );
+  size_t fired = 0;
+
+  // deadlines spread over the last second, so all of them are due
+  const uint64_t now = Timer::timestamp_ns();
+  uniform_int_distribution<uint64_t> deadline { now - BILLION, now };
+  for ( size_t i = 0; i < count; i++ ) {
+    event_loop.add_timer( category, deadline( prng ), [&] { fired++; } );
+  }
+
+  const uint64_t start = Timer::timestamp_ns();
+  while ( event_loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {
+  }
+  report( "fire (all due)", Timer::timestamp_ns() - start, count, "timer" );
+
+  if ( fired != count ) {
+    throw runtime_error( "expected " + to_string( count ) + " timers to fire, got " + to_string( fired ) );
+  }
+}
+
+void periodic_timers( const size_t count )
+{
+  EventLoop event_loop;
+  const size_t category = event_loop.add_category( "timer" );
+  size_t fired = 0;
+
+  constexpr uint64_t PERIOD = 10 * MILLION;
+  constexpr uint64_t DURATION = BILLION / 2;
+  vector<EventLoop::RuleHandle> handles;
+  for ( size_t i = 0; i < count; i++ ) {
+    handles.push_back( event_loop.add_periodic_timer( category, PERIOD, [&] { fired++; } ) );
+  }
+
+  bool done = false;
+  event_loop.add_timer( category, Timer::timestamp_ns() + DURATION, [&] {
+    for ( auto& handle : handles ) {
+      handle.cancel();
+    }
+    done = true;
+  } );
+
+  while ( not done and event_loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {
+  }
+
+  cout << "   periodic (" << count << " x " << Timer::pp_ns( PERIOD ) << " for " << Timer::pp_ns( DURATION )
+       << "): " << double( fired ) / count << " ticks/timer (ideal " << DURATION / PERIOD << ")\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 2 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t count = argc > 1 ? stoul( argv[1] ) : MILLION;
+
+    cout << "EventLoop timers\n----------------\n\n";
+    pending_timers( count );
+    due_timers( count );
+    periodic_timers( 1000 );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <vector>
+
+#include <sys/eventfd.h>
+
+#include "eventloop.hh"
+#include "exception.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Measures what EventLoop tracing adds to each callback: non-FD rules that
+// each fire once per call to wait_next_event, with tracing off, sampling one
+// wakeup in 100, and tracing every wakeup. Also times writing out a full ring
+// as Chrome trace JSON.
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [RULES] [ITERATIONS]\n";
+}
+
+double per_callback( const size_t rules, const size_t iterations, const optional<unsigned int> sample_period )
+{
+  const FileDescriptor fd { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+  vector<char> pending( rules );
+
+  EventLoop event_loop;
+  if ( sample_period.has_value() ) {
+    event_loop.enable_tracing( 65536, *sample_period );
+  }
+
+  const size_t category = event_loop.add_category( "active" );
+  event_loop.add_rule( category, fd, Direction::In, [] {} );
+  for ( size_t i = 0; i < rules; i++ ) {
+    event_loop.add_rule(
+      category, [&pending, i] { pending[i] = 0; }, [&pending, i] { return pending[i] != 0; } );
+  }
+
+  const uint64_t start = Timer::timestamp_ns();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    fill( pending.begin(), pending.end(), 1 );
+    event_loop.wait_next_event( 0 );
+  }
+
+  return double( Timer::timestamp_ns() - start ) / iterations / rules;
+}
+
+void dump_cost( const size_t events )
+{
+  EventTrace trace { events, 1 };
+  for ( size_t i = 0; i < events; i++ ) {
+    trace.record( { i * 1000, i * 1000 + 500, i, 0 } );
+  }
+
+  ostringstream out;
+  const uint64_t start = Timer::timestamp_ns();
+  trace.write_chrome_json( out, { "active" } );
+  const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+  cout << "   Writing " << events << " events as JSON: " << Timer::pp_ns( elapsed ) << " (" << out.str().size()
+       << " bytes)\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 3 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t rules = argc > 1 ? stoul( argv[1] ) : 1000;
+    const size_t iterations = argc > 2 ? stoul( argv[2] ) : 10000;
+
+    cout << "EventLoop tracing overhead\n--------------------------\n\n";
+    cout << "   Rules: " << rules << ", calls to wait_next_event: " << iterations << "\n\n";
+    cout << "   Tracing off:              " << per_callback( rules, iterations, {} ) << " ns/callback\n";
+    cout << "   Sampling 1 wakeup in 100: " << per_callback( rules, iterations, 100 ) << " ns/callback\n";
+    cout << "   Tracing every wakeup:     " << per_callback( rules, iterations, 1 ) << " ns/callback\n\n";
+    dump_cost( 65536 );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "exception.hh"
+#include "http_request.hh"
+#include "http_response_parser.hh"
+#include "socket.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Measures how a running mycached shares itself out: the latency of PUT+GET
+// round trips from a few light clients, first on their own and then while a
+// heavy client pipelines large PUTs as fast as the server will take them.
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " HOST PORT [LIGHT_CLIENTS] [SECONDS]\n";
+}
+
+static constexpr size_t HEAVY_PIPELINE = 1000;
+static constexpr size_t HEAVY_VALUE_SIZE = 4096;
+
+void send_all( TCPSocket& sock, string_view data )
+{
+  while ( not data.empty() ) {
+    data.remove_prefix( sock.write( data ) );
+  }
+}
+
+void round_trip( TCPSocket& sock, HTTPRequest&& request )
+{
+  HTTPResponseParser responses;
+  responses.new_request_arrived( request );
+
+  // one write, so that Nagle's algorithm doesn't hold back the body
+  string headers;
+  request.serialize_headers( headers );
+  send_all( sock, headers + request.body() );
+
+  string buffer( 4096, 0 );
+  string unparsed;
+  while ( responses.empty() ) {
+    const size_t bytes_read = sock.read( { buffer.data(), buffer.size() } );
+    if ( bytes_read == 0 ) {
+      throw runtime_error( "server closed the connection" );
+    }
+    unparsed.append( buffer, 0, bytes_read );
+    unparsed.erase( 0, responses.parse( unparsed ) );
+  }
+}
+
+// Pipelines batches of PUTs on one connection until told to stop, while another thread drains the responses
+class HeavyClient
+{
+  TCPSocket sock_ {};
+  atomic<bool> stop_ { false };
+  atomic<uint64_t> requests_ { 0 };
+  thread writer_ {}, reader_ {};
+
+public:
+  explicit HeavyClient( const Address& server )
+  {
+    sock_.connect( server );
+
+    string batch;
+    const string value( HEAVY_VALUE_SIZE, 'x' );
+    for ( size_t i = 0; i < HEAVY_PIPELINE; i++ ) {
+      HTTPRequest request { "PUT /fairness-heavy-" + to_string( i ) + " HTTP/1.1",
+                            { { "Host", "mycached" }, { "Content-Length", to_string( value.size() ) } },
+                            string( value ) };
+      string headers;
+      request.serialize_headers( headers );
+      batch += headers + value;
+    }
+
+    writer_ = thread( [this, batch = move( batch )] {
+      while ( not stop_.load() ) {
+        send_all( sock_, batch );
+        requests_ += HEAVY_PIPELINE;
+      }
+    } );
+
+    reader_ = thread( [this] {
+      string buffer( 65536, 0 );
+      while ( sock_.read( { buffer.data(), buffer.size() } ) > 0 ) {}
+    } );
+  }
+
+  uint64_t requests() const { return requests_.load(); }
+
+  ~HeavyClient()
+  {
+    stop_ = true;
+    writer_.join();
+    sock_.shutdown( SHUT_WR );
+    reader_.join();
+  }
+
+  /* Disallow copying */
+  HeavyClient( const HeavyClient& other ) = delete;
+  HeavyClient& operator=( const HeavyClient& other ) = delete;
+};
+
+vector<uint64_t> light_clients( const Address& server, const size_t count, const uint64_t duration_ns )
+{
+  vector<vector<uint64_t>> latencies( count );
+  vector<thread> threads;
+  const uint64_t end = Timer::timestamp_ns() + duration_ns;
+
+  for ( size_t i = 0; i < count; i++ ) {
+    threads.emplace_back( [&, i] {
+      TCPSocket sock;
+      sock.connect( server );
+      const string key = "/fairness-light-" + to_string( i );
+
+      for ( uint64_t now = Timer::timestamp_ns(); now < end; ) {
+        round_trip( sock,
+                    { "PUT " + key + " HTTP/1.1",
+                      { { "Host", "mycached" }, { "Content-Length", "5" } },
+                      "hello" } );
+        round_trip( sock, { "GET " + key + " HTTP/1.1", { { "Host", "mycached" } }, "" } );
+
+        const uint64_t done = Timer::timestamp_ns();
+        latencies[i].push_back( done - now );
+        now = done;
+      }
+    } );
+  }
+
+  for ( auto& t : threads ) {
+    t.join();
+  }
+
+  vector<uint64_t> all;
+  for ( const auto& l : latencies ) {
+    all.insert( all.end(), l.begin(), l.end() );
+  }
+  sort( all.begin(), all.end() );
+  if ( all.empty() ) {
+    throw runtime_error( "no round trips completed" );
+  }
+  return all;
+}
+
+void report( const string& label, const vector<uint64_t>& latencies )
+{
+  cout << "   " << label << ": " << string( 32 - label.size(), ' ' );
+  cout << "median " << Timer::pp_ns( latencies[latencies.size() / 2] );
+  cout << ", p99 " << Timer::pp_ns( latencies[latencies.size() * 99 / 100] );
+  cout << ", max " << Timer::pp_ns( latencies.back() );
+  cout << " [count=" << latencies.size() << "]\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc < 3 or argc > 5 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const Address server { argv[1], argv[2] };
+    const size_t light = argc > 3 ? stoul( argv[3] ) : 4;
+    const uint64_t duration_ns = ( argc > 4 ? stoul( argv[4] ) : 5 ) * 1'000'000'000;
+
+    cout << "Fairness summary\n----------------\n\n";
+    cout << "   Light clients: " << light << " (PUT+GET round trips)\n";
+    cout << "   Heavy client: pipelines " << HEAVY_PIPELINE << " PUTs of " << HEAVY_VALUE_SIZE
+         << " bytes at a time\n\n";
+
+    report( "Light clients alone", light_clients( server, light, duration_ns ) );
+
+    uint64_t heavy_requests;
+    vector<uint64_t> latencies;
+    {
+      HeavyClient heavy { server };
+      latencies = light_clients( server, light, duration_ns );
+      heavy_requests = heavy.requests();
+    }
+    report( "With a heavy client", latencies );
+    cout << "\n   Heavy client sent " << heavy_requests << " requests ("
+         << double( heavy_requests ) * 1'000'000'000 / duration_ns << "/s)\n";
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hot_keys.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Feeds HotKeys a stream of keys drawn from a Zipf distribution and reports,
+// for several sample periods, what offer() costs per request and how many of
+// the truly hottest keys come out on top.
+
+static constexpr size_t TOP = 32;
+static constexpr size_t CHECKED = 10;
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [KEYS] [REQUESTS] [ZIPF_EXPONENT]\n";
+}
+
+vector<string> zipf_stream( const size_t keys, const size_t requests, const double exponent )
+{
+  vector<double> weights( keys );
+  for ( size_t i = 0; i < keys; i++ ) {
+    weights[i] = 1.0 / pow( i + 1, exponent );
+  }
+
+  mt19937_64 prng;
+  discrete_distribution<size_t> rank { weights.begin(), weights.end() };
+
+  vector<string> stream;
+  stream.reserve( requests );
+  for ( size_t i = 0; i < requests; i++ ) {
+    stream.push_back( "key" + to_string( rank( prng ) ) );
+  }
+  return stream;
+}
+
+// how many of the CHECKED most requested keys made the top
+size_t found( const vector<string>& stream, const HotKeys& hot_keys )
+{
+  unordered_map<string, size_t> counts;
+  for ( const auto& key : stream ) {
+    counts[key]++;
+  }
+
+  vector<pair<size_t, string>> ranked;
+  for ( const auto& [key, count] : counts ) {
+    ranked.emplace_back( count, key );
+  }
+  sort( ranked.rbegin(), ranked.rend() );
+
+  const auto top = hot_keys.top();
+  size_t hits = 0;
+  for ( size_t i = 0; i < min( CHECKED, ranked.size() ); i++ ) {
+    hits += any_of( top.begin(), top.end(), [&]( const HotKeys::Entry& e ) { return e.key == ranked[i].second; } );
+  }
+  return hits;
+}
+
+void run( const vector<string>& stream, const uint32_t sample_period )
+{
+  HotKeys hot_keys { TOP, sample_period };
+
+  const uint64_t start = Timer::timestamp_ns();
+  for ( const auto& key : stream ) {
+    hot_keys.offer( key );
+  }
+  const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+  cout << "   1 in " << sample_period << ":" << string( 6 - to_string( sample_period ).size(), ' ' )
+       << double( elapsed ) / stream.size() << " ns/request, " << found( stream, hot_keys ) << "/" << CHECKED
+       << " hottest keys found\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 4 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t keys = argc > 1 ? stoul( argv[1] ) : 100'000;
+    const size_t requests = argc > 2 ? stoul( argv[2] ) : 2'000'000;
+    const double exponent = argc > 3 ? stod( argv[3] ) : 1.0;
+
+    cout << "HotKeys\n-------\n\n";
+    cout << "   Keys: " << keys << ", requests: " << requests << ", Zipf exponent: " << exponent << "\n\n";
+
+    const auto stream = zipf_stream( keys, requests, exponent );
+    for ( const uint32_t sample_period : { 1, 16, 64, 256 } ) {
+      run( stream, sample_period );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "ring_buffer.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Simulates connection churn: a fixed number of connections stay open, and on
+// every cycle one of them is closed and replaced by a new one that takes an
+// inbound and an outbound buffer, moves a request and a response through them,
+// and holds on to them until it is closed in turn. Buffers come either from
+// fresh mappings or from a RingBufferPool.
+
+static constexpr size_t BUFFER_SIZE = 65536;
+static constexpr size_t TARGET_CYCLES_PER_SECOND = 50000;
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [CYCLES] [OPEN_CONNECTIONS]\n";
+}
+
+struct Connection
+{
+  unique_ptr<RingBuffer> inbound {}, outbound {};
+};
+
+template<class Acquire, class Release>
+double churn( const size_t cycles, const size_t open_connections, Acquire&& acquire, Release&& release )
+{
+  vector<Connection> connections( open_connections );
+  const string request( 100, 'q' ), response( 1000, 'r' );
+
+  const uint64_t start = Timer::timestamp_ns();
+
+  for ( size_t i = 0; i < cycles; i++ ) {
+    Connection& connection = connections[i % open_connections];
+
+    // disconnect
+    release( move( connection.inbound ) );
+    release( move( connection.outbound ) );
+
+    // connect, and serve one request
+    connection.inbound = acquire();
+    connection.outbound = acquire();
+    connection.inbound->write( request );
+    connection.inbound->pop( connection.inbound->readable_region().size() );
+    connection.outbound->write( response );
+    connection.outbound->pop( connection.outbound->readable_region().size() );
+  }
+
+  const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+  for ( auto& connection : connections ) {
+    release( move( connection.inbound ) );
+    release( move( connection.outbound ) );
+  }
+
+  return cycles / ( elapsed / 1e9 );
+}
+
+void report( const string& label, const double cycles_per_second )
+{
+  cout << "   " << label << ": " << string( 32 - label.size(), ' ' );
+  cout << static_cast<uint64_t>( cycles_per_second ) << " cycles/s";
+  cout << ( cycles_per_second >= TARGET_CYCLES_PER_SECOND ? "" : "  [below target]" ) << "\n";
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 3 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t cycles = argc > 1 ? stoul( argv[1] ) : 200000;
+    const size_t open_connections = argc > 2 ? stoul( argv[2] ) : 1000;
+
+    const double unpooled = churn(
+      cycles,
+      open_connections,
+      [] { return make_unique<RingBuffer>( BUFFER_SIZE ); },
+      []( unique_ptr<RingBuffer>&& buffer ) { buffer.reset(); } );
+
+    RingBufferPool pool { { BUFFER_SIZE }, 2 * open_connections * BUFFER_SIZE };
+    const double pooled = churn(
+      cycles,
+      open_connections,
+      [&] { return pool.acquire( BUFFER_SIZE ); },
+      [&]( unique_ptr<RingBuffer>&& buffer ) { pool.release( move( buffer ) ); } );
+
+    cout << "RingBuffer churn summary (target: " << TARGET_CYCLES_PER_SECOND << " cycles/s)\n";
+    cout << "-------------------------------------------------\n\n";
+    report( "New mappings", unpooled );
+    report( "RingBufferPool", pooled );
+    cout << "\n" << pool.summary();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
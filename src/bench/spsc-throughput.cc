@@ -0,0 +1,126 @@
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <thread>
+
+#include <pthread.h>
+
+#include "exception.hh"
+#include "spsc_ring_buffer.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Streams bytes from a producer thread to a consumer thread through an
+// SpscRingBuffer, with the two threads pinned to different cores, and reports
+// the throughput for several index-publication batch sizes.
+
+static constexpr size_t BUFFER_SIZE = 1048576;
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [MEGABYTES] [CHUNK_SIZE]\n";
+}
+
+void pin_to_core( thread& t, const unsigned int core )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( core, &cpus );
+
+  const int ret = pthread_setaffinity_np( t.native_handle(), sizeof( cpus ), &cpus );
+  if ( ret ) {
+    throw unix_error( "pthread_setaffinity_np", ret );
+  }
+}
+
+double run( const size_t total_bytes, const size_t chunk_size, const size_t publish_batch, const bool pin )
+{
+  SpscRingBuffer buffer { BUFFER_SIZE, publish_batch };
+
+  string chunk( chunk_size, 0 );
+  iota( chunk.begin(), chunk.end(), 0 );
+
+  const uint64_t chunk_sum = accumulate( chunk.begin(), chunk.end(), uint64_t( 0 ), []( uint64_t a, char b ) {
+    return a + static_cast<uint8_t>( b );
+  } );
+
+  uint64_t received_sum = 0;
+
+  const uint64_t start = Timer::timestamp_ns();
+
+  thread producer( [&] {
+    for ( size_t sent = 0; sent < total_bytes; ) {
+      string_view remaining { chunk };
+      while ( not remaining.empty() ) {
+        remaining.remove_prefix( buffer.write( remaining ) );
+      }
+      sent += chunk.size();
+    }
+    buffer.publish_push();
+  } );
+
+  thread consumer( [&] {
+    for ( size_t received = 0; received < total_bytes; ) {
+      const string_view data = buffer.readable_region();
+      for ( const char ch : data ) {
+        received_sum += static_cast<uint8_t>( ch );
+      }
+      buffer.pop( data.size() );
+      received += data.size();
+    }
+    buffer.publish_pop();
+  } );
+
+  if ( pin ) {
+    pin_to_core( producer, 0 );
+    pin_to_core( consumer, 1 );
+  }
+
+  producer.join();
+  consumer.join();
+
+  const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+  if ( received_sum != chunk_sum * ( total_bytes / chunk_size ) ) {
+    throw runtime_error( "consumer received corrupted data" );
+  }
+
+  return total_bytes / ( elapsed / 1e9 );
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 3 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t megabytes = argc > 1 ? stoul( argv[1] ) : 1024;
+    const size_t chunk_size = argc > 2 ? stoul( argv[2] ) : 1024;
+    const size_t total_bytes = megabytes * 1048576 / chunk_size * chunk_size;
+    const bool pin = thread::hardware_concurrency() >= 2;
+
+    cout << "SpscRingBuffer throughput summary\n---------------------------------\n\n";
+    cout << "   " << megabytes << " MiB in " << chunk_size << "-byte chunks";
+    cout << ( pin ? ", producer on core 0 and consumer on core 1" : " (only one core available: threads not pinned)" );
+    cout << "\n\n";
+
+    for ( const size_t batch : { size_t( 1 ), size_t( 4096 ), size_t( 65536 ) } ) {
+      const string label = "publish every " + to_string( batch ) + " B";
+      const double bytes_per_second = run( total_bytes, chunk_size, batch, pin );
+      cout << "   " << label << ": " << string( 32 - label.size(), ' ' );
+      cout << bytes_per_second / 1e9 << " GB/s\n";
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
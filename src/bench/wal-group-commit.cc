@@ -0,0 +1,115 @@
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "eventloop.hh"
+#include "exception.hh"
+#include "timer.hh"
+#include "write_ahead_log.hh"
+
+using namespace std;
+
+// Drives a WriteAheadLog from an event loop the way mycached does: CLIENTS clients each PUT, wait for the PUT
+// to be durable, and PUT again. For several client counts and commit intervals, reports PUTs per second,
+// fdatasyncs per second, PUTs per fdatasync and the mean time from append to durable.
+
+static constexpr uint64_t MAX_BATCH_RECORDS = 1024;
+static constexpr uint64_t RUN_NS = 1'000'000'000;
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [PATH] [VALUE_SIZE]\n";
+}
+
+void run( const string& path, const size_t value_size, const size_t clients, const uint64_t commit_interval_us )
+{
+  unlink( path.c_str() );
+
+  EventLoop event_loop;
+  const FileDescriptor idle { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+  event_loop.add_rule( "idle", idle, Direction::In, [] {} ); // keeps the loop from exiting
+
+  const string value( value_size, 'x' );
+  deque<pair<uint64_t, size_t>> waiting; // (LSN, client), in LSN order
+  uint64_t puts = 0, last_durable = 0;
+  bool stopping = false;
+  size_t outstanding = 0;
+
+  const uint64_t start = Timer::timestamp_ns();
+  WriteAheadLog* log_ptr = nullptr;
+
+  auto put = [&]( const size_t client ) {
+    waiting.emplace_back( log_ptr->append( WriteAheadLog::Op::Put, "key" + to_string( client ), value ), client );
+    outstanding++;
+  };
+
+  WriteAheadLog log { path, event_loop, { commit_interval_us, MAX_BATCH_RECORDS }, [&]( const uint64_t lsn ) {
+                       const uint64_t now = Timer::timestamp_ns();
+                       while ( not waiting.empty() and waiting.front().first <= lsn ) {
+                         const size_t client = waiting.front().second;
+                         waiting.pop_front();
+                         outstanding--;
+                         puts++;
+                         if ( not stopping ) {
+                           put( client );
+                         }
+                       }
+                       stopping = now - start >= RUN_NS;
+                       last_durable = now;
+                     } };
+  log_ptr = &log;
+
+  for ( size_t client = 0; client < clients; client++ ) {
+    put( client );
+  }
+  while ( outstanding ) {
+    event_loop.wait_next_event( -1 );
+  }
+  const uint64_t elapsed = last_durable - start;
+
+  const uint64_t commits = log.commits();
+  const string label = to_string( clients ) + ( clients == 1 ? " client, " : " clients, " ) + "interval "
+                       + to_string( commit_interval_us ) + " us";
+  cout << "   " << label << ": " << string( 32 - label.size(), ' ' ) << uint64_t( puts * 1e9 / elapsed )
+       << " PUTs/s, " << uint64_t( commits * 1e9 / elapsed ) << " fdatasyncs/s, " << double( puts ) / commits
+       << " PUTs/fdatasync, "
+       << Timer::pp_ns( elapsed * clients / puts ) << " per PUT\n"; // every client always has a PUT waiting
+
+  unlink( path.c_str() );
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 3 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const string path = argc > 1 ? argv[1] : "wal-group-commit.wal";
+    const size_t value_size = argc > 2 ? stoul( argv[2] ) : 100;
+
+    cout << "WriteAheadLog group commit\n--------------------------\n\n";
+    cout << "   Log: " << path << ", value size: " << value_size << " bytes\n\n";
+
+    for ( const uint64_t commit_interval_us : { 0, 200, 1000 } ) {
+      for ( const size_t clients : { 1, 16, 256 } ) {
+        run( path, value_size, clients, commit_interval_us );
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
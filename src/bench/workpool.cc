@@ -0,0 +1,96 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "timer.hh"
+#include "work_stealing_pool.hh"
+
+using namespace std;
+
+// Submits CPU-heavy jobs of uneven size from an EventLoop to a WorkStealingPool,
+// checks every completion arrives back on the loop with the right answer, and
+// reports the round-trip latency and the pool's summary. Each job also splits
+// off a child job from inside the pool, which lands on the worker's own deque
+// and is what idle workers steal.
+
+void usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [JOBS] [THREADS]\n";
+}
+
+static uint64_t spin( const uint64_t iterations )
+{
+  uint64_t x = iterations;
+  for ( uint64_t i = 0; i < iterations; i++ ) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+  }
+  return x;
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc > 3 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const size_t jobs = argc > 1 ? stoul( argv[1] ) : 10000;
+    const size_t threads = argc > 2 ? stoul( argv[2] ) : 4;
+
+    size_t completed = 0, wrong = 0;
+    uint64_t total_latency = 0;
+    atomic<size_t> children { 0 };
+
+    EventLoop event_loop;
+    WorkStealingPool pool { threads };
+
+    const uint64_t start = Timer::timestamp_ns();
+    for ( size_t i = 0; i < jobs; i++ ) {
+      // every 16th job is 64 times heavier than the rest
+      const uint64_t iterations = ( i % 16 == 0 ) ? 64 * 1000 : 1000;
+      const uint64_t submitted = Timer::timestamp_ns();
+
+      pool.submit(
+        event_loop,
+        [&pool, &children, iterations] {
+          pool.submit( [&children, iterations] {
+            spin( iterations );
+            children.fetch_add( 1, memory_order_relaxed );
+          } );
+          return spin( iterations );
+        },
+        [&, iterations, submitted]( const uint64_t result ) {
+          total_latency += Timer::timestamp_ns() - submitted;
+          completed++;
+          wrong += ( result != spin( iterations ) );
+        } );
+    }
+
+    while ( event_loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+    while ( children.load( memory_order_relaxed ) < jobs ) {
+      this_thread::yield();
+    }
+    const uint64_t elapsed = Timer::timestamp_ns() - start;
+
+    if ( completed != jobs or wrong ) {
+      cerr << "Error: " << completed << " of " << jobs << " completions, " << wrong << " wrong\n";
+      return EXIT_FAILURE;
+    }
+
+    cout << "WorkStealingPool\n----------------\n\n";
+    cout << "   " << jobs << " jobs (+ " << jobs << " children) on " << threads << " workers in "
+         << Timer::pp_ns( elapsed ) << ", mean submit-to-completion " << Timer::pp_ns( total_latency / jobs )
+         << "\n\n";
+    cout << pool.summary();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -117,13 +117,19 @@ void program_body()
 
   event_loop.add_rule(
     "HTTP write",
-    [&] { http.write( ssl.outbound_plaintext() ); },
-    [&] { return ( not ssl.outbound_plaintext().writable_region().empty() ) and ( not http.requests_empty() ); } );
+    [&] {
+      http.write( ssl.outbound_plaintext() );
+      ssl.update_buffers();
+    },
+    [&] { return ( not ssl.outbound_plaintext_full() ) and ( not http.requests_empty() ); } );
 
   event_loop.add_rule(
     "HTTP read",
-    [&] { http.read( ssl.inbound_plaintext() ); },
-    [&] { return not ssl.inbound_plaintext().readable_region().empty(); } );
+    [&] {
+      http.read( ssl.inbound_plaintext() );
+      ssl.update_buffers();
+    },
+    [&] { return not ssl.inbound_plaintext_empty(); } );
 
   event_loop.add_rule(
     "print HTTP response",
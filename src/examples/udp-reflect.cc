@@ -52,16 +52,9 @@ void program_body( const string& id )
 
   EventLoop event_loop;
 
-  uint64_t next_announce_time = start_time;
-  event_loop.add_rule(
-    "UDP send announcement",
-    sock,
-    Direction::Out,
-    [&] {
-      sock.sendto( trolley, "= " + id );
-      next_announce_time = Timer::timestamp_ns() + BILLION;
-    },
-    [&] { return next_announce_time < Timer::timestamp_ns(); } );
+  const auto announce = [&] { sock.sendto( trolley, "= " + id ); };
+  announce();
+  event_loop.add_periodic_timer( "UDP send announcement", BILLION, announce );
 
   event_loop.add_rule(
     "UDP receive",
@@ -81,17 +74,12 @@ void program_body( const string& id )
     },
     [&] { return true; } );
 
-  uint64_t next_call_time = start_time;
-  event_loop.add_rule(
-    "UDP send call",
-    sock,
-    Direction::Out,
-    [&] {
+  event_loop.add_periodic_timer( "UDP send call", BILLION / 2, [&] {
+    if ( other_address.has_value() ) {
       sock.sendto( trolley, "INFO sending request to other" );
       sock.sendto( other_address.value(), "REQUEST from " + id );
-      next_call_time = Timer::timestamp_ns() + BILLION / 2;
-    },
-    [&] { return next_call_time < Timer::timestamp_ns() and other_address.has_value(); } );
+    }
+  } );
 
   while ( event_loop.wait_next_event( 500 ) != EventLoop::Result::Exit ) {
     if ( Timer::timestamp_ns() - start_time > 5ULL * 1000 * 1000 * 1000 ) {
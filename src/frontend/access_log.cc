@@ -0,0 +1,254 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access_log.hh"
+#include "util/exception.hh"
+#include "util/prometheus.hh"
+#include "util/timer.hh"
+
+using namespace std;
+
+static_assert( sizeof( AccessLog::Record ) == 32
+               and is_trivially_copyable_v<AccessLog::Record> );
+
+void AccessLog::Producer::append( const Record& record )
+{
+  simple_string_span space = ring_.writable_region( sizeof( record ) );
+  if ( space.size() < sizeof( record ) ) {
+    ++dropped_;
+    return;
+  }
+
+  memcpy( space.mutable_data(), &record, sizeof( record ) );
+  ring_.push( sizeof( record ) );
+  ++appended_;
+
+  // the flusher comes by every FLUSH_INTERVAL_MS anyway; only hurry it along
+  // when the ring is filling up faster than that
+  unsignalled_ += sizeof( record );
+  if ( unsignalled_ >= RING_SIZE / 2 ) {
+    unsignalled_ = 0;
+    log_.wake_flusher();
+  }
+}
+
+AccessLog::AccessLog( const string& path,
+                      const uint64_t max_file_bytes,
+                      const unsigned int keep )
+  : path_( path )
+  , max_file_bytes_( max_file_bytes )
+  , keep_( keep )
+  , origin_ticks_( Timer::ticks() )
+  , origin_wall_ns_( chrono::duration_cast<chrono::nanoseconds>(
+                       chrono::system_clock::now().time_since_epoch() )
+                       .count() )
+  , file_( CheckSystemCall( "open " + path,
+                            open( path.c_str(),
+                                  O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                                  0644 ) ) )
+  , wakeup_( CheckSystemCall( "eventfd", eventfd( 0, EFD_CLOEXEC ) ) )
+{
+  open_file();
+  flusher_ = thread( [this] { flush_loop(); } );
+}
+
+AccessLog::~AccessLog()
+{
+  stopping_.store( true, memory_order_release );
+  wake_flusher();
+  flusher_.join();
+}
+
+AccessLog::Producer& AccessLog::add_producer()
+{
+  lock_guard<mutex> lock { producers_mutex_ };
+  producers_.push_back( make_unique<Producer>( *this ) );
+  return *producers_.back();
+}
+
+uint64_t AccessLog::wall_ns( const uint64_t ticks ) const
+{
+  if ( ticks >= origin_ticks_ ) {
+    return origin_wall_ns_ + Timer::ticks_to_ns( ticks - origin_ticks_ );
+  }
+  return origin_wall_ns_ - Timer::ticks_to_ns( origin_ticks_ - ticks );
+}
+
+void AccessLog::wake_flusher()
+{
+  const uint64_t one = 1;
+  CheckSystemCall( "write",
+                   ::write( wakeup_.fd_num(), &one, sizeof( one ) ) );
+}
+
+// starts a new file with a header; carries on from the end of an old one
+void AccessLog::open_file()
+{
+  struct stat st {};
+  CheckSystemCall( "fstat " + path_, fstat( file_.fd_num(), &st ) );
+  file_bytes_ = st.st_size;
+
+  if ( file_bytes_ == 0 ) {
+    FileHeader header {};
+    memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+    header.version = VERSION;
+    header.record_size = sizeof( Record );
+
+    const string_view bytes { reinterpret_cast<const char*>( &header ),
+                              sizeof( header ) };
+    for ( string_view unwritten = bytes; not unwritten.empty(); ) {
+      unwritten.remove_prefix( file_.write( unwritten ) );
+    }
+    file_bytes_ = sizeof( header );
+  }
+}
+
+static void rename_if_exists( const string& from, const string& to )
+{
+  if ( rename( from.c_str(), to.c_str() ) < 0 and errno != ENOENT ) {
+    throw unix_error( "rename " + from );
+  }
+}
+
+void AccessLog::rotate()
+{
+  if ( keep_ == 0 ) {
+    CheckSystemCall( "unlink " + path_, unlink( path_.c_str() ) );
+  } else {
+    for ( unsigned int i = keep_ - 1; i > 0; i-- ) {
+      rename_if_exists( path_ + "." + to_string( i ),
+                        path_ + "." + to_string( i + 1 ) );
+    }
+    rename_if_exists( path_, path_ + ".1" );
+  }
+
+  file_ = FileDescriptor { CheckSystemCall(
+    "open " + path_,
+    open( path_.c_str(),
+          O_WRONLY | O_CREAT | O_APPEND | O_TRUNC | O_CLOEXEC,
+          0644 ) ) };
+  open_file();
+  rotations_.fetch_add( 1, memory_order_relaxed );
+}
+
+bool AccessLog::flush()
+{
+  // producers are never removed, so the lock needn't be held while writing
+  // (and an event loop adding a producer or reading metrics never waits on
+  // the disk)
+  vector<Producer*> producers;
+  {
+    lock_guard<mutex> lock { producers_mutex_ };
+    for ( const auto& producer : producers_ ) {
+      producers.push_back( producer.get() );
+    }
+  }
+
+  // whole records only, straight from each ring
+  vector<string_view> regions;
+  uint64_t total = 0;
+  for ( Producer* producer : producers ) {
+    string_view region = producer->ring_.readable_region( sizeof( Record ) );
+    region.remove_suffix( region.size() % sizeof( Record ) );
+    regions.push_back( region );
+    total += region.size();
+  }
+
+  if ( total == 0 ) {
+    return false;
+  }
+
+  if ( file_bytes_ + total > max_file_bytes_
+       and file_bytes_ > sizeof( FileHeader ) ) {
+    rotate();
+  }
+
+  // one writev for the lot, and more only if the kernel took part of it
+  vector<string_view> unwritten = regions;
+  while ( not unwritten.empty() ) {
+    size_t written = file_.write( unwritten );
+    while ( not unwritten.empty() and written >= unwritten.front().size() ) {
+      written -= unwritten.front().size();
+      unwritten.erase( unwritten.begin() );
+    }
+    if ( not unwritten.empty() ) {
+      unwritten.front().remove_prefix( written );
+    }
+  }
+
+  for ( size_t i = 0; i < regions.size(); i++ ) {
+    producers[i]->ring_.pop( regions[i].size() );
+  }
+
+  file_bytes_ += total;
+  bytes_written_.fetch_add( total, memory_order_relaxed );
+  return true;
+}
+
+void AccessLog::flush_loop()
+{
+  while ( true ) {
+    pollfd wakeup { wakeup_.fd_num(), POLLIN, 0 };
+    CheckSystemCall( "poll", poll( &wakeup, 1, FLUSH_INTERVAL_MS ) );
+    if ( wakeup.revents & POLLIN ) {
+      uint64_t wakeups;
+      CheckSystemCall(
+        "read", ::read( wakeup_.fd_num(), &wakeups, sizeof( wakeups ) ) );
+    }
+
+    const bool stopping = stopping_.load( memory_order_acquire );
+
+    while ( flush() )
+      ;
+
+    if ( stopping ) {
+      return;
+    }
+  }
+}
+
+void AccessLog::write_metrics( PrometheusText& out )
+{
+  uint64_t appended = 0, dropped = 0;
+  {
+    lock_guard<mutex> lock { producers_mutex_ };
+    for ( const auto& producer : producers_ ) {
+      appended += producer->appended_.load();
+      dropped += producer->dropped_.load();
+    }
+  }
+
+  out.family( "mycached_access_log_records_total",
+              "counter",
+              "Access log records, by whether they were queued for writing "
+              "or dropped because the log fell behind" );
+  out.sample( "mycached_access_log_records_total",
+              PrometheusText::label( "result", "appended" ),
+              appended );
+  out.sample( "mycached_access_log_records_total",
+              PrometheusText::label( "result", "dropped" ),
+              dropped );
+
+  out.family( "mycached_access_log_written_bytes_total",
+              "counter",
+              "Bytes of records written to the access log" );
+  out.sample( "mycached_access_log_written_bytes_total",
+              "",
+              bytes_written_.load( memory_order_relaxed ) );
+
+  out.family( "mycached_access_log_rotations_total",
+              "counter",
+              "Times the access log file was rotated" );
+  out.sample( "mycached_access_log_rotations_total",
+              "",
+              rotations_.load( memory_order_relaxed ) );
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/file_descriptor.hh"
+#include "util/per_thread.hh"
+#include "util/spsc_ring_buffer.hh"
+
+class PrometheusText;
+
+//! A binary log of every request mycached answers, for capacity planning.
+//! Each event loop thread appends fixed-size records to its own Producer (a
+//! single-producer ring, so appending is a copy and a store); a flusher thread
+//! gathers whatever the rings hold into one large sequential write every
+//! FLUSH_INTERVAL_MS, or sooner when a ring fills up. When the file reaches
+//! its size limit it is rotated: PATH becomes PATH.1, PATH.1 becomes PATH.2,
+//! and so on, keeping `keep` old files. If the disk can't keep up and a ring
+//! is full, records are dropped and counted, and the event loop never waits.
+//!
+//! Each file starts with a FileHeader, then holds Records in the machine's
+//! byte order; mycached-access-log turns them back into text or CSV.
+class AccessLog
+{
+public:
+  enum class Op : uint8_t
+  {
+    Get,
+    Put,
+    Other,
+  };
+
+  struct Record
+  {
+    uint64_t timestamp_ns; //!< wall-clock time the request's first byte was
+                           //!< received, since the Unix epoch
+    uint64_t key_hash;     //!< fnv1a() of the key
+    uint64_t latency_ns;   //!< from first byte received to response ready
+    uint32_t value_size;   //!< of the value stored or returned
+    uint16_t status;       //!< HTTP status code of the response
+    Op op;
+    uint8_t reserved;
+  };
+
+  struct FileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+  };
+
+  static constexpr char MAGIC[8] = { 'M', 'Y', 'C', 'A', 'C', 'C', 'L', 'G' };
+  static constexpr uint32_t VERSION = 1;
+
+  static constexpr size_t RING_SIZE = 1 << 20; //!< per producer
+  static constexpr int FLUSH_INTERVAL_MS = 100;
+
+  //! Where one thread's records wait for the flusher
+  class Producer
+  {
+    friend class AccessLog;
+
+    SpscRingBuffer ring_ { RING_SIZE };
+    AccessLog& log_;
+    size_t unsignalled_ {}; //!< bytes pushed since the flusher was last woken
+    RelaxedCounter appended_ {};
+    RelaxedCounter dropped_ {};
+
+  public:
+    explicit Producer( AccessLog& log )
+      : log_( log )
+    {}
+
+    void append( const Record& record );
+
+    Producer( const Producer& other ) = delete;
+    Producer& operator=( const Producer& other ) = delete;
+  };
+
+private:
+  std::string path_;
+  uint64_t max_file_bytes_;
+  unsigned int keep_;
+
+  // wall-clock time at a known tick count, for timestamping records
+  uint64_t origin_ticks_;
+  uint64_t origin_wall_ns_;
+
+  FileDescriptor file_;
+  uint64_t file_bytes_ {};
+  FileDescriptor wakeup_; //!< eventfd that producers write to when full-ish
+
+  std::mutex producers_mutex_ {};
+  std::vector<std::unique_ptr<Producer>> producers_ {};
+
+  std::atomic<uint64_t> bytes_written_ { 0 };
+  std::atomic<uint64_t> rotations_ { 0 };
+  std::atomic<bool> stopping_ { false };
+  std::thread flusher_ {};
+
+  void open_file();
+  void rotate();
+  void flush_loop();
+
+  //! Writes everything the producers hold
+  //! \returns whether there was anything
+  bool flush();
+
+  void wake_flusher();
+
+public:
+  //! Logs to `path`, rotating it when it would grow past `max_file_bytes`
+  AccessLog( const std::string& path,
+             const uint64_t max_file_bytes,
+             const unsigned int keep );
+
+  //! Writes out what the producers hold, then stops the flusher
+  ~AccessLog();
+
+  //! A new Producer, for the calling thread to append to (it lasts as long as
+  //! the log)
+  Producer& add_producer();
+
+  //! Record::timestamp_ns for the moment Timer::ticks() returned `ticks`
+  uint64_t wall_ns( const uint64_t ticks ) const;
+
+  //! Records appended, dropped and written, bytes written and rotations
+  void write_metrics( PrometheusText& out );
+
+  AccessLog( const AccessLog& other ) = delete;
+  AccessLog& operator=( const AccessLog& other ) = delete;
+};
@@ -0,0 +1,111 @@
+#include <stdexcept>
+
+#include "http/http_request.hh"
+#include "http/http_response_parser.hh"
+#include "local_client.hh"
+
+using namespace std;
+
+static FileDescriptor receive_store_fd( const string& local_socket_path )
+{
+  LocalStreamSocket sock;
+  sock.connect( local_socket_path );
+
+  string payload;
+  FileDescriptor fd = sock.recv_fd( payload );
+
+  if ( payload != shared_store::GREETING ) {
+    throw runtime_error( "LocalClient: unexpected greeting from server" );
+  }
+
+  return fd;
+}
+
+LocalClient::LocalClient( const string& local_socket_path,
+                          const Address& server,
+                          const unsigned int max_attempts )
+  : store_( receive_store_fd( local_socket_path ) )
+  , server_( server )
+  , max_attempts_( max_attempts )
+{}
+
+optional<string> LocalClient::get( const string& key )
+{
+  hot_keys_.offer( key );
+  if ( ++gets_since_decay_ == HOT_KEYS_DECAY_GETS ) {
+    gets_since_decay_ = 0;
+    hot_keys_.decay();
+  }
+
+  if ( const string* replica = replica_.find( key, store_ ) ) {
+    replica_gets_++;
+    return *replica;
+  }
+
+  string value;
+  SharedStoreReader::Version version {};
+
+  switch ( store_.get( key, value, max_attempts_, &version ) ) {
+    case SharedStoreReader::Result::Hit:
+      shared_memory_gets_++;
+      if ( hot_keys_.is_hot( key, REPLICATE_MIN_GETS ) ) {
+        replica_.insert( key, value, version );
+      }
+      return value;
+
+    case SharedStoreReader::Result::Miss:
+      shared_memory_gets_++;
+      return {};
+
+    case SharedStoreReader::Result::Fallback:
+      break;
+  }
+
+  socket_gets_++;
+  return get_over_socket( key );
+}
+
+optional<string> LocalClient::get_over_socket( const string& key )
+{
+  if ( not connection_.has_value() ) {
+    connection_.emplace();
+    connection_->connect( server_ );
+  }
+
+  HTTPRequest request { "GET /" + key + " HTTP/1.1",
+                        { { "Host", server_.to_string() } },
+                        "" };
+
+  HTTPResponseParser responses;
+  responses.new_request_arrived( request );
+
+  string headers;
+  request.serialize_headers( headers );
+  for ( string_view unsent = headers; not unsent.empty(); ) {
+    unsent.remove_prefix( connection_->write( unsent ) );
+  }
+
+  string buffer( 65536, 0 );
+  string unparsed;
+  while ( responses.empty() ) {
+    const size_t bytes_read = connection_->read( { buffer.data(), buffer.size() } );
+    if ( bytes_read == 0 ) {
+      connection_.reset();
+      throw runtime_error( "LocalClient: server closed the connection" );
+    }
+
+    unparsed.append( buffer, 0, bytes_read );
+    unparsed.erase( 0, responses.parse( unparsed ) );
+  }
+
+  const HTTPResponse& response = responses.front();
+
+  if ( response.status_code() == "200" ) {
+    return response.body();
+  } else if ( response.status_code() == "404" ) {
+    return {};
+  }
+
+  throw runtime_error( "LocalClient: unexpected response: "
+                       + string( response.first_line() ) );
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "replica_cache.hh"
+#include "util/address.hh"
+#include "util/hot_keys.hh"
+#include "util/shared_store.hh"
+#include "util/socket.hh"
+
+//! A client for a mycached server on the same host. GETs are answered from
+//! the server's shared-memory index without a system call when possible, and
+//! sent over TCP when the index can't give a definite answer.
+//!
+//! Note that a GET sent to the server consumes the key, while a GET answered
+//! from shared memory leaves it in place.
+//!
+//! Each client (meant to be one per thread) also finds the keys it reads most
+//! with a HotKeys sketch, and keeps copies of their values in a ReplicaCache,
+//! so that many threads reading one celebrity key don't all probe the shared
+//! index and copy out of its arena. A write to the key invalidates the copies.
+class LocalClient
+{
+  //! GETs sampled for hot keys: 1 in HOT_KEYS_SAMPLE, with the counts halved
+  //! every HOT_KEYS_DECAY_GETS
+  static constexpr uint32_t HOT_KEYS_SAMPLE = 8;
+  static constexpr uint64_t HOT_KEYS_DECAY_GETS = 1 << 16;
+  static constexpr size_t HOT_KEYS_TOP = 32;
+
+  //! Estimated recent GETs that make a key worth replicating
+  static constexpr uint64_t REPLICATE_MIN_GETS = 64;
+  static constexpr size_t REPLICA_CAPACITY = 32;
+
+  SharedStoreReader store_;
+  Address server_;
+  std::optional<TCPSocket> connection_ {};
+
+  unsigned int max_attempts_;
+
+  HotKeys hot_keys_ { HOT_KEYS_TOP, HOT_KEYS_SAMPLE };
+  uint64_t gets_since_decay_ { 0 };
+  ReplicaCache replica_ { REPLICA_CAPACITY };
+
+  size_t replica_gets_ { 0 };
+  size_t shared_memory_gets_ { 0 };
+  size_t socket_gets_ { 0 };
+
+  std::optional<std::string> get_over_socket( const std::string& key );
+
+public:
+  //! \param[in] local_socket_path is where the server hands out its memfd
+  //! \param[in] server is the server's TCP address, used for fallbacks
+  //! \param[in] max_attempts bounds the retries on a slot being rewritten
+  LocalClient( const std::string& local_socket_path,
+               const Address& server,
+               const unsigned int max_attempts = 16 );
+
+  //! \returns the value stored under `key`, if any
+  std::optional<std::string> get( const std::string& key );
+
+  size_t replica_gets() const { return replica_gets_; }
+  uint64_t replica_invalidations() const { return replica_.stale(); }
+  size_t shared_memory_gets() const { return shared_memory_gets_; }
+  size_t socket_gets() const { return socket_gets_; }
+};
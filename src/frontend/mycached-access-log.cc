@@ -0,0 +1,128 @@
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "access_log.hh"
+#include "util/timer.hh"
+
+using namespace std;
+
+void usage( char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [--csv] FILE...\n\n"
+       << "Prints the records of mycached access logs (see "
+       << "MYCACHED_ACCESS_LOG) as\ntext, or as CSV with --csv." << endl;
+}
+
+static const char* op_name( const AccessLog::Op op )
+{
+  switch ( op ) {
+    case AccessLog::Op::Get:
+      return "GET";
+    case AccessLog::Op::Put:
+      return "PUT";
+    default:
+      return "OTHER";
+  }
+}
+
+// local wall-clock time, to the microsecond
+static void write_wall_time( ostream& out, const uint64_t ns )
+{
+  const time_t seconds = ns / 1'000'000'000;
+  tm local {};
+  localtime_r( &seconds, &local );
+  out << put_time( &local, "%Y-%m-%d %H:%M:%S" ) << '.' << setw( 6 )
+      << setfill( '0' ) << ns % 1'000'000'000 / 1000 << setfill( ' ' );
+}
+
+static void write_record( ostream& out,
+                          const AccessLog::Record& record,
+                          const bool csv )
+{
+  if ( csv ) {
+    out << record.timestamp_ns << ',' << op_name( record.op ) << ','
+        << record.status << ',' << hex << setw( 16 ) << setfill( '0' )
+        << record.key_hash << dec << setfill( ' ' ) << ','
+        << record.value_size << ',' << record.latency_ns << '\n';
+    return;
+  }
+
+  const string latency = Timer::pp_ns( record.latency_ns );
+  write_wall_time( out, record.timestamp_ns );
+  out << ' ' << op_name( record.op ) << ' ' << record.status << " key="
+      << hex << setw( 16 ) << setfill( '0' ) << record.key_hash << dec
+      << setfill( ' ' ) << " value=" << record.value_size
+      << " latency=" << latency.substr( latency.find_first_not_of( ' ' ) )
+      << '\n';
+}
+
+// returns the number of records
+static uint64_t decode( const string& path, const bool csv )
+{
+  ifstream in { path, ios::binary };
+  if ( not in ) {
+    throw runtime_error( "can't open " + path );
+  }
+
+  AccessLog::FileHeader header {};
+  if ( not in.read( reinterpret_cast<char*>( &header ), sizeof( header ) )
+       or memcmp( header.magic, AccessLog::MAGIC, sizeof( header.magic ) )
+       or header.version != AccessLog::VERSION
+       or header.record_size != sizeof( AccessLog::Record ) ) {
+    throw runtime_error( path + " is not a version "
+                         + to_string( AccessLog::VERSION )
+                         + " mycached access log from this machine" );
+  }
+
+  uint64_t count = 0;
+  AccessLog::Record record {};
+  while ( in.read( reinterpret_cast<char*>( &record ), sizeof( record ) ) ) {
+    write_record( cout, record, csv );
+    count++;
+  }
+
+  if ( in.gcount() != 0 ) {
+    cerr << path << ": ignoring " << in.gcount()
+         << " bytes of a partly written record\n";
+  }
+
+  return count;
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    const bool csv = argc > 1 and argv[1] == string( "--csv" );
+    const int first_file = csv ? 2 : 1;
+
+    if ( argc <= first_file ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    if ( csv ) {
+      cout << "timestamp_ns,op,status,key_hash,value_size,latency_ns\n";
+    }
+
+    uint64_t records = 0;
+    for ( int i = first_file; i < argc; i++ ) {
+      records += decode( argv[i], csv );
+    }
+
+    cerr << records << " records\n";
+  } catch ( const exception& e ) {
+    cout << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
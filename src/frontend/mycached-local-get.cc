@@ -0,0 +1,45 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "local_client.hh"
+
+using namespace std;
+
+void usage( char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " LOCAL_SOCKET_PATH HOST PORT KEY..." << endl;
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    if ( argc < 5 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    LocalClient client { argv[1], { argv[2], argv[3] } };
+
+    for ( int i = 4; i < argc; i++ ) {
+      const auto value = client.get( argv[i] );
+      if ( value.has_value() ) {
+        cout << argv[i] << ": " << value.value() << "\n";
+      } else {
+        cout << argv[i] << ": (not found)\n";
+      }
+    }
+
+    cerr << "replica gets: " << client.replica_gets()
+         << ", shared-memory gets: " << client.shared_memory_gets()
+         << ", socket gets: " << client.socket_gets() << "\n";
+  } catch ( const exception& e ) {
+    cout << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
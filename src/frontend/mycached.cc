@@ -1,14 +1,33 @@
+#include <charconv>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <optional>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include <unistd.h>
+
 #include "http/http_server.hh"
+#include "access_log.hh"
+#include "http/slow_request_log.hh"
+#include "snapshot.hh"
+#include "store_stats.hh"
 #include "util/eventloop.hh"
 #include "util/exception.hh"
+#include "util/fnv1a.hh"
+#include "util/hot_keys.hh"
+#include "util/probes.hh"
+#include "util/prometheus.hh"
+#include "util/shared_store.hh"
 #include "util/socket.hh"
 #include "util/tokenize.hh"
+#include "util/write_ahead_log.hh"
 
 using namespace std;
 
@@ -18,11 +37,84 @@ constexpr auto to_underlying( E e ) noexcept
   return static_cast<std::underlying_type_t<E>>( e );
 }
 
+// environment variables that turn on event loop tracing, hardware
+// performance counters, the slow request log, Server-Timing headers, the
+// access log, overload shedding, snapshots and the write-ahead log
+static constexpr char const* TRACE_ENV = "MYCACHED_TRACE";
+static constexpr char const* PERF_ENV = "MYCACHED_PERF_COUNTERS";
+static constexpr char const* SLOW_LOG_ENV = "MYCACHED_SLOW_LOG";
+static constexpr char const* SLOW_US_ENV = "MYCACHED_SLOW_US";
+static constexpr char const* SERVER_TIMING_ENV = "MYCACHED_SERVER_TIMING";
+static constexpr char const* ACCESS_LOG_ENV = "MYCACHED_ACCESS_LOG";
+static constexpr char const* ACCESS_LOG_MB_ENV = "MYCACHED_ACCESS_LOG_MB";
+static constexpr char const* SHED_LAG_US_ENV = "MYCACHED_SHED_LAG_US";
+static constexpr char const* HOTKEYS_SAMPLE_ENV = "MYCACHED_HOTKEYS_SAMPLE";
+static constexpr char const* SNAPSHOT_ENV = "MYCACHED_SNAPSHOT";
+static constexpr char const* WAL_ENV = "MYCACHED_WAL";
+static constexpr char const* WAL_COMMIT_US_ENV = "MYCACHED_WAL_COMMIT_US";
+static constexpr char const* WAL_BATCH_ENV = "MYCACHED_WAL_BATCH";
+
+static constexpr uint64_t DEFAULT_SLOW_US = 10'000;
+static constexpr uint64_t DEFAULT_ACCESS_LOG_MB = 64;
+static constexpr unsigned int ACCESS_LOGS_KEPT = 4;
+
+// hot-key detection: one GET or PUT key in every HOTKEYS_SAMPLE (on average)
+// is counted, and the counts are halved every HOTKEYS_DECAY_NS
+static constexpr uint32_t DEFAULT_HOTKEYS_SAMPLE = 64;
+static constexpr size_t HOTKEYS_TOP = 32;
+static constexpr uint64_t HOTKEYS_DECAY_NS = 10'000'000'000;
+
+// group commit: the write-ahead log is synced once the oldest waiting change
+// has waited WAL_COMMIT_US, or sooner once WAL_BATCH changes are waiting
+static constexpr uint64_t DEFAULT_WAL_COMMIT_US = 0;
+static constexpr uint64_t DEFAULT_WAL_BATCH = 256;
+
 void usage( char* argv0 )
 {
-  cerr << "Usage: " << argv0 << " PORT" << endl;
+  cerr << "Usage: " << argv0 << " PORT [LOCAL_SOCKET_PATH]\n\n"
+       << "With " << TRACE_ENV << "=PREFIX set, 1 in 100 event loop wakeups "
+       << "are traced,\nand SIGUSR1 writes the recent ones to PREFIX<thread "
+       << "ID>.json (Chrome\ntrace format).\n\n"
+       << "With " << PERF_ENV << " set, hardware performance counters are "
+       << "read around\nthe callbacks of 1 in 100 event loop wakeups and "
+       << "reported on /_metrics.\n\n"
+       << "With " << SLOW_LOG_ENV << "=PATH set, requests that take at least "
+       << SLOW_US_ENV << " µs\n(default " << DEFAULT_SLOW_US << ") from "
+       << "first byte received to last byte sent are\nappended to PATH, "
+       << "with the time spent in each phase.\n\n"
+       << "With " << SERVER_TIMING_ENV << " set, responses carry a "
+       << "Server-Timing header\nwith the phases up to processing.\n\n"
+       << "With " << ACCESS_LOG_ENV << "=PATH set, every request is logged "
+       << "to PATH in binary\n(decode it with mycached-access-log). The log "
+       << "is rotated at " << ACCESS_LOG_MB_ENV << "\nMiB (default "
+       << DEFAULT_ACCESS_LOG_MB << "), keeping " << ACCESS_LOGS_KEPT
+       << " old files.\n\n"
+       << "With " << SHED_LAG_US_ENV << "=N set, while the event loop is "
+       << "more than N µs\nbehind (see EventLoop::lag_ns), new connections "
+       << "are closed at once and\nPUTs are answered with 503.\n\n"
+       << "A request with an X-Deadline header (Unix time in milliseconds) "
+       << "that is\nalready past when mycached gets to it is answered with "
+       << "504, undone.\n\n"
+       << "GET /_hotkeys lists the most requested keys, from a sample of 1 "
+       << "in " << HOTKEYS_SAMPLE_ENV << "\n(default "
+       << DEFAULT_HOTKEYS_SAMPLE << ") GETs and PUTs; 0 turns sampling off."
+       << "\n\nWith " << SNAPSHOT_ENV << "=PATH set, the store is loaded from "
+       << "the snapshot at PATH\n(if there is one) on startup, and saved to "
+       << "it on POST /_save, or by a\nforked child on POST /_bgsave.\n\n"
+       << "With " << WAL_ENV << "=PATH set, PUTs and the erasures done by "
+       << "GETs are logged\nto PATH, and a PUT is answered only once the "
+       << "log is synced to disk. The log\nis synced after "
+       << WAL_COMMIT_US_ENV << " µs (default " << DEFAULT_WAL_COMMIT_US
+       << "), or once " << WAL_BATCH_ENV << "\nchanges (default "
+       << DEFAULT_WAL_BATCH << ") are waiting. It is replayed on startup "
+       << "(after the\nsnapshot), and emptied by POST /_save." << endl;
 }
 
+// geometry of the shared-memory index (the memfd is sparse, so unused space
+// costs nothing)
+static constexpr size_t SHARED_STORE_SLOTS = 1 << 20;
+static constexpr size_t SHARED_STORE_ARENA_SIZE = size_t { 1 } << 30;
+
 enum class RuleCategory : size_t
 {
   SocketRead,
@@ -43,17 +135,238 @@ static constexpr char const*
 
 static size_t CATEGORY_IDS[to_underlying( RuleCategory::COUNT )] = { 0 };
 
+static constexpr size_t RULES_PER_CLIENT = 5;
+
+// GETs of these keys return, in Prometheus text format, the server's metrics
+// (event loop, timers and buffers), the store's statistics and the hottest
+// keys
+static constexpr char const* METRICS_KEY = "_metrics";
+static constexpr char const* STATS_KEY = "_stats";
+static constexpr char const* HOTKEYS_KEY = "_hotkeys";
+
+// POSTs to these keys save a snapshot of the store, on the event loop's thread
+// (which waits for it) or in a forked child
+static constexpr char const* SAVE_KEY = "_save";
+static constexpr char const* BGSAVE_KEY = "_bgsave";
+
+// per-client work allowed in each call to wait_next_event, so that a client
+// pipelining a long run of requests can't starve the others (a response takes
+// up to three writes: headers, body, and moving on to the next response)
+static constexpr unsigned int REQUESTS_PER_TURN = 16;
+static constexpr unsigned int RESPONSE_WRITES_PER_TURN = 3 * REQUESTS_PER_TURN;
+
+static HTTPResponse prometheus_response( const PrometheusText& page )
+{
+  string body = page.str();
+
+  return { "HTTP/1.1 200 OK",
+           { { "Server", "mycached/0.0.1" },
+             { "Content-Type", PrometheusText::CONTENT_TYPE },
+             { "Content-Length", to_string( body.length() ) } },
+           move( body ) };
+}
+
+// USDT probes through the life of a connection and its requests (arguments
+// are the connection ID, then the key's length and the value's size):
+//
+//   accept( id )                          new connection
+//   request_parsed( id, key, value )      value is the request body's size
+//   request_processed( id, key, value )   value is the stored or returned
+//                                         value's size
+//   response_written( id )                last byte of a response handed to
+//                                         the connection
+//   close( id )
+//
+// e.g. time from parsing to the response being written, by connection:
+//   bpftrace -e 'usdt:./mycached:request_parsed { @s[arg0] = nsecs; }
+//     usdt:./mycached:response_written /@s[arg0]/ {
+//     @us = hist((nsecs - @s[arg0]) / 1000); delete(@s[arg0]); }'
+// (this assumes one request in flight per connection)
+USDT_SEMAPHORE( mycached, accept );
+USDT_SEMAPHORE( mycached, request_parsed );
+USDT_SEMAPHORE( mycached, request_processed );
+USDT_SEMAPHORE( mycached, response_written );
+USDT_SEMAPHORE( mycached, close );
+
+// length of the key in a request's first line ("GET /key HTTP/1.1")
+static size_t key_length( const string_view first_line )
+{
+  const size_t start = first_line.find( " /" );
+  if ( start == string_view::npos ) {
+    return 0;
+  }
+
+  const size_t end = first_line.find( ' ', start + 2 );
+  return ( end == string_view::npos ? first_line.size() : end ) - start - 2;
+}
+
+static HTTPResponse text_response( const string& status, string&& body )
+{
+  return { "HTTP/1.1 " + status,
+           { { "Server", "mycached/0.0.1" },
+             { "Content-Type", "text/plain" },
+             { "Content-Length", to_string( body.length() ) } },
+           move( body ) };
+}
+
+// Snapshots saved, and the one loaded on startup
+struct SnapshotStats
+{
+  uint64_t saves_ok {};
+  uint64_t saves_failed {};
+  uint64_t last_save_ns {};
+  uint64_t load_ns {};
+  uint64_t loaded_bytes {};
+};
+
+static void write_snapshot_stats( PrometheusText& out,
+                                  const SnapshotStats& stats )
+{
+  out.family( "mycached_snapshot_saves_total",
+              "counter",
+              "Snapshots saved, by whether the save succeeded" );
+  out.sample( "mycached_snapshot_saves_total",
+              PrometheusText::label( "result", "ok" ),
+              stats.saves_ok );
+  out.sample( "mycached_snapshot_saves_total",
+              PrometheusText::label( "result", "failed" ),
+              stats.saves_failed );
+
+  out.family( "mycached_snapshot_last_save_seconds",
+              "gauge",
+              "How long the last snapshot save took" );
+  out.sample(
+    "mycached_snapshot_last_save_seconds", "", stats.last_save_ns / 1e9 );
+
+  out.family( "mycached_snapshot_load_seconds",
+              "gauge",
+              "How long loading the snapshot took on startup" );
+  out.sample( "mycached_snapshot_load_seconds", "", stats.load_ns / 1e9 );
+
+  out.family( "mycached_snapshot_loaded_bytes",
+              "gauge",
+              "Size of the snapshot loaded on startup" );
+  out.sample( "mycached_snapshot_loaded_bytes", "", stats.loaded_bytes );
+}
+
+// Loads the snapshot at `path` into the (empty) store and reports how long it
+// took: verifying and copying out the records runs on every core, then
+// building the index runs on this thread
+static void load_snapshot( const string& path,
+                           snapshot::Store& data_store,
+                           optional<SharedStoreWriter>& shared_store,
+                           SnapshotStats& stats )
+{
+  const unsigned int threads = max( thread::hardware_concurrency(), 1u );
+
+  const uint64_t start = Timer::timestamp_ns();
+  snapshot::Loaded loaded = snapshot::load( path, threads );
+  const uint64_t copied = Timer::timestamp_ns();
+
+  data_store.reserve( loaded.items );
+  for ( auto& shard : loaded.shards ) {
+    for ( auto& [key, value] : shard ) {
+      store_stats().stored( key.size(), value.size() );
+      if ( shared_store.has_value() ) {
+        shared_store->put( key, value );
+      }
+      data_store.emplace( move( key ), move( value ) );
+    }
+    vector<pair<string, string>>().swap( shard );
+  }
+  const uint64_t end = Timer::timestamp_ns();
+
+  stats.load_ns = end - start;
+  stats.loaded_bytes = loaded.bytes;
+
+  cerr << "Loaded " << loaded.items << " items (" << loaded.bytes
+       << " bytes) from " << path << " in " << Timer::pp_ns( end - start )
+       << ", " << double( loaded.bytes ) / ( end - start ) << " GB/s\n"
+       << "  verifying and copying on " << threads
+       << " threads: " << Timer::pp_ns( copied - start ) << " ("
+       << double( loaded.bytes ) / ( copied - start ) << " GB/s)\n"
+       << "  indexing: " << Timer::pp_ns( end - copied ) << "\n";
+}
+
+// Work turned away to keep latency down for the clients already being served
+struct OverloadStats
+{
+  uint64_t accepts_refused {};
+  uint64_t puts_shed {};
+  uint64_t past_deadline {};
+};
+
+static void write_overload_stats( PrometheusText& out,
+                                  const OverloadStats& stats )
+{
+  out.family( "mycached_shed_total",
+              "counter",
+              "Work turned away: connections closed and PUTs refused while "
+              "the event loop lagged, and requests already past their "
+              "X-Deadline" );
+  out.sample( "mycached_shed_total",
+              PrometheusText::label( "reason", "accept" ),
+              stats.accepts_refused );
+  out.sample( "mycached_shed_total",
+              PrometheusText::label( "reason", "put" ),
+              stats.puts_shed );
+  out.sample( "mycached_shed_total",
+              PrometheusText::label( "reason", "deadline" ),
+              stats.past_deadline );
+}
+
+// whether the request's X-Deadline (Unix time in milliseconds) has passed; a
+// missing or malformed header is no deadline
+static bool past_deadline( const HTTPRequest& request )
+{
+  if ( not request.has_header( "X-Deadline" ) ) {
+    return false;
+  }
+
+  const string_view value = request.get_header_value( "X-Deadline" );
+  uint64_t deadline_ms = 0;
+  const auto [end, error] = from_chars( value.data(),
+                                        value.data() + value.size(),
+                                        deadline_ms );
+  if ( error != errc() or end != value.data() + value.size() ) {
+    return false;
+  }
+
+  const uint64_t now_ms = chrono::duration_cast<chrono::milliseconds>(
+                            chrono::system_clock::now().time_since_epoch() )
+                            .count();
+  return now_ms > deadline_ms;
+}
+
+// A response held until the write-ahead log has made the PUT it answers
+// durable (or, for any other response, until the held responses ahead of it
+// on its connection have gone)
+struct HeldResponse
+{
+  uint64_t lsn; //!< that must be durable first (0 if none)
+  HTTPResponse response;
+  list<RequestTiming> timing; //!< taken from the request when it was popped
+  string key;
+  AccessLog::Op op;
+  size_t value_size;
+};
+
+// Per-connection state. An idle client holds no buffers: TCPSession takes
+// them from its pool only while there are bytes in flight.
 struct Client
 {
   uint64_t id;
   TCPSession session;
   HTTPServer http {};
-  list<EventLoop::RuleHandle> handles {};
+  vector<EventLoop::RuleHandle> handles {};
+  list<HeldResponse> held {}; //!< in request order (a list: nothing while idle)
 
   Client( const uint64_t id, TCPSocket&& socket )
     : id( id )
     , session( move( socket ) )
-  {}
+  {
+    handles.reserve( RULES_PER_CLIENT );
+  }
 };
 
 int main( int argc, char* argv[] )
@@ -63,7 +376,7 @@ int main( int argc, char* argv[] )
       abort();
     }
 
-    if ( argc != 2 ) {
+    if ( argc != 2 and argc != 3 ) {
       usage( argv[0] );
       return EXIT_FAILURE;
     }
@@ -75,11 +388,90 @@ int main( int argc, char* argv[] )
 
     EventLoop event_loop;
 
+    if ( const char* trace_prefix = getenv( TRACE_ENV ) ) {
+      event_loop.enable_tracing();
+      EventTrace::dump_on_signal( SIGUSR1, trace_prefix );
+    }
+
+    if ( getenv( PERF_ENV ) and not event_loop.enable_perf_counters() ) {
+      cerr << "Warning: no hardware performance counters are available\n";
+    }
+
+    unique_ptr<SlowRequestLog> slow_log;
+    if ( const char* path = getenv( SLOW_LOG_ENV ) ) {
+      const char* slow_us = getenv( SLOW_US_ENV );
+      const uint64_t threshold_us
+        = slow_us ? stoull( slow_us ) : DEFAULT_SLOW_US;
+      slow_log = make_unique<SlowRequestLog>( path, threshold_us * 1000 );
+    }
+
+    const bool server_timing = getenv( SERVER_TIMING_ENV ) != nullptr;
+
+    optional<uint64_t> shed_lag_ns;
+    if ( const char* shed_lag_us = getenv( SHED_LAG_US_ENV ) ) {
+      shed_lag_ns = stoull( shed_lag_us ) * 1000;
+    }
+    OverloadStats overload_stats;
+
+    const char* hotkeys_sample = getenv( HOTKEYS_SAMPLE_ENV );
+    const uint32_t hotkeys_sample_period
+      = hotkeys_sample ? stoul( hotkeys_sample ) : DEFAULT_HOTKEYS_SAMPLE;
+    optional<HotKeys> hot_keys;
+    if ( hotkeys_sample_period ) {
+      hot_keys.emplace( HOTKEYS_TOP, hotkeys_sample_period );
+      event_loop.add_periodic_timer(
+        "hot keys decay", HOTKEYS_DECAY_NS, [&] { hot_keys->decay(); } );
+    }
+    auto overloaded = [&] {
+      return shed_lag_ns.has_value() and event_loop.lag_ns() > *shed_lag_ns;
+    };
+
+    unique_ptr<AccessLog> access_log;
+    AccessLog::Producer* access_log_producer = nullptr;
+    if ( const char* path = getenv( ACCESS_LOG_ENV ) ) {
+      const char* log_mb = getenv( ACCESS_LOG_MB_ENV );
+      const uint64_t max_mb = log_mb ? stoull( log_mb ) : DEFAULT_ACCESS_LOG_MB;
+      access_log
+        = make_unique<AccessLog>( path, max_mb << 20, ACCESS_LOGS_KEPT );
+      access_log_producer = &access_log->add_producer();
+    }
+
+    auto log_access = [&]( const Client& client,
+                           const string_view key,
+                           const AccessLog::Op op,
+                           const size_t value_size ) {
+      if ( not access_log_producer ) {
+        return;
+      }
+
+      const RequestTiming& timing = client.http.last_response_timing();
+      const uint64_t received = timing.ticks[RequestTiming::Received];
+      const uint64_t processed = timing.ticks[RequestTiming::Processed];
+
+      access_log_producer->append( { access_log->wall_ns( received ),
+                                     fnv1a( key ),
+                                     Timer::ticks_to_ns( processed - received ),
+                                     static_cast<uint32_t>( value_size ),
+                                     timing.status,
+                                     op,
+                                     0 } );
+    };
+
     // initialize the categories
     for ( size_t i = 0; i < to_underlying( RuleCategory::COUNT ); i++ ) {
       CATEGORY_IDS[i] = event_loop.add_category( CATEGORY_NAMES[i] );
     }
 
+    event_loop.set_category_budget(
+      CATEGORY_IDS[to_underlying( RuleCategory::HTTPServerRead )],
+      REQUESTS_PER_TURN );
+    event_loop.set_category_budget(
+      CATEGORY_IDS[to_underlying( RuleCategory::ProcessRequest )],
+      REQUESTS_PER_TURN );
+    event_loop.set_category_budget(
+      CATEGORY_IDS[to_underlying( RuleCategory::HTTPServerWrite )],
+      RESPONSE_WRITES_PER_TURN );
+
     const uint16_t port = static_cast<uint16_t>( stoi( argv[1] ) );
     const Address listen_address { "0.0.0.0", port };
 
@@ -87,13 +479,178 @@ int main( int argc, char* argv[] )
     listen_sock.set_reuseaddr();
     listen_sock.set_blocking( false );
     listen_sock.bind( listen_address );
-    listen_sock.listen();
+    listen_sock.listen( 4096 );
+
+    // opt-in: publish the store in shared memory for readers on this host
+    optional<SharedStoreWriter> shared_store;
+    optional<LocalStreamSocket> local_listen_sock;
+
+    if ( argc == 3 ) {
+      shared_store.emplace( SHARED_STORE_SLOTS, SHARED_STORE_ARENA_SIZE );
+
+      unlink( argv[2] );
+      local_listen_sock.emplace();
+      local_listen_sock->bind( argv[2] );
+      local_listen_sock->listen();
+
+      event_loop.add_rule(
+        "local listener",
+        *local_listen_sock,
+        Direction::In,
+        [&] {
+          // a client that has already gone (EPIPE, ECONNRESET, ...) costs
+          // only its own connection, which closes as it goes out of scope
+          try {
+            local_listen_sock->accept().send_fd( shared_store->fd(),
+                                                 shared_store::GREETING );
+          } catch ( const exception& e ) {
+            cerr << "Local client dropped: " << e.what() << "\n";
+          }
+        },
+        [] { return true; },
+        [] { throw runtime_error( "local listen socket cancelled" ); } );
+    }
+
+    // rebuilds the shared index from the store once erasures and replaced
+    // values have left it full of tombstones and dead arena space, or once
+    // keys it had no room for will fit again (the store is only changed on
+    // this thread, so its counters here are the whole store's)
+    auto tidy_shared_store = [&] {
+      const StoreStats& stats = store_stats();
+      if ( shared_store.has_value()
+           and shared_store->wants_rebuild(
+             stats.items.load(),
+             stats.key_bytes.load() + stats.value_bytes.load() ) ) {
+        const uint64_t start = Timer::timestamp_ns();
+        shared_store->rebuild( data_store );
+        cerr << "Rebuilt the shared index (" << data_store.size()
+             << " keys) in " << Timer::pp_ns( Timer::timestamp_ns() - start )
+             << "\n";
+      }
+    };
+
+    const char* snapshot_path = getenv( SNAPSHOT_ENV );
+    SnapshotStats snapshot_stats;
+    if ( snapshot_path and access( snapshot_path, F_OK ) == 0 ) {
+      load_snapshot( snapshot_path, data_store, shared_store, snapshot_stats );
+    }
+
+    // PUTs (and GETs, which erase what they return) are logged, and a PUT's
+    // response is held until the log is durable up to it; the client's later
+    // requests are processed meanwhile, but their responses queue behind it
+    unique_ptr<WriteAheadLog> wal;
+    uint64_t wal_durable_lsn = 0;
+    deque<pair<uint64_t, uint64_t>> wal_waiters; // (LSN, client ID)
+
+    // sends the client's held responses that no longer wait on the log
+    auto release_held = [&]( Client& client ) {
+      while ( not client.held.empty()
+              and client.held.front().lsn <= wal_durable_lsn ) {
+        HeldResponse& held = client.held.front();
+        client.http.push_response( move( held.response ),
+                                   move( held.timing ) );
+        log_access( client, held.key, held.op, held.value_size );
+        client.held.pop_front();
+      }
+    };
+
+    if ( const char* wal_path = getenv( WAL_ENV ) ) {
+      const uint64_t start = Timer::timestamp_ns();
+      const uint64_t replayed = WriteAheadLog::replay(
+        wal_path,
+        [&]( const WriteAheadLog::Op op,
+             const string_view key,
+             const string_view value ) {
+          if ( op == WriteAheadLog::Op::Put ) {
+            const auto [it, inserted] = data_store.emplace( key, value );
+            if ( inserted ) {
+              store_stats().stored( key.size(), value.size() );
+              if ( shared_store.has_value() ) {
+                shared_store->put( it->first, it->second );
+              }
+            }
+          } else if ( auto it = data_store.find( string( key ) );
+                      it != data_store.end() ) {
+            store_stats().removed( key.size(), it->second.size() );
+            data_store.erase( it );
+            if ( shared_store.has_value() ) {
+              shared_store->erase( key );
+            }
+          }
+        } );
+      cerr << "Replayed " << replayed << " records from " << wal_path
+           << " in " << Timer::pp_ns( Timer::timestamp_ns() - start ) << "\n";
+
+      const char* commit_us = getenv( WAL_COMMIT_US_ENV );
+      const char* batch = getenv( WAL_BATCH_ENV );
+      const WriteAheadLog::Config config {
+        commit_us ? stoull( commit_us ) : DEFAULT_WAL_COMMIT_US,
+        batch ? stoull( batch ) : DEFAULT_WAL_BATCH };
+
+      wal = make_unique<WriteAheadLog>(
+        wal_path, event_loop, config, [&]( const uint64_t lsn ) {
+          wal_durable_lsn = lsn;
+          while ( not wal_waiters.empty()
+                  and wal_waiters.front().first <= lsn ) {
+            const auto it = clients.find( wal_waiters.front().second );
+            wal_waiters.pop_front();
+            if ( it == clients.end() ) {
+              continue; // closed while it waited
+            }
+
+            release_held( it->second );
+          }
+        } );
+    }
+
+    // the snapshot and the log may have left tombstones in the shared index
+    tidy_shared_store();
+
+    // the child saving a snapshot in the background, if there is one; its
+    // rule fires once, when the child exits
+    const size_t background_save_category
+      = event_loop.add_category( "background save" );
+    optional<snapshot::BackgroundSave> background_save;
+    optional<EventLoop::RuleHandle> background_save_rule;
+    uint64_t background_save_start = 0;
+
+    auto start_background_save = [&] {
+      background_save.emplace(
+        snapshot::start_background_save( data_store, snapshot_path ) );
+      background_save_start = Timer::timestamp_ns();
+
+      background_save_rule = event_loop.add_rule(
+        background_save_category,
+        background_save->pidfd,
+        Direction::In,
+        [&] {
+          if ( snapshot::finish_background_save( *background_save ) ) {
+            ++snapshot_stats.saves_ok;
+          } else {
+            ++snapshot_stats.saves_failed;
+          }
+          snapshot_stats.last_save_ns
+            = Timer::timestamp_ns() - background_save_start;
+
+          background_save_rule->cancel();
+          background_save_rule.reset();
+          background_save.reset();
+        } );
+    };
 
     event_loop.add_rule(
       "tcp listener",
       listen_sock,
       Direction::In,
       [&]() {
+        if ( overloaded() ) {
+          // closed as soon as it's accepted, rather than left to wait in the
+          // backlog
+          listen_sock.accept();
+          ++overload_stats.accepts_refused;
+          return;
+        }
+
         clients.emplace(
           piecewise_construct,
           forward_as_tuple( client_id ),
@@ -101,8 +658,11 @@ int main( int argc, char* argv[] )
 
         Client& client = clients.at( client_id );
         client.session.socket().set_blocking( false );
+        client.http.set_server_timing( server_timing );
+        USDT_PROBE1( mycached, accept, client.id );
 
         auto cancel_callback = [&] {
+          USDT_PROBE1( mycached, close, client.id );
           for ( auto& handle : client.handles ) {
             handle.cancel();
           }
@@ -122,30 +682,65 @@ int main( int argc, char* argv[] )
           CATEGORY_IDS[to_underlying( RuleCategory::SocketWrite )],
           client.session.socket(),
           Direction::Out,
-          [&] { client.session.do_write(); },
+          [&] {
+            client.session.do_write();
+            client.http.responses_sent(
+              client.session.outbound_bytes(),
+              [&]( const RequestTiming& timing ) {
+                if ( slow_log ) {
+                  slow_log->record( client.id, timing );
+                }
+              } );
+          },
           [&] { return client.session.want_write(); },
           cancel_callback ) );
 
-        client.handles.push_back( event_loop.add_rule(
+        // the rules below are only considered when the session or the
+        // HTTPServer reports progress, so idle clients cost nothing
+        client.handles.push_back( event_loop.add_wakeup_rule(
           CATEGORY_IDS[to_underlying( RuleCategory::HTTPServerRead )],
-          [&] { client.http.read( client.session.inbound_plaintext() ); },
           [&] {
-            return not client.session.inbound_plaintext()
-                         .readable_region()
-                         .empty();
-          } ) );
+            const size_t parsed_before
+              = USDT_ENABLED( mycached, request_parsed )
+                  ? client.http.requests().size()
+                  : 0;
+
+            client.http.read( client.session.inbound_plaintext(),
+                              [&]( const uint64_t offset ) {
+                                return client.session.inbound_arrival( offset );
+                              } );
+            client.session.update_buffers();
+
+            if ( USDT_ENABLED( mycached, request_parsed ) ) {
+              auto it = next( client.http.requests().begin(), parsed_before );
+              for ( ; it != client.http.requests().end(); ++it ) {
+                USDT_PROBE3( mycached,
+                             request_parsed,
+                             client.id,
+                             key_length( it->first_line() ),
+                             it->body().size() );
+              }
+            }
+          },
+          [&] { return not client.session.inbound_plaintext_empty(); } ) );
+        client.session.inbound_wakeup().set( client.handles.back() );
 
-        client.handles.push_back( event_loop.add_rule(
+        client.handles.push_back( event_loop.add_wakeup_rule(
           CATEGORY_IDS[to_underlying( RuleCategory::HTTPServerWrite )],
-          [&] { client.http.write( client.session.outbound_plaintext() ); },
           [&] {
-            return not client.session.outbound_plaintext()
-                         .writable_region()
-                         .empty()
+            if ( client.http.write( client.session.outbound_plaintext() ) ) {
+              USDT_PROBE1( mycached, response_written, client.id );
+            }
+            client.session.update_buffers();
+          },
+          [&] {
+            return not client.session.outbound_plaintext_full()
                    and not client.http.responses_empty();
           } ) );
+        client.session.outbound_wakeup().set( client.handles.back() );
+        client.http.response_wakeup().set( client.handles.back() );
 
-        client.handles.push_back( event_loop.add_rule(
+        client.handles.push_back( event_loop.add_wakeup_rule(
           CATEGORY_IDS[to_underlying( RuleCategory::ProcessRequest )],
           [&] {
             auto& request = client.http.requests_front();
@@ -153,36 +748,200 @@ int main( int argc, char* argv[] )
 
             const string& method = tokens.at( 0 );
             const string& key = tokens.at( 1 ).substr( 1 );
-
-            if ( method == "GET" ) {
-              client.http.push_response(
-                { "HTTP/1.1 200 OK",
+            size_t value_size = 0;
+            HTTPResponse response;
+            uint64_t lsn = 0; // that must be durable before the response
+
+            if ( past_deadline( request ) ) {
+              ++overload_stats.past_deadline;
+              response = { "HTTP/1.1 504 Gateway Timeout",
+                           { { "Server", "mycached/0.0.1" },
+                             { "X-Object-Key", key },
+                             { "Content-Length", "0" } },
+                           "" };
+            } else if ( method == "PUT" and overloaded() ) {
+              ++overload_stats.puts_shed;
+              response = { "HTTP/1.1 503 Service Unavailable",
+                           { { "Server", "mycached/0.0.1" },
+                             { "X-Object-Key", key },
+                             { "Retry-After", "1" },
+                             { "Content-Length", "0" } },
+                           "" };
+            } else if ( method == "GET" and key == METRICS_KEY ) {
+              PrometheusText metrics;
+              global_timer().write_metrics( metrics );
+              event_loop.write_metrics( metrics );
+              session_buffer_context().write_metrics( metrics );
+              if ( access_log ) {
+                access_log->write_metrics( metrics );
+              }
+              write_overload_stats( metrics, overload_stats );
+              write_snapshot_stats( metrics, snapshot_stats );
+              if ( wal ) {
+                wal->write_metrics( metrics );
+              }
+              response = prometheus_response( metrics );
+            } else if ( method == "GET" and key == HOTKEYS_KEY ) {
+              PrometheusText page;
+              page.family( "mycached_hot_key_requests",
+                           "gauge",
+                           "Estimated recent requests for the most requested "
+                           "keys (sampled, and halved every 10 s)" );
+              if ( hot_keys ) {
+                hot_keys->write_metrics( page, "mycached_hot_key_requests" );
+              }
+              response = prometheus_response( page );
+            } else if ( method == "POST"
+                        and ( key == SAVE_KEY or key == BGSAVE_KEY ) ) {
+              if ( not snapshot_path ) {
+                response = text_response(
+                  "409 Conflict", string( SNAPSHOT_ENV ) + " is not set\n" );
+              } else if ( background_save.has_value() ) {
+                response = text_response( "409 Conflict",
+                                          "A background save is running\n" );
+              } else if ( key == BGSAVE_KEY ) {
+                // fork() fails with ENOMEM easily for a big process under
+                // strict overcommit
+                try {
+                  start_background_save();
+                  response = text_response( "202 Accepted",
+                                            "Background save started\n" );
+                } catch ( const exception& e ) {
+                  ++snapshot_stats.saves_failed;
+                  response = text_response( "500 Internal Server Error",
+                                            string( "Background save failed: " )
+                                              + e.what() + "\n" );
+                }
+              } else {
+                const uint64_t start = Timer::timestamp_ns();
+                try {
+                  const auto saved
+                    = snapshot::save( data_store, snapshot_path );
+                  snapshot_stats.last_save_ns = Timer::timestamp_ns() - start;
+                  ++snapshot_stats.saves_ok;
+                  if ( wal ) {
+                    // everything logged so far is in the snapshot
+                    wal->checkpoint();
+                  }
+                  response = text_response(
+                    "200 OK",
+                    "Saved " + to_string( saved.items ) + " items ("
+                      + to_string( saved.bytes ) + " bytes, "
+                      + to_string( saved.shards ) + " shards) in "
+                      + Timer::pp_ns( snapshot_stats.last_save_ns ) + "\n" );
+                } catch ( const exception& e ) {
+                  ++snapshot_stats.saves_failed;
+                  response = text_response( "500 Internal Server Error",
+                                            string( "Save failed: " )
+                                              + e.what() + "\n" );
+                }
+              }
+            } else if ( method == "GET" and key == STATS_KEY ) {
+              PrometheusText stats;
+              write_store_stats( stats );
+              response = prometheus_response( stats );
+            } else if ( method == "GET" ) {
+              if ( hot_keys ) {
+                hot_keys->offer( key );
+              }
+              auto it = data_store.find( key );
+
+              if ( it == data_store.end() ) {
+                ++store_stats().get_misses;
+                response = { "HTTP/1.1 404 Not Found",
+                             { { "Server", "mycached/0.0.1" },
+                               { "X-Object-Key", key },
+                               { "Content-Length", "0" } },
+                             "" };
+              } else {
+                ++store_stats().get_hits;
+                store_stats().removed( key.size(), it->second.size() );
+                value_size = it->second.size();
+
+                response = {
+                  "HTTP/1.1 200 OK",
                   { { "Server", "mycached/0.0.1" },
                     { "X-Object-Key", key },
-                    { "Content-Length",
-                      to_string( data_store.at( key ).length() ) } },
-                  move( data_store.at( key ) ) } );
-
-              data_store.erase( key );
+                    { "Content-Length", to_string( it->second.length() ) } },
+                  move( it->second ) };
+
+                data_store.erase( it );
+
+                if ( shared_store.has_value() ) {
+                  shared_store->erase( key );
+                  tidy_shared_store();
+                }
+                if ( wal ) {
+                  wal->append( WriteAheadLog::Op::Erase, key, {} );
+                }
+              }
             } else if ( method == "PUT" ) {
-              data_store.emplace( key, move( request.body() ) );
-
-              client.http.push_response( { "HTTP/1.1 200 OK",
-                                           { { "Server", "mycached/0.0.1" },
-                                             { "X-Object-Key", key },
-                                             { "Content-Length", "0" } },
-                                           "" } );
+              if ( hot_keys ) {
+                hot_keys->offer( key );
+              }
+              value_size = request.body().size();
+              const auto [it, inserted]
+                = data_store.emplace( key, move( request.body() ) );
+
+              if ( inserted ) {
+                ++store_stats().puts_stored;
+                store_stats().stored( key.size(), it->second.size() );
+              } else {
+                ++store_stats().puts_existing;
+              }
+
+              if ( inserted and shared_store.has_value() ) {
+                shared_store->put( key, it->second );
+                tidy_shared_store();
+              }
+              if ( inserted and wal ) {
+                wal->append( WriteAheadLog::Op::Put, key, it->second );
+              }
+
+              // a PUT of a key already stored waits for the PUT that stored it
+              if ( wal ) {
+                lsn = wal->last_lsn();
+              }
+              response = { "HTTP/1.1 200 OK",
+                           { { "Server", "mycached/0.0.1" },
+                             { "X-Object-Key", key },
+                             { "Content-Length", "0" } },
+                           "" };
             } else {
-              client.http.push_response( { "HTTP/1.1 405 Method Not Allowed",
-                                           { { "Server", "mycached/0.0.1" },
-                                             { "X-Object-Key", key },
-                                             { "Content-Length", "0" } },
-                                           "" } );
+              response = { "HTTP/1.1 405 Method Not Allowed",
+                           { { "Server", "mycached/0.0.1" },
+                             { "X-Object-Key", key },
+                             { "Content-Length", "0" } },
+                           "" };
             }
 
+            USDT_PROBE3(
+              mycached, request_processed, client.id, key.size(), value_size );
+
+            const AccessLog::Op op = method == "GET"   ? AccessLog::Op::Get
+                                     : method == "PUT" ? AccessLog::Op::Put
+                                                       : AccessLog::Op::Other;
+
+            // responses go out in request order, so one behind a held
+            // response is held too
+            if ( lsn > wal_durable_lsn or not client.held.empty() ) {
+              if ( lsn > wal_durable_lsn ) {
+                wal_waiters.emplace_back( lsn, client.id );
+              }
+              client.held.push_back( { lsn,
+                                       move( response ),
+                                       client.http.take_request_timing(),
+                                       key,
+                                       op,
+                                       value_size } );
+            } else {
+              client.http.push_response( move( response ) );
+              log_access( client, key, op, value_size );
+            }
             client.http.pop_request();
           },
           [&] { return not client.http.requests_empty(); } ) );
+        client.http.request_wakeup().set( client.handles.back() );
 
         client_id++;
       },
@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "replica_cache.hh"
+
+using namespace std;
+
+ReplicaCache::ReplicaCache( const size_t capacity )
+  : capacity_( capacity )
+{
+  if ( capacity == 0 ) {
+    throw invalid_argument( "ReplicaCache: capacity must be nonzero" );
+  }
+  entries_.reserve( capacity );
+}
+
+const string* ReplicaCache::find( const string& key,
+                                  const SharedStoreReader& store )
+{
+  const auto it = entries_.find( key );
+  if ( it == entries_.end() ) {
+    return nullptr;
+  }
+
+  if ( not store.unchanged( it->second.version ) ) {
+    entries_.erase( it );
+    stale_++;
+    return nullptr;
+  }
+
+  it->second.hits++;
+  return &it->second.value;
+}
+
+void ReplicaCache::insert( const string& key,
+                           const string& value,
+                           const SharedStoreReader::Version& version )
+{
+  if ( entries_.size() >= capacity_ and not entries_.count( key ) ) {
+    entries_.erase( min_element( entries_.begin(),
+                                 entries_.end(),
+                                 []( const auto& a, const auto& b ) {
+                                   return a.second.hits < b.second.hits;
+                                 } ) );
+  }
+
+  entries_.insert_or_assign( key, Entry { value, version, 0 } );
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "util/shared_store.hh"
+
+//! One thread's private, read-only copies of a few hot keys' values from a
+//! SharedStoreReader. Each copy is kept with the SharedStoreReader::Version it
+//! was read at, and is only served while the store says that version is
+//! unchanged; the first lookup after the writer changes the key drops the
+//! copy. A hit is a hash-table lookup in this thread's memory plus one load
+//! of the slot's sequence number, a cache line that stays shared among every
+//! core reading the key until the key is written.
+class ReplicaCache
+{
+  struct Entry
+  {
+    std::string value;
+    SharedStoreReader::Version version;
+    uint64_t hits;
+  };
+
+  std::unordered_map<std::string, Entry> entries_ {};
+  size_t capacity_;
+  uint64_t stale_ { 0 };
+
+public:
+  explicit ReplicaCache( const size_t capacity );
+
+  //! The cached value of `key`, if there is one and it is still current
+  //! (valid until the next call to insert())
+  const std::string* find( const std::string& key,
+                           const SharedStoreReader& store );
+
+  //! Caches `value`, read at `version`, making room by dropping the entry
+  //! with the fewest hits if the cache is full
+  void insert( const std::string& key,
+               const std::string& value,
+               const SharedStoreReader::Version& version );
+
+  size_t size() const { return entries_.size(); }
+
+  //! Copies dropped because the writer changed the key
+  uint64_t stale() const { return stale_; }
+};
@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "snapshot.hh"
+#include "util/crc32c.hh"
+#include "util/exception.hh"
+#include "util/ring_buffer.hh"
+
+using namespace std;
+
+namespace snapshot {
+
+static_assert( sizeof( FileHeader ) == 16 and sizeof( ShardEntry ) == 32
+               and sizeof( Trailer ) == 32 );
+
+template<class T>
+static string_view bytes_of( const T& t )
+{
+  return { reinterpret_cast<const char*>( &t ), sizeof( t ) };
+}
+
+// Appends to a file through a large buffer, so the file sees big sequential
+// writes
+class BufferedWriter
+{
+  static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+  FileDescriptor& file_;
+  string buffer_ {};
+  uint64_t position_ { 0 };
+
+public:
+  explicit BufferedWriter( FileDescriptor& file )
+    : file_( file )
+  {
+    buffer_.reserve( BUFFER_SIZE );
+  }
+
+  void append( const string_view data )
+  {
+    if ( buffer_.size() + data.size() > BUFFER_SIZE ) {
+      flush();
+    }
+    if ( data.size() >= BUFFER_SIZE ) {
+      write_all( data );
+    } else {
+      buffer_.append( data );
+    }
+    position_ += data.size();
+  }
+
+  void flush()
+  {
+    write_all( buffer_ );
+    buffer_.clear();
+  }
+
+  void write_all( string_view data )
+  {
+    while ( not data.empty() ) {
+      data.remove_prefix( file_.write( data ) );
+    }
+  }
+
+  uint64_t position() const { return position_; }
+
+  BufferedWriter( const BufferedWriter& other ) = delete;
+  BufferedWriter& operator=( const BufferedWriter& other ) = delete;
+};
+
+static string directory_of( const string& path )
+{
+  const size_t slash = path.rfind( '/' );
+  if ( slash == string::npos ) {
+    return ".";
+  }
+  return slash == 0 ? "/" : path.substr( 0, slash );
+}
+
+SaveResult save( const Store& store, const string& path )
+{
+  const string temporary = path + ".tmp";
+  FileDescriptor file { CheckSystemCall(
+    "open " + temporary,
+    open( temporary.c_str(),
+          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+          0644 ) ) };
+  BufferedWriter out { file };
+
+  FileHeader header {};
+  memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+  header.version = VERSION;
+  out.append( bytes_of( header ) );
+
+  vector<ShardEntry> shards;
+  ShardEntry shard { out.position(), 0, 0, 0, 0 };
+
+  for ( const auto& [key, value] : store ) {
+    if ( key.size() > UINT32_MAX or value.size() > UINT32_MAX ) {
+      throw runtime_error( "snapshot: key or value too large: " + key );
+    }
+
+    const uint32_t lengths[2] = { static_cast<uint32_t>( key.size() ),
+                                  static_cast<uint32_t>( value.size() ) };
+    const string_view record_header { reinterpret_cast<const char*>( lengths ),
+                                      sizeof( lengths ) };
+    for ( const string_view part : { record_header,
+                                     string_view { key },
+                                     string_view { value } } ) {
+      out.append( part );
+      shard.crc = crc32c( shard.crc, part );
+    }
+    shard.items++;
+
+    shard.length = out.position() - shard.offset;
+    if ( shard.length >= SHARD_BYTES ) {
+      shards.push_back( shard );
+      shard = { out.position(), 0, 0, 0, 0 };
+    }
+  }
+  if ( shard.items ) {
+    shards.push_back( shard );
+  }
+
+  Trailer trailer {};
+  for ( const auto& entry : shards ) {
+    out.append( bytes_of( entry ) );
+    trailer.index_crc = crc32c( trailer.index_crc, bytes_of( entry ) );
+  }
+  trailer.shard_count = shards.size();
+  trailer.items = store.size();
+  memcpy( trailer.magic, MAGIC, sizeof( MAGIC ) );
+  out.append( bytes_of( trailer ) );
+  out.flush();
+
+  // the data must be on disk before the rename makes it the snapshot, and the
+  // rename must be on disk before the save counts as done
+  CheckSystemCall( "fsync " + temporary, fsync( file.fd_num() ) );
+  CheckSystemCall( "rename " + temporary,
+                   rename( temporary.c_str(), path.c_str() ) );
+  const string directory = directory_of( path );
+  FileDescriptor directory_fd { CheckSystemCall(
+    "open " + directory,
+    open( directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) };
+  CheckSystemCall( "fsync " + directory, fsync( directory_fd.fd_num() ) );
+
+  return { store.size(), out.position(), shards.size() };
+}
+
+BackgroundSave start_background_save( const Store& store, const string& path )
+{
+  const pid_t pid = CheckSystemCall( "fork", fork() );
+
+  if ( pid == 0 ) {
+    // the child: only this thread exists here, and it must not return into
+    // the parent's event loop or run the parent's destructors
+    try {
+      save( store, path );
+    } catch ( const exception& e ) {
+      cerr << "Background save failed: " << e.what() << endl;
+      _exit( EXIT_FAILURE );
+    }
+    _exit( EXIT_SUCCESS );
+  }
+
+  const int pidfd = syscall( SYS_pidfd_open, pid, 0 );
+  if ( pidfd < 0 ) {
+    // (an old kernel, or a seccomp filter) with no way to wait for the child
+    // in the event loop, stop it rather than leave it unreaped
+    const int error = errno;
+    kill( pid, SIGKILL );
+    waitpid( pid, nullptr, 0 );
+    throw unix_error( "pidfd_open", error );
+  }
+
+  return { pid, FileDescriptor { pidfd } };
+}
+
+bool finish_background_save( const BackgroundSave& save )
+{
+  int status = 0;
+  CheckSystemCall( "waitpid", waitpid( save.pid, &status, 0 ) );
+  return WIFEXITED( status ) and WEXITSTATUS( status ) == EXIT_SUCCESS;
+}
+
+// copies the records of one shard out of the mapped file
+static void load_shard( const char* const file,
+                        const ShardEntry& entry,
+                        vector<pair<string, string>>& records )
+{
+  const string_view shard { file + entry.offset, entry.length };
+  if ( crc32c( 0, shard ) != entry.crc ) {
+    throw runtime_error( "snapshot: checksum mismatch in shard at offset "
+                         + to_string( entry.offset ) );
+  }
+
+  records.reserve( entry.items );
+  for ( string_view rest = shard; not rest.empty(); ) {
+    uint32_t lengths[2];
+    if ( rest.size() < sizeof( lengths ) ) {
+      throw runtime_error( "snapshot: truncated record" );
+    }
+    memcpy( lengths, rest.data(), sizeof( lengths ) );
+    rest.remove_prefix( sizeof( lengths ) );
+
+    if ( uint64_t( lengths[0] ) + lengths[1] > rest.size() ) {
+      throw runtime_error( "snapshot: truncated record" );
+    }
+    records.emplace_back( rest.substr( 0, lengths[0] ),
+                          rest.substr( lengths[0], lengths[1] ) );
+    rest.remove_prefix( lengths[0] + lengths[1] );
+  }
+
+  if ( records.size() != entry.items ) {
+    throw runtime_error( "snapshot: shard has the wrong number of records" );
+  }
+}
+
+Loaded load( const string& path, const unsigned int threads )
+{
+  FileDescriptor file { CheckSystemCall(
+    "open " + path, open( path.c_str(), O_RDONLY | O_CLOEXEC ) ) };
+  struct stat st {};
+  CheckSystemCall( "fstat " + path, fstat( file.fd_num(), &st ) );
+  const uint64_t size = st.st_size;
+
+  if ( size < sizeof( FileHeader ) + sizeof( Trailer ) ) {
+    throw runtime_error( "snapshot: " + path + " is too short" );
+  }
+
+  const MMap_Region mapping {
+    nullptr, size, PROT_READ, MAP_PRIVATE, file.fd_num()
+  };
+  const char* const data = mapping.addr();
+  // start reading ahead (only a hint)
+  madvise( mapping.addr(), size, MADV_WILLNEED );
+
+  FileHeader header {};
+  Trailer trailer {};
+  memcpy( &header, data, sizeof( header ) );
+  memcpy( &trailer, data + size - sizeof( trailer ), sizeof( trailer ) );
+
+  if ( memcmp( header.magic, MAGIC, sizeof( MAGIC ) )
+       or memcmp( trailer.magic, MAGIC, sizeof( MAGIC ) )
+       or header.version != VERSION ) {
+    throw runtime_error( "snapshot: " + path + " is not a version "
+                         + to_string( VERSION ) + " mycached snapshot" );
+  }
+
+  const uint64_t index_size = trailer.shard_count * sizeof( ShardEntry );
+  if ( trailer.shard_count > size / sizeof( ShardEntry )
+       or index_size > size - sizeof( header ) - sizeof( trailer ) ) {
+    throw runtime_error( "snapshot: " + path + " has a damaged index" );
+  }
+  const uint64_t index_offset = size - sizeof( trailer ) - index_size;
+
+  vector<ShardEntry> index( trailer.shard_count );
+  memcpy( index.data(), data + index_offset, index_size );
+  if ( crc32c( 0, { data + index_offset, index_size } ) != trailer.index_crc ) {
+    throw runtime_error( "snapshot: " + path + " has a damaged index" );
+  }
+  for ( const auto& entry : index ) {
+    if ( entry.offset < sizeof( header ) or entry.offset > index_offset
+         or entry.length > index_offset - entry.offset ) {
+      throw runtime_error( "snapshot: " + path + " has a damaged index" );
+    }
+  }
+
+  Loaded loaded {};
+  loaded.shards.resize( index.size() );
+  loaded.items = trailer.items;
+  loaded.bytes = size;
+
+  // each thread takes the next shard until there are none left
+  atomic<size_t> next_shard { 0 };
+  vector<exception_ptr> errors( max( threads, 1u ) );
+  vector<thread> workers;
+  for ( size_t t = 0; t < errors.size(); t++ ) {
+    workers.emplace_back( [&, t] {
+      try {
+        for ( size_t i = next_shard++; i < index.size(); i = next_shard++ ) {
+          load_shard( data, index[i], loaded.shards[i] );
+        }
+      } catch ( ... ) {
+        errors[t] = current_exception();
+      }
+    } );
+  }
+  for ( auto& worker : workers ) {
+    worker.join();
+  }
+  for ( const auto& error : errors ) {
+    if ( error ) {
+      rethrow_exception( error );
+    }
+  }
+
+  return loaded;
+}
+
+}
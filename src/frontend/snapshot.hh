@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "util/file_descriptor.hh"
+
+//! Snapshots of mycached's store, so that a restart doesn't lose it.
+//!
+//! A snapshot file is a FileHeader, then shards of records, then an index of
+//! the shards (a ShardEntry each) and a Trailer. A record is the key's and the
+//! value's lengths (32 bits each, in the machine's byte order) followed by the
+//! key and value bytes. save() writes the records in one sequential pass,
+//! starting a new shard every SHARD_BYTES, and checksums each shard and the
+//! index with CRC-32C. load() maps the file and has several threads each take
+//! a shard at a time, verify it and copy its records out.
+namespace snapshot {
+
+constexpr char MAGIC[8] = { 'M', 'Y', 'C', 'S', 'N', 'A', 'P', '1' };
+constexpr uint32_t VERSION = 1;
+constexpr uint64_t SHARD_BYTES = 64 << 20;
+
+struct FileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct ShardEntry
+{
+  uint64_t offset;
+  uint64_t length;
+  uint64_t items;
+  uint32_t crc; //!< CRC-32C of the shard's records
+  uint32_t reserved;
+};
+
+struct Trailer
+{
+  uint64_t shard_count;
+  uint64_t items;
+  uint32_t index_crc; //!< CRC-32C of the ShardEntry array
+  uint32_t reserved;
+  char magic[8];
+};
+
+using Store = std::unordered_map<std::string, std::string>;
+
+struct SaveResult
+{
+  uint64_t items;
+  uint64_t bytes;
+  uint64_t shards;
+};
+
+//! Writes `store` to `path`. The snapshot is written to `path`.tmp, synced,
+//! and renamed into place, so a failed save leaves the previous one intact.
+SaveResult save( const Store& store, const std::string& path );
+
+//! A child process saving a snapshot
+struct BackgroundSave
+{
+  pid_t pid;
+  FileDescriptor pidfd; //!< readable once the child has exited
+};
+
+//! Forks a child that saves `store` as it is now, while the parent carries on
+//! changing it (copy-on-write keeps the child's view of it frozen). Throws if
+//! the child can't be started, or can't be watched (it is then killed).
+BackgroundSave start_background_save( const Store& store,
+                                      const std::string& path );
+
+//! Reaps the child (call once its pidfd is readable)
+//! \returns whether it saved the snapshot
+bool finish_background_save( const BackgroundSave& save );
+
+//! The records of a snapshot, by shard
+struct Loaded
+{
+  std::vector<std::vector<std::pair<std::string, std::string>>> shards;
+  uint64_t items;
+  uint64_t bytes; //!< size of the file
+};
+
+//! Maps the snapshot at `path` and verifies and copies out its shards on
+//! `threads` threads. Throws if the file is damaged.
+Loaded load( const std::string& path, const unsigned int threads );
+
+}
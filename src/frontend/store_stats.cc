@@ -0,0 +1,128 @@
+#include <string>
+
+#include "store_stats.hh"
+#include "util/prometheus.hh"
+
+using namespace std;
+
+void StoreStats::stored( const size_t key_size, const size_t value_size )
+{
+  ++items;
+  key_bytes.add( key_size );
+  value_bytes.add( value_size );
+  ++key_sizes[size_class( key_size )];
+  ++value_sizes[size_class( value_size )];
+}
+
+void StoreStats::removed( const size_t key_size, const size_t value_size )
+{
+  items.sub( 1 );
+  key_bytes.sub( key_size );
+  value_bytes.sub( value_size );
+  key_sizes[size_class( key_size )].sub( 1 );
+  value_sizes[size_class( value_size )].sub( 1 );
+}
+
+namespace {
+
+using SizeCounts = array<uint64_t, StoreStats::SIZE_CLASSES>;
+
+// a plain copy of StoreStats, for adding up
+struct Totals
+{
+  uint64_t items, key_bytes, value_bytes;
+  uint64_t get_hits, get_misses, puts_stored, puts_existing;
+  SizeCounts key_sizes, value_sizes;
+};
+
+void write_size_histogram( PrometheusText& out,
+                           const string& name,
+                           const SizeCounts& sizes,
+                           const uint64_t sum )
+{
+  const string bucket_name = name + "_bucket";
+
+  // class k ends at 2^k - 1; stop at 4 GiB, well past any size mycached sees
+  uint64_t cumulative = 0;
+  for ( size_t k = 0; k <= 32; k++ ) {
+    cumulative += sizes[k];
+    const uint64_t bound = ( uint64_t( 1 ) << k ) - 1;
+    out.sample( bucket_name,
+                PrometheusText::label( "le", to_string( bound ) ),
+                cumulative );
+  }
+
+  uint64_t count = 0;
+  for ( const auto n : sizes ) {
+    count += n;
+  }
+  out.sample( bucket_name, PrometheusText::label( "le", "+Inf" ), count );
+  out.sample( name + "_sum", "", sum );
+  out.sample( name + "_count", "", count );
+}
+
+}
+
+void write_store_stats( PrometheusText& out )
+{
+  Totals t {};
+  PerThread<StoreStats>::for_each( [&]( const StoreStats& s ) {
+    t.items += s.items.load();
+    t.key_bytes += s.key_bytes.load();
+    t.value_bytes += s.value_bytes.load();
+    t.get_hits += s.get_hits.load();
+    t.get_misses += s.get_misses.load();
+    t.puts_stored += s.puts_stored.load();
+    t.puts_existing += s.puts_existing.load();
+    for ( size_t k = 0; k < StoreStats::SIZE_CLASSES; k++ ) {
+      t.key_sizes[k] += s.key_sizes[k].load();
+      t.value_sizes[k] += s.value_sizes[k].load();
+    }
+  } );
+
+  out.family( "mycached_items", "gauge", "Items stored" );
+  out.sample( "mycached_items", "", t.items );
+
+  out.family( "mycached_bytes", "gauge", "Bytes of keys and values stored" );
+  out.sample(
+    "mycached_bytes", PrometheusText::label( "part", "key" ), t.key_bytes );
+  out.sample(
+    "mycached_bytes", PrometheusText::label( "part", "value" ), t.value_bytes );
+
+  out.family( "mycached_gets_total",
+              "counter",
+              "GET requests, by whether the key was found (and consumed)" );
+  out.sample( "mycached_gets_total",
+              PrometheusText::label( "result", "hit" ),
+              t.get_hits );
+  out.sample( "mycached_gets_total",
+              PrometheusText::label( "result", "miss" ),
+              t.get_misses );
+
+  const uint64_t gets = t.get_hits + t.get_misses;
+  out.family( "mycached_get_hit_ratio", "gauge", "Share of GETs that hit" );
+  out.sample( "mycached_get_hit_ratio",
+              "",
+              gets ? double( t.get_hits ) / gets : 0.0 );
+
+  out.family( "mycached_puts_total",
+              "counter",
+              "PUT requests, by whether the key was already stored (in "
+              "which case the old value is kept)" );
+  out.sample( "mycached_puts_total",
+              PrometheusText::label( "result", "stored" ),
+              t.puts_stored );
+  out.sample( "mycached_puts_total",
+              PrometheusText::label( "result", "existing" ),
+              t.puts_existing );
+
+  out.family(
+    "mycached_key_size_bytes", "histogram", "Sizes of the keys stored" );
+  write_size_histogram(
+    out, "mycached_key_size_bytes", t.key_sizes, t.key_bytes );
+
+  out.family(
+    "mycached_value_size_bytes", "histogram", "Sizes of the values stored" );
+  write_size_histogram(
+    out, "mycached_value_size_bytes", t.value_sizes, t.value_bytes );
+}
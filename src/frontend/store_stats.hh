@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "util/per_thread.hh"
+
+class PrometheusText;
+
+//! What mycached's store holds and how it is used. Each thread counts into
+//! its own copy (see PerThread), so counting costs a few plain increments on
+//! the request path; write_store_stats() adds the copies up.
+struct StoreStats
+{
+  //! Sizes are counted by power of two: class k holds sizes in [2^(k-1),
+  //! 2^k), and class 0 holds empty keys or values
+  static constexpr size_t SIZE_CLASSES = 65;
+
+  static size_t size_class( const uint64_t size )
+  {
+    return size ? 64 - __builtin_clzll( size ) : 0;
+  }
+
+  RelaxedCounter items {};
+  RelaxedCounter key_bytes {};
+  RelaxedCounter value_bytes {};
+  RelaxedCounter get_hits {};
+  RelaxedCounter get_misses {};
+  RelaxedCounter puts_stored {};
+  RelaxedCounter puts_existing {}; //!< PUTs of a key already stored (ignored)
+
+  //! Items currently stored, by size class of key and of value
+  std::array<RelaxedCounter, SIZE_CLASSES> key_sizes {};
+  std::array<RelaxedCounter, SIZE_CLASSES> value_sizes {};
+
+  void stored( const size_t key_size, const size_t value_size );
+  void removed( const size_t key_size, const size_t value_size );
+};
+
+//! The calling thread's counters
+inline StoreStats& store_stats()
+{
+  return PerThread<StoreStats>::local();
+}
+
+//! Adds up every thread's counters and writes them out
+void write_store_stats( PrometheusText& out );
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -46,6 +47,9 @@ protected:
   /* state of an in-progress request or response */
   HTTPMessageState state_ { FIRST_LINE_PENDING };
 
+  /* where the message began in the stream of bytes given to its parser */
+  uint64_t stream_offset_ {};
+
   /* used by subclasses to set the expected body size */
   void set_expected_body_size( const bool is_known, const size_t value = -1 );
 
@@ -63,8 +67,9 @@ public:
   size_t read_in_body( const std::string_view str );
   void eof();
 
-  /* setter */
+  /* setters */
   void add_header( const HTTPHeader& header );
+  void set_stream_offset( const uint64_t offset ) { stream_offset_ = offset; }
 
   /* getters */
   bool body_size_is_known() const;
@@ -73,6 +78,7 @@ public:
   std::string_view first_line() const { return first_line_; }
   const std::vector<HTTPHeader>& headers() const { return headers_; }
   const std::string& body() const { return body_; }
+  uint64_t stream_offset() const { return stream_offset_; }
 
   /* troll through the headers */
   bool has_header( const std::string_view header_name ) const;
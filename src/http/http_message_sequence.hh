@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <list>
 #include <queue>
 #include <string>
 
@@ -23,8 +24,12 @@ class HTTPMessageSequence
     return str.substr( 0, first_line_ending );
   }
 
-  /* complete messages ready to go */
-  std::queue<MessageType> complete_messages_ {};
+  /* complete messages ready to go, oldest first (a list, unlike a deque, allocates nothing while empty) */
+  std::list<MessageType> complete_messages_ {};
+
+  /* bytes consumed by earlier calls to parse(), and the size of the buffer given to this one */
+  uint64_t bytes_parsed_ {};
+  size_t parse_size_ {};
 
   /* one loop through the parser */
   /* returns whether to continue */
@@ -44,7 +49,7 @@ public:
 
   size_t parse( std::string_view buf )
   {
-    size_t original_size = buf.size();
+    parse_size_ = buf.size();
 
     if ( buf.empty() ) { /* EOF */
       message_in_progress_.eof();
@@ -54,15 +59,22 @@ public:
     while ( parsing_step( buf ) ) {
     }
 
-    return original_size - buf.size();
+    bytes_parsed_ += parse_size_ - buf.size();
+    return parse_size_ - buf.size();
   }
 
   /* getters */
   bool empty() const { return complete_messages_.empty(); }
+  const MessageType& in_progress() const { return message_in_progress_; }
+  size_t size() const { return complete_messages_.size(); }
   const MessageType& front() const { return complete_messages_.front(); }
 
+  /* iterate over the complete messages, oldest first */
+  auto begin() const { return complete_messages_.begin(); }
+  auto end() const { return complete_messages_.end(); }
+
   /* pop one request */
-  void pop() { complete_messages_.pop(); }
+  void pop() { complete_messages_.pop_front(); }
 };
 
 template<class MessageType>
@@ -78,6 +90,7 @@ bool HTTPMessageSequence<MessageType>::parsing_step( std::string_view& buf )
       /* supply status line to request/response initialization routine */
       initialize_new_message();
 
+      message_in_progress_.set_stream_offset( bytes_parsed_ + parse_size_ - buf.size() );
       message_in_progress_.set_first_line( get_line( buf ) );
       buf.remove_prefix( message_in_progress_.first_line().size() + 2 );
 
@@ -108,7 +121,7 @@ bool HTTPMessageSequence<MessageType>::parsing_step( std::string_view& buf )
       return message_in_progress_.state() == COMPLETE;
 
     case COMPLETE:
-      complete_messages_.emplace( std::move( message_in_progress_ ) );
+      complete_messages_.emplace_back( std::move( message_in_progress_ ) );
       message_in_progress_ = MessageType();
       return true;
   }
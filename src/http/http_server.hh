@@ -1,22 +1,41 @@
 #pragma once
 
+#include <list>
 #include <queue>
 #include <string>
 #include <string_view>
 
+#include "eventloop.hh"
 #include "http_request_parser.hh"
 #include "http_response.hh"
+#include "request_timing.hh"
 #include "ring_buffer.hh"
 
+//! \brief The server side of an HTTP/1.1 connection: parses requests and serializes the responses to them.
+//! \details Each request's RequestTiming follows it through the server: stamped by read() as it is parsed,
+//! moved to its response by push_response(), and handed out by responses_sent() once the connection has
+//! written the response to the kernel. Timings travel in lists, spliced from one to the next, so an idle
+//! server holds no memory for them. A caller that answers a request only after popping it (holding the
+//! response until something else happens) takes the request's timing with take_request_timing() and gives it
+//! back with the response.
 class HTTPServer
 {
   HTTPRequestParser requests_ {};
-  std::queue<HTTPResponse> responses_ {};
+  std::queue<HTTPResponse, std::list<HTTPResponse>> responses_ {};
+
+  RequestTiming in_progress_timing_ {};          //!< of the request the parser is partway through
+  std::list<RequestTiming> request_timings_ {};  //!< of the complete requests with no response yet
+  std::list<RequestTiming> response_timings_ {}; //!< of the responses not yet fully written
+  std::list<RequestTiming> unsent_timings_ {};   //!< of the responses written, but maybe not yet sent
+  uint64_t bytes_written_ {};                    //!< ever written by write()
+  bool server_timing_ {};
 
   std::string current_response_headers_ {};
   std::string_view current_response_unsent_headers_ {};
   std::string_view current_response_unsent_body_ {};
 
+  EventLoop::Wakeup request_wakeup_ {}, response_wakeup_ {};
+
   void load()
   {
     if ( ( not current_response_unsent_headers_.empty() ) or ( not current_response_unsent_body_.empty() )
@@ -25,47 +44,189 @@ class HTTPServer
     }
 
     responses_.front().serialize_headers( current_response_headers_ );
+    if ( server_timing_ ) {
+      // before the blank line that ends the headers
+      current_response_headers_.insert( current_response_headers_.size() - CRLF.size(),
+                                        "Server-Timing: " + response_timings_.front().server_timing() + CRLF );
+    }
     current_response_unsent_headers_ = current_response_headers_;
     current_response_unsent_body_ = responses_.front().body();
   }
 
-public:
-  void push_response( HTTPResponse&& res )
+  void queue_response( HTTPResponse&& res )
   {
+    response_timings_.back().ticks[RequestTiming::Processed] = Timer::ticks();
+    response_timings_.back().set_status( res.first_line() );
+
     responses_.push( std::move( res ) );
 
-    if ( current_response_unsent_headers_.empty() and current_response_unsent_body_.empty() ) {
+    // if an earlier response is still queued (even if fully sent), write() will load this one after popping it
+    if ( responses_.size() == 1 ) {
       load();
     }
+
+    response_wakeup_.notify();
   }
 
+public:
+  //! Whether responses get a Server-Timing header, with the intervals of the request's timing so far
+  void set_server_timing( const bool enabled ) { server_timing_ = enabled; }
+
+  //! Queues the response to the oldest request that doesn't have one
+  void push_response( HTTPResponse&& res )
+  {
+    if ( request_timings_.size() == requests_.size() and not request_timings_.empty() ) {
+      response_timings_.splice( response_timings_.end(), request_timings_, request_timings_.begin() );
+    } else {
+      response_timings_.emplace_back();
+    }
+    queue_response( std::move( res ) );
+  }
+
+  //! Queues a response to a request already popped, with the timing take_request_timing() took from it
+  void push_response( HTTPResponse&& res, std::list<RequestTiming>&& timing )
+  {
+    if ( timing.empty() ) {
+      timing.emplace_back();
+    }
+    response_timings_.splice( response_timings_.end(), timing, timing.begin() );
+    queue_response( std::move( res ) );
+  }
+
+  //! Takes the timing of the oldest request that doesn't have a response, for a response pushed after the
+  //! request is popped
+  std::list<RequestTiming> take_request_timing()
+  {
+    std::list<RequestTiming> timing;
+    if ( request_timings_.size() == requests_.size() and not request_timings_.empty() ) {
+      timing.splice( timing.end(), request_timings_, request_timings_.begin() );
+    }
+    return timing;
+  }
+
+  //! The timing of the response last pushed, as it stood then (valid until the next call to write())
+  const RequestTiming& last_response_timing() const { return response_timings_.back(); }
+
+  //! Notified by read() when a complete request has arrived
+  EventLoop::Wakeup& request_wakeup() { return request_wakeup_; }
+
+  //! Notified by push_response()
+  EventLoop::Wakeup& response_wakeup() { return response_wakeup_; }
+
   bool responses_empty() const
   {
     return current_response_unsent_headers_.empty() and current_response_unsent_body_.empty() and responses_.empty();
   }
 
+  //! Writes some of the current response
+  //! \returns true if this wrote the last of the response
   template<class Writable>
-  void write( Writable& out )
+  bool write( Writable& out )
   {
     if ( responses_empty() ) {
       throw std::runtime_error( "HTTPServer::write(): HTTPServer has no more responses" );
     }
 
     if ( not current_response_unsent_headers_.empty() ) {
-      current_response_unsent_headers_.remove_prefix( out.write( current_response_unsent_headers_ ) );
+      const size_t written = out.write( current_response_unsent_headers_ );
+      current_response_unsent_headers_.remove_prefix( written );
+      bytes_written_ += written;
     } else if ( not current_response_unsent_body_.empty() ) {
-      current_response_unsent_body_.remove_prefix( out.write( current_response_unsent_body_ ) );
+      const size_t written = out.write( current_response_unsent_body_ );
+      current_response_unsent_body_.remove_prefix( written );
+      bytes_written_ += written;
     } else {
       responses_.pop();
       if ( not responses_.empty() ) {
         load();
+      } else {
+        std::string().swap( current_response_headers_ ); // don't hold on to memory while idle
       }
+      return false;
+    }
+
+    if ( not current_response_unsent_headers_.empty() or not current_response_unsent_body_.empty() ) {
+      return false;
+    }
+
+    response_timings_.front().response_end = bytes_written_;
+    unsent_timings_.splice( unsent_timings_.end(), response_timings_, response_timings_.begin() );
+    return true;
+  }
+
+  //! Calls `on_sent` with the timing of each response that is now entirely among the first `bytes_sent` bytes
+  //! that write() wrote (and that the connection has since written to the kernel)
+  template<class Callback>
+  void responses_sent( const uint64_t bytes_sent, Callback&& on_sent )
+  {
+    if ( unsent_timings_.empty() or unsent_timings_.front().response_end > bytes_sent ) {
+      return;
+    }
+
+    const uint64_t now = Timer::ticks();
+    while ( not unsent_timings_.empty() and unsent_timings_.front().response_end <= bytes_sent ) {
+      unsent_timings_.front().ticks[RequestTiming::Sent] = now;
+      on_sent( static_cast<const RequestTiming&>( unsent_timings_.front() ) );
+      unsent_timings_.pop_front();
+    }
+  }
+
+  //! Parses requests from `in`; `arrival( offset )` gives the Timer::ticks() at which the byte at `offset` in
+  //! the inbound stream (counting every byte ever given to read) was received
+  template<class Arrival>
+  void read( RingBuffer& in, Arrival&& arrival )
+  {
+    const size_t complete_before = requests_.size();
+    in.pop( requests_.parse( in.readable_region() ) );
+    const size_t completed = requests_.size() - complete_before;
+
+    if ( completed or requests_.in_progress().state() != FIRST_LINE_PENDING ) {
+      const uint64_t now = Timer::ticks();
+
+      for ( auto it = std::prev( requests_.end(), completed ); it != requests_.end(); ++it ) {
+        RequestTiming& timing = request_timings_.emplace_back( in_progress_timing_ );
+        in_progress_timing_ = {};
+        if ( not timing.ticks[RequestTiming::Received] ) {
+          timing.ticks[RequestTiming::Received] = arrival( it->stream_offset() );
+        }
+        if ( not timing.ticks[RequestTiming::HeadersParsed] ) {
+          timing.ticks[RequestTiming::HeadersParsed] = now;
+        }
+        timing.ticks[RequestTiming::BodyComplete] = now;
+        timing.set_first_line( it->first_line() );
+      }
+
+      // the request still being parsed, if it's past its first line
+      const HTTPRequest& in_progress = requests_.in_progress();
+      if ( in_progress.state() != FIRST_LINE_PENDING and not in_progress_timing_.ticks[RequestTiming::Received] ) {
+        in_progress_timing_.ticks[RequestTiming::Received] = arrival( in_progress.stream_offset() );
+      }
+      if ( in_progress.state() == BODY_PENDING and not in_progress_timing_.ticks[RequestTiming::HeadersParsed] ) {
+        in_progress_timing_.ticks[RequestTiming::HeadersParsed] = now;
+      }
+    }
+
+    if ( not requests_.empty() ) {
+      request_wakeup_.notify();
     }
   }
 
-  void read( RingBuffer& in ) { in.pop( requests_.parse( in.readable_region() ) ); }
+  //! Parses requests from `in`, taking them to have arrived now
+  void read( RingBuffer& in )
+  {
+    read( in, [now = Timer::ticks()]( uint64_t ) { return now; } );
+  }
 
   bool requests_empty() const { return requests_.empty(); }
+  const HTTPRequestParser& requests() const { return requests_; }
   const HTTPRequest& requests_front() const { return requests_.front(); }
-  void pop_request() { return requests_.pop(); }
+
+  void pop_request()
+  {
+    // the request had no response
+    if ( request_timings_.size() == requests_.size() and not request_timings_.empty() ) {
+      request_timings_.pop_front();
+    }
+    requests_.pop();
+  }
 };
@@ -0,0 +1,71 @@
+#include "request_timing.hh"
+#include "timer.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+// Timer::pp_ticks without the padding
+static string pp( const uint64_t ticks )
+{
+  const string padded = Timer::pp_ticks( ticks );
+  return padded.substr( padded.find_first_not_of( ' ' ) );
+}
+
+void RequestTiming::set_first_line( const string_view line )
+{
+  first_line_length = min( line.size(), MAX_FIRST_LINE );
+  copy_n( line.data(), first_line_length, first_line.data() );
+}
+
+void RequestTiming::set_status( const string_view status_line )
+{
+  status = 0;
+  const size_t space = status_line.find( ' ' );
+  for ( size_t i = space + 1; space != string_view::npos and i < status_line.size(); i++ ) {
+    if ( status_line[i] < '0' or status_line[i] > '9' ) {
+      break;
+    }
+    status = status * 10 + ( status_line[i] - '0' );
+  }
+}
+
+uint64_t RequestTiming::total_ticks() const
+{
+  for ( size_t phase = NUM_PHASES; phase-- > Received + 1; ) {
+    if ( ticks[phase] ) {
+      return ticks[phase] - ticks[Received];
+    }
+  }
+  return 0;
+}
+
+string RequestTiming::server_timing() const
+{
+  ostringstream out;
+  out << fixed << setprecision( 3 );
+
+  for ( size_t phase = Received + 1; phase < NUM_PHASES and ticks[phase]; phase++ ) {
+    if ( phase > Received + 1 ) {
+      out << ", ";
+    }
+    // milliseconds, as the spec asks
+    out << interval_names[phase] << ";dur=" << Timer::ticks_to_ns( ticks[phase] - ticks[phase - 1] ) / 1e6;
+  }
+
+  return out.str();
+}
+
+string RequestTiming::summary() const
+{
+  ostringstream out;
+  out << '"' << request() << "\" total=" << pp( total_ticks() );
+
+  for ( size_t phase = Received + 1; phase < NUM_PHASES and ticks[phase]; phase++ ) {
+    out << " " << interval_names[phase] << "=" << pp( ticks[phase] - ticks[phase - 1] );
+  }
+
+  return out.str();
+}
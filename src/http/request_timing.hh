@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+//! When a request reached each phase of its life in an HTTPServer, as Timer::ticks() values (0 if not yet)
+struct RequestTiming
+{
+  enum Phase
+  {
+    Received,      //!< its first byte was read from the socket
+    HeadersParsed, //!< the parser got to the end of its headers
+    BodyComplete,  //!< the parser got to the end of its body
+    Processed,     //!< its response was pushed
+    Sent,          //!< the last byte of its response was handed to the kernel
+    NUM_PHASES
+  };
+
+  //! Names of the intervals that end at each phase (the first has none)
+  static constexpr std::array<const char*, NUM_PHASES> interval_names {
+    { "", "headers", "body", "process", "send" }
+  };
+
+  static constexpr size_t MAX_FIRST_LINE = 64;
+
+  std::array<uint64_t, NUM_PHASES> ticks {};
+  std::array<char, MAX_FIRST_LINE> first_line {}; //!< the request's, cut short if need be
+  uint8_t first_line_length {};
+  uint64_t response_end {}; //!< the outbound stream offset just past the response
+  uint16_t status {};       //!< the response's status code
+
+  //! Takes the status code from a response's status line ("HTTP/1.1 200 OK")
+  void set_status( const std::string_view status_line );
+
+  void set_first_line( const std::string_view line );
+  std::string_view request() const { return { first_line.data(), first_line_length }; }
+
+  //! Ticks from the first phase to the last one reached
+  uint64_t total_ticks() const;
+
+  //! The durations so far, as the value of a Server-Timing header (e.g. "headers;dur=0.012, body;dur=0")
+  std::string server_timing() const;
+
+  //! One line: the request, the total, and each interval
+  std::string summary() const;
+};
@@ -0,0 +1,118 @@
+#include "slow_request_log.hh"
+#include "exception.hh"
+#include "timer.hh"
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iomanip>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <type_traits>
+#include <unistd.h>
+
+using namespace std;
+
+SlowRequestLog::SlowRequestLog( const string& path, const uint64_t threshold_ns )
+  : threshold_ticks_( Timer::ns_to_ticks( threshold_ns ) )
+  , file_( CheckSystemCall( "open " + path, open( path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 ) ) )
+  , wakeup_( CheckSystemCall( "eventfd", eventfd( 0, EFD_CLOEXEC ) ) )
+{
+  writer_ = thread( [this] { write_entries(); } );
+}
+
+SlowRequestLog::~SlowRequestLog()
+{
+  stopping_.store( true, memory_order_release );
+  const uint64_t one = 1;
+  CheckSystemCall( "write", ::write( wakeup_.fd_num(), &one, sizeof( one ) ) );
+  writer_.join();
+}
+
+void SlowRequestLog::record( const uint64_t connection_id, const RequestTiming& timing )
+{
+  static_assert( is_trivially_copyable_v<Entry> );
+
+  if ( timing.total_ticks() < threshold_ticks_ ) {
+    return;
+  }
+
+  simple_string_span space = ring_.writable_region( sizeof( Entry ) );
+  if ( space.size() < sizeof( Entry ) ) {
+    dropped_.fetch_add( 1, memory_order_relaxed );
+    return;
+  }
+
+  const Entry entry { connection_id, timing };
+  memcpy( space.mutable_data(), &entry, sizeof( entry ) );
+  ring_.push( sizeof( entry ) );
+
+  // pairs with the fence in write_entries(): either the writer sees this entry before it sleeps, or this sees
+  // that it is asleep
+  atomic_thread_fence( memory_order_seq_cst );
+  if ( writer_idle_.load( memory_order_relaxed ) and writer_idle_.exchange( false, memory_order_relaxed ) ) {
+    const uint64_t one = 1;
+    CheckSystemCall( "write", ::write( wakeup_.fd_num(), &one, sizeof( one ) ) );
+  }
+}
+
+// local wall-clock time, to the millisecond
+static void write_wall_time( ostream& out, const chrono::system_clock::time_point when )
+{
+  const time_t seconds = chrono::system_clock::to_time_t( when );
+  const auto ms = chrono::duration_cast<chrono::milliseconds>( when.time_since_epoch() ).count() % 1000;
+
+  tm local {};
+  localtime_r( &seconds, &local );
+  out << put_time( &local, "%Y-%m-%d %H:%M:%S" ) << '.' << setw( 3 ) << setfill( '0' ) << ms;
+}
+
+void SlowRequestLog::write_entries()
+{
+  uint64_t dropped_reported = 0;
+
+  while ( true ) {
+    const bool stopping = stopping_.load( memory_order_acquire );
+
+    ostringstream lines;
+    const uint64_t now_ticks = Timer::ticks();
+    const auto now = chrono::system_clock::now();
+
+    for ( string_view queued = ring_.readable_region( sizeof( Entry ) ); queued.size() >= sizeof( Entry );
+          queued = ring_.readable_region( sizeof( Entry ) ) ) {
+      Entry entry {};
+      memcpy( &entry, queued.data(), sizeof( entry ) );
+      ring_.pop( sizeof( entry ) );
+
+      // when the request's first byte arrived
+      const uint64_t ago_ns = Timer::ticks_to_ns( now_ticks - entry.timing.ticks[RequestTiming::Received] );
+      write_wall_time( lines, now - chrono::nanoseconds( ago_ns ) );
+      lines << " conn=" << entry.connection_id << " " << entry.timing.summary() << "\n";
+    }
+
+    const uint64_t dropped = dropped_.load( memory_order_relaxed );
+    if ( dropped != dropped_reported ) {
+      lines << "(" << dropped - dropped_reported << " slow requests not logged: the log fell behind)\n";
+      dropped_reported = dropped;
+    }
+
+    const string text = lines.str();
+    for ( string_view unwritten = text; not unwritten.empty(); ) {
+      unwritten.remove_prefix( file_.write( unwritten ) );
+    }
+
+    if ( stopping ) {
+      return;
+    }
+
+    // ask record() for a wakeup, then look once more in case an entry arrived before it could see the request
+    // (a wakeup that turns out to be unneeded only costs an extra pass)
+    writer_idle_.store( true, memory_order_relaxed );
+    atomic_thread_fence( memory_order_seq_cst );
+    if ( ring_.readable_region( sizeof( Entry ) ).size() < sizeof( Entry ) ) {
+      uint64_t wakeups;
+      CheckSystemCall( "read", ::read( wakeup_.fd_num(), &wakeups, sizeof( wakeups ) ) );
+    }
+  }
+}
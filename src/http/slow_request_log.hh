@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "file_descriptor.hh"
+#include "request_timing.hh"
+#include "spsc_ring_buffer.hh"
+
+//! \brief Appends requests that took longer than a threshold, with how long each phase took, to a log file.
+//! \details record() is called by one thread (an event loop's). When a request is over the threshold, its
+//! timing is copied into a single-producer, single-consumer ring, and a thread of the log's own formats it and
+//! writes it out, so the event loop never waits on the file. record() only writes the eventfd when the writer
+//! has drained the ring and is about to sleep, not for every entry. If the writer falls so far behind that the
+//! ring is full, entries are dropped, and the next line written says how many were.
+class SlowRequestLog
+{
+  struct Entry
+  {
+    uint64_t connection_id;
+    RequestTiming timing;
+  };
+
+  static constexpr size_t RING_SIZE = 64 * 1024;
+
+  uint64_t threshold_ticks_;
+  FileDescriptor file_;
+  FileDescriptor wakeup_; //!< eventfd that record() writes to when it adds an entry while the writer is idle
+  SpscRingBuffer ring_ { RING_SIZE };
+  std::atomic<bool> writer_idle_ { false }; //!< set by the writer before it sleeps, cleared by the wakeup
+  std::atomic<uint64_t> dropped_ { 0 };
+  std::atomic<bool> stopping_ { false };
+  std::thread writer_ {};
+
+  void write_entries();
+
+public:
+  //! Appends to `path` requests that took at least `threshold_ns` from first byte to last byte sent
+  SlowRequestLog( const std::string& path, const uint64_t threshold_ns );
+
+  //! Writes out what is queued, then stops the writer
+  ~SlowRequestLog();
+
+  //! Logs the request if it was slow (call once the response is sent, from one thread only)
+  void record( const uint64_t connection_id, const RequestTiming& timing );
+
+  uint64_t dropped() const { return dropped_.load( std::memory_order_relaxed ); }
+
+  /* Disallow copying */
+  SlowRequestLog( const SlowRequestLog& other ) = delete;
+  SlowRequestLog& operator=( const SlowRequestLog& other ) = delete;
+};
@@ -2,8 +2,11 @@
 #include <cstdlib>
 #include <iostream>
 #include <random>
+#include <stdexcept>
+#include <thread>
 
 #include "ring_buffer.hh"
+#include "spsc_ring_buffer.hh"
 
 using namespace std;
 
@@ -34,12 +37,123 @@ void rb_test( const size_t rb_size, const size_t iteration_count, const size_t b
   }
 }
 
+void pool_test()
+{
+  RingBufferPool pool { { 16384, 4096 }, 4096 };
+
+  auto small = pool.acquire( 100 );
+  auto large = pool.acquire( 5000 );
+  assert( small->capacity() == 4096 );
+  assert( large->capacity() == 16384 );
+
+  small->write( "leftover" );
+  pool.release( move( small ) );
+  pool.release( move( large ) ); // exceeds the idle budget
+
+  auto reused = pool.acquire( 4096 );
+  if ( reused->capacity() != 4096 or not reused->readable_region().empty() ) {
+    throw runtime_error( "pool returned a buffer of the wrong class or with stale contents" );
+  }
+
+  auto extra = pool.acquire( 4096 );
+  pool.release( move( reused ) );
+  pool.release( move( extra ) ); // exceeds the idle budget
+
+  const auto stats = pool.statistics();
+  if ( stats.hits != 1 or stats.misses != 3 or stats.releases != 2 or stats.discards != 2 ) {
+    throw runtime_error( "unexpected pool statistics" );
+  }
+
+  if ( pool.idle_bytes() != 4096 ) {
+    throw runtime_error( "unexpected idle bytes" );
+  }
+}
+
+void adaptive_test()
+{
+  AdaptiveRingBufferContext context { { 4096, 16384, 2, 65536 } };
+
+  {
+    AdaptiveRingBuffer buffer { context };
+    assert( buffer.resident_bytes() == 0 );
+
+    // filling the buffer moves the contents to one twice the size
+    const string data( 4096, 'x' );
+    buffer.get().write( data );
+    buffer.update();
+    assert( buffer.get().capacity() == 8192 );
+    if ( buffer.get().readable_region() != data ) {
+      throw runtime_error( "AdaptiveRingBuffer lost data when growing" );
+    }
+
+    // draining it gives it back
+    buffer.get().pop( data.size() );
+    buffer.update();
+    assert( buffer.resident_bytes() == 0 );
+    assert( context.statistics().resident_bytes == 0 );
+
+    // two drains that stay small halve it again
+    for ( int i = 0; i < 2; i++ ) {
+      buffer.get().write( "small" );
+      buffer.update();
+      buffer.get().pop( 5 );
+      buffer.update();
+    }
+    assert( buffer.get().capacity() == 4096 );
+  }
+
+  const auto& stats = context.statistics();
+  if ( stats.grows != 1 or stats.shrinks != 1 or stats.buffers != 0 or stats.resident_bytes != 0 ) {
+    throw runtime_error( "unexpected AdaptiveRingBuffer statistics" );
+  }
+}
+
+void spsc_test( const size_t publish_batch )
+{
+  SpscRingBuffer rb { 4096, publish_batch };
+  constexpr size_t block_size = 777, block_count = 2000;
+
+  thread producer( [&] {
+    string block( block_size, 0 );
+    size_t sent = 0;
+    for ( size_t i = 0; i < block_count; i++ ) {
+      for ( auto& ch : block ) {
+        ch = static_cast<char>( sent++ % 251 );
+      }
+      for ( string_view remaining = block; not remaining.empty(); ) {
+        remaining.remove_prefix( rb.write( remaining ) );
+      }
+    }
+    rb.publish_push();
+  } );
+
+  size_t received = 0;
+  bool mismatch = false;
+  while ( received < block_size * block_count ) {
+    const string_view data = rb.readable_region();
+    for ( const char ch : data ) {
+      mismatch |= ( ch != static_cast<char>( received++ % 251 ) );
+    }
+    rb.pop( data.size() );
+  }
+
+  producer.join();
+
+  if ( mismatch ) {
+    throw runtime_error( "SpscRingBuffer: consumer saw corrupted or reordered data" );
+  }
+}
+
 int main()
 {
   try {
     rb_test( 65536, 800, 641 );
     rb_test( 4096, 32, 4096 );
     rb_test( 8192, 32, 4096 );
+    pool_test();
+    adaptive_test();
+    spsc_test( 1 );
+    spsc_test( 1024 );
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << endl;
     return EXIT_FAILURE;
@@ -0,0 +1,163 @@
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "crc32c.hh"
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "frontend/snapshot.hh"
+
+using namespace std;
+
+static constexpr unsigned int LOAD_THREADS = 4;
+
+string read_file( const string& path )
+{
+  FileDescriptor file { CheckSystemCall( "open " + path, open( path.c_str(), O_RDONLY ) ) };
+  string contents, buffer( 65536, 0 );
+  while ( true ) {
+    const size_t n = file.read( { buffer.data(), buffer.size() } );
+    if ( n == 0 ) {
+      return contents;
+    }
+    contents.append( buffer, 0, n );
+  }
+}
+
+void write_file( const string& path, const string& contents )
+{
+  FileDescriptor file { CheckSystemCall( "open " + path, open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) };
+  for ( string_view unwritten = contents; not unwritten.empty(); ) {
+    unwritten.remove_prefix( file.write( unwritten ) );
+  }
+}
+
+// saves `store` to `path` and checks that loading it gives back every key and value
+void round_trip( const snapshot::Store& store, const string& path )
+{
+  const snapshot::SaveResult saved = snapshot::save( store, path );
+  if ( saved.items != store.size() or saved.bytes != read_file( path ).size() ) {
+    throw runtime_error( "snapshot::save: wrong item count or size reported" );
+  }
+
+  snapshot::Loaded loaded = snapshot::load( path, LOAD_THREADS );
+  if ( loaded.items != store.size() or loaded.bytes != saved.bytes ) {
+    throw runtime_error( "snapshot::load: wrong item count or size reported" );
+  }
+
+  snapshot::Store reloaded;
+  for ( auto& shard : loaded.shards ) {
+    for ( auto& [key, value] : shard ) {
+      if ( not reloaded.emplace( move( key ), move( value ) ).second ) {
+        throw runtime_error( "snapshot::load: a key came back twice" );
+      }
+    }
+  }
+  if ( reloaded != store ) {
+    throw runtime_error( "snapshot::load: the store came back different" );
+  }
+}
+
+// writes `contents` to `path` and checks that loading it throws
+void expect_rejected( const string& path, const string& contents, const string& what )
+{
+  write_file( path, contents );
+  try {
+    snapshot::load( path, LOAD_THREADS );
+  } catch ( const exception& ) {
+    return;
+  }
+  throw runtime_error( "snapshot::load accepted a snapshot with " + what );
+}
+
+void damage_test( const snapshot::Store& store, const string& path )
+{
+  snapshot::save( store, path );
+  const string contents = read_file( path );
+
+  snapshot::Trailer trailer {};
+  memcpy( &trailer, contents.data() + contents.size() - sizeof( trailer ), sizeof( trailer ) );
+  const size_t trailer_offset = contents.size() - sizeof( trailer );
+  const size_t index_offset = trailer_offset - trailer.shard_count * sizeof( snapshot::ShardEntry );
+
+  string corrupted_shard = contents;
+  corrupted_shard[sizeof( snapshot::FileHeader ) + ( index_offset - sizeof( snapshot::FileHeader ) ) / 2] ^= 0x01;
+  expect_rejected( path, corrupted_shard, "a corrupted shard byte" );
+
+  string damaged_index_crc = contents;
+  damaged_index_crc[trailer_offset + offsetof( snapshot::Trailer, index_crc )] ^= 0x01;
+  expect_rejected( path, damaged_index_crc, "a damaged index CRC" );
+
+  for ( const uint64_t shard_count : { trailer.shard_count + 1, uint64_t( 1 ) << 40, UINT64_MAX } ) {
+    string bad_shard_count = contents;
+    memcpy( bad_shard_count.data() + trailer_offset + offsetof( snapshot::Trailer, shard_count ),
+            &shard_count,
+            sizeof( shard_count ) );
+    expect_rejected( path, bad_shard_count, "a shard count of " + to_string( shard_count ) );
+  }
+
+  // an entry pointing past the end of the file, under an index CRC that matches it
+  for ( const uint64_t offset : { uint64_t( contents.size() ), uint64_t( contents.size() ) * 2, UINT64_MAX } ) {
+    string bad_offset = contents;
+    memcpy( bad_offset.data() + index_offset + offsetof( snapshot::ShardEntry, offset ), &offset, sizeof( offset ) );
+    const uint32_t index_crc
+      = crc32c( 0, string_view { bad_offset }.substr( index_offset, trailer_offset - index_offset ) );
+    memcpy(
+      bad_offset.data() + trailer_offset + offsetof( snapshot::Trailer, index_crc ), &index_crc, sizeof( index_crc ) );
+    expect_rejected( path, bad_offset, "a shard offset of " + to_string( offset ) );
+  }
+
+  for ( const size_t length : { size_t( 0 ), size_t( 10 ), contents.size() / 2, contents.size() - 1 } ) {
+    expect_rejected( path, contents.substr( 0, length ), "its end cut off at " + to_string( length ) + " bytes" );
+  }
+}
+
+int main()
+{
+  try {
+    // keys and values are arbitrary bytes, and may be empty
+    mt19937 prng;
+    snapshot::Store store;
+    store.emplace( "", "" );
+    for ( size_t i = 0; i < 5000; i++ ) {
+      string key = "key" + to_string( i ) + string( prng() % 32, 0 );
+      string value( i % 11 == 0 ? 0 : prng() % 2000, 0 );
+      for ( size_t j = 3; j < key.size(); j++ ) {
+        key[j] = static_cast<char>( prng() );
+      }
+      for ( auto& ch : value ) {
+        ch = static_cast<char>( prng() );
+      }
+      store.emplace( move( key ), move( value ) );
+    }
+
+    char directory[] = "/tmp/snapshot-test.XXXXXX";
+    if ( not mkdtemp( directory ) ) {
+      throw unix_error( "mkdtemp" );
+    }
+    const string path = string( directory ) + "/test.snapshot";
+    try {
+      round_trip( {}, path );
+      round_trip( store, path );
+      damage_test( store, path );
+    } catch ( ... ) {
+      unlink( path.c_str() );
+      rmdir( directory );
+      throw;
+    }
+    unlink( path.c_str() );
+    rmdir( directory );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
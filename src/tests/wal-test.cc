@@ -0,0 +1,224 @@
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.hh"
+#include "eventloop.hh"
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "write_ahead_log.hh"
+
+using namespace std;
+
+using Record = tuple<WriteAheadLog::Op, string, string>;
+
+void crc_test()
+{
+  // the check value from the CRC catalogue, on the SSE4.2 path (where the CPU has it) and the table path
+  const string_view check = "123456789";
+  if ( crc32c( 0, check ) != 0xe3069283 or crc32c_portable( 0, check ) != 0xe3069283 ) {
+    throw runtime_error( "crc32c: wrong check value" );
+  }
+
+  // the SSE4.2 path takes eight bytes at a time, so try every alignment of the tail, and continuing a CRC
+  mt19937 prng;
+  string data( 1000, 0 );
+  for ( auto& ch : data ) {
+    ch = static_cast<char>( prng() );
+  }
+
+  const uint32_t whole = crc32c_portable( 0, data );
+  for ( size_t length = 0; length <= data.size(); length++ ) {
+    const string_view prefix = string_view { data }.substr( 0, length );
+    if ( crc32c( 0, prefix ) != crc32c_portable( 0, prefix ) ) {
+      throw runtime_error( "crc32c: paths disagree on " + to_string( length ) + " bytes" );
+    }
+    if ( crc32c( crc32c( 0, prefix ), string_view { data }.substr( length ) ) != whole ) {
+      throw runtime_error( "crc32c: continuing after " + to_string( length ) + " bytes changed the CRC" );
+    }
+  }
+}
+
+string read_file( const string& path )
+{
+  FileDescriptor file { CheckSystemCall( "open " + path, open( path.c_str(), O_RDONLY ) ) };
+  string contents, buffer( 65536, 0 );
+  while ( true ) {
+    const size_t n = file.read( { buffer.data(), buffer.size() } );
+    if ( n == 0 ) {
+      return contents;
+    }
+    contents.append( buffer, 0, n );
+  }
+}
+
+void write_file( const string& path, const string& contents )
+{
+  FileDescriptor file { CheckSystemCall( "open " + path, open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) };
+  for ( string_view unwritten = contents; not unwritten.empty(); ) {
+    unwritten.remove_prefix( file.write( unwritten ) );
+  }
+}
+
+// appends `records` to a new log at `path`, and waits until they are durable
+void write_log( const string& path, const vector<Record>& records )
+{
+  unlink( path.c_str() );
+
+  EventLoop event_loop;
+  const FileDescriptor idle { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+  event_loop.add_rule( "idle", idle, Direction::In, [] {} ); // keeps the loop from exiting
+
+  uint64_t durable = 0;
+  WriteAheadLog log { path, event_loop, { 0, 16 }, [&]( const uint64_t lsn ) { durable = lsn; } };
+  for ( const auto& [op, key, value] : records ) {
+    log.append( op, key, value );
+  }
+  while ( durable < log.last_lsn() ) {
+    event_loop.wait_next_event( -1 );
+  }
+}
+
+vector<Record> replay_log( const string& path )
+{
+  vector<Record> replayed;
+  const uint64_t count
+    = WriteAheadLog::replay( path, [&]( const WriteAheadLog::Op op, const string_view key, const string_view value ) {
+        replayed.emplace_back( op, key, value );
+      } );
+  if ( count != replayed.size() ) {
+    throw runtime_error( "WriteAheadLog::replay: returned count doesn't match the records applied" );
+  }
+  return replayed;
+}
+
+// where each record starts in an intact log
+vector<size_t> record_offsets( const string& contents )
+{
+  vector<size_t> offsets;
+  for ( size_t offset = sizeof( WriteAheadLog::FileHeader ); offset < contents.size(); ) {
+    WriteAheadLog::RecordHeader header {};
+    memcpy( &header, contents.data() + offset, sizeof( header ) );
+    offsets.push_back( offset );
+    offset += sizeof( header ) + header.length;
+  }
+  return offsets;
+}
+
+// replays `contents`, which should yield the first `intact` of `records` and be truncated after them
+void expect_replay( const string& path,
+                    const string& contents,
+                    const vector<Record>& records,
+                    const size_t intact,
+                    const size_t truncated_size,
+                    const string& what )
+{
+  write_file( path, contents );
+
+  const vector<Record> replayed = replay_log( path );
+  if ( replayed != vector<Record>( records.begin(), records.begin() + intact ) ) {
+    throw runtime_error( "WriteAheadLog::replay (" + what + "): applied " + to_string( replayed.size() )
+                         + " records, expected the first " + to_string( intact ) );
+  }
+
+  const size_t size = read_file( path ).size();
+  if ( size != truncated_size ) {
+    throw runtime_error( "WriteAheadLog::replay (" + what + "): log is " + to_string( size )
+                         + " bytes, expected it truncated to " + to_string( truncated_size ) );
+  }
+}
+
+void wal_test( const string& path )
+{
+  mt19937 prng;
+  vector<Record> records;
+  for ( size_t i = 0; i < 200; i++ ) {
+    // keys and values are arbitrary bytes, and a value may be empty
+    string key = "key" + to_string( i ) + string( prng() % 32, 0 );
+    string value( i % 7 == 0 ? 0 : prng() % 300, 0 );
+    for ( size_t j = 3; j < key.size(); j++ ) {
+      key[j] = static_cast<char>( prng() );
+    }
+    for ( auto& ch : value ) {
+      ch = static_cast<char>( prng() );
+    }
+
+    if ( i % 5 == 4 ) {
+      records.emplace_back( WriteAheadLog::Op::Erase, move( key ), "" );
+    } else {
+      records.emplace_back( WriteAheadLog::Op::Put, move( key ), move( value ) );
+    }
+  }
+
+  write_log( path, records );
+  const string contents = read_file( path );
+  const vector<size_t> offsets = record_offsets( contents );
+  if ( offsets.size() != records.size() ) {
+    throw runtime_error( "WriteAheadLog: wrote " + to_string( offsets.size() ) + " records, expected "
+                         + to_string( records.size() ) );
+  }
+
+  // an intact log replays in full, and is left as it was
+  expect_replay( path, contents, records, records.size(), contents.size(), "intact" );
+
+  // a commit cut short by a crash: the last record is only partly written
+  expect_replay(
+    path, contents.substr( 0, offsets.back() + 5 ), records, records.size() - 1, offsets.back(), "torn tail" );
+
+  // damage stops the replay at the damaged record, and everything from there on is dropped
+  const size_t damaged = records.size() / 2;
+
+  string flipped_crc = contents;
+  flipped_crc[offsets[damaged] + offsetof( WriteAheadLog::RecordHeader, crc )] ^= 0x10;
+  expect_replay( path, flipped_crc, records, damaged, offsets[damaged], "flipped CRC byte" );
+
+  // a key length past the end of the payload, under a CRC that matches it
+  string bad_key_length = contents;
+  const size_t payload_offset = offsets[damaged] + sizeof( WriteAheadLog::RecordHeader );
+  WriteAheadLog::RecordHeader header {};
+  memcpy( &header, bad_key_length.data() + offsets[damaged], sizeof( header ) );
+  const uint32_t key_length = header.length;
+  memcpy( bad_key_length.data() + payload_offset + sizeof( WriteAheadLog::Op ), &key_length, sizeof( key_length ) );
+  header.crc = crc32c( crc32c( 0, { reinterpret_cast<const char*>( &header.length ), sizeof( header.length ) } ),
+                       string_view { bad_key_length }.substr( payload_offset, header.length ) );
+  memcpy( bad_key_length.data() + offsets[damaged], &header, sizeof( header ) );
+  expect_replay( path, bad_key_length, records, damaged, offsets[damaged], "bad key length" );
+}
+
+int main()
+{
+  try {
+    crc_test();
+
+    char directory[] = "/tmp/wal-test.XXXXXX";
+    if ( not mkdtemp( directory ) ) {
+      throw unix_error( "mkdtemp" );
+    }
+    const string path = string( directory ) + "/test.wal";
+    try {
+      wal_test( path );
+    } catch ( ... ) {
+      unlink( path.c_str() );
+      rmdir( directory );
+      throw;
+    }
+    unlink( path.c_str() );
+    rmdir( directory );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#include "crc32c.hh"
+
+#include <array>
+#include <cstring>
+
+#if defined( __x86_64__ )
+#include <nmmintrin.h>
+#endif
+
+using namespace std;
+
+static constexpr uint32_t POLYNOMIAL = 0x82f63b78; // reversed
+
+static constexpr array<uint32_t, 256> make_table()
+{
+  array<uint32_t, 256> table {};
+  for ( uint32_t i = 0; i < 256; i++ ) {
+    uint32_t crc = i;
+    for ( int bit = 0; bit < 8; bit++ ) {
+      crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? POLYNOMIAL : 0 );
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+static constexpr array<uint32_t, 256> TABLE = make_table();
+
+static uint32_t crc32c_table( uint32_t crc, const string_view data )
+{
+  for ( const char c : data ) {
+    crc = ( crc >> 8 ) ^ TABLE[( crc ^ static_cast<unsigned char>( c ) ) & 0xff];
+  }
+  return crc;
+}
+
+#if defined( __x86_64__ )
+__attribute__( ( target( "sse4.2" ) ) ) static uint32_t crc32c_sse42( uint32_t crc, string_view data )
+{
+  uint64_t crc64 = crc;
+  while ( data.size() >= sizeof( uint64_t ) ) {
+    uint64_t word;
+    memcpy( &word, data.data(), sizeof( word ) );
+    crc64 = _mm_crc32_u64( crc64, word );
+    data.remove_prefix( sizeof( word ) );
+  }
+
+  crc = crc64;
+  for ( const char c : data ) {
+    crc = _mm_crc32_u8( crc, c );
+  }
+  return crc;
+}
+#endif
+
+uint32_t crc32c( const uint32_t crc, const string_view data )
+{
+#if defined( __x86_64__ )
+  static const bool have_sse42 = __builtin_cpu_supports( "sse4.2" );
+  if ( have_sse42 ) {
+    return ~crc32c_sse42( ~crc, data );
+  }
+#endif
+  return crc32c_portable( crc, data );
+}
+
+uint32_t crc32c_portable( const uint32_t crc, const string_view data )
+{
+  return ~crc32c_table( ~crc, data );
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+//! CRC-32C (Castagnoli) of `data`, continuing from `crc`, the CRC-32C of whatever came before it (0 to start).
+//! \details Uses the SSE4.2 crc32 instruction, eight bytes at a time, on CPUs that have it, and a table
+//! otherwise. crc32c( 0, "123456789" ) is 0xe3069283.
+uint32_t crc32c( const uint32_t crc, const std::string_view data );
+
+//! The table-driven CRC-32C that crc32c() falls back on without SSE4.2 (the same results, only slower)
+uint32_t crc32c_portable( const uint32_t crc, const std::string_view data );
@@ -0,0 +1,103 @@
+#include "event_trace.hh"
+#include "exception.hh"
+#include "timer.hh"
+
+#include <atomic>
+#include <csignal>
+#include <iomanip>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+// incremented by the signal handler (a lock-free atomic, so it's async-signal-safe)
+static atomic<uint64_t> dump_requests { 0 };
+static string dump_path_prefix;
+
+static void request_dump( int )
+{
+  dump_requests.fetch_add( 1, memory_order_relaxed );
+}
+
+EventTrace::EventTrace( const size_t capacity, const unsigned int sample_period )
+  : events_( capacity )
+  , sample_period_( sample_period )
+  , countdown_( sample_period )
+  , dumps_seen_( dump_requests.load( memory_order_relaxed ) )
+{
+  if ( capacity == 0 or sample_period == 0 ) {
+    throw invalid_argument( "EventTrace: capacity and sample period must be nonzero" );
+  }
+}
+
+bool EventTrace::dump_requested()
+{
+  const uint64_t requests = dump_requests.load( memory_order_relaxed );
+  if ( requests == dumps_seen_ ) {
+    return false;
+  }
+
+  dumps_seen_ = requests;
+  return true;
+}
+
+static void write_json_string( ostream& out, const string& str )
+{
+  out << '"';
+  for ( const char c : str ) {
+    if ( c == '"' or c == '\\' ) {
+      out << '\\' << c;
+    } else if ( static_cast<unsigned char>( c ) < 0x20 ) {
+      out << "\\u" << hex << setw( 4 ) << setfill( '0' ) << int( c ) << dec;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+// Chrome wants microseconds
+static void write_us( ostream& out, const uint64_t ns )
+{
+  out << ns / 1000 << '.' << setw( 3 ) << setfill( '0' ) << ns % 1000;
+}
+
+void EventTrace::write_chrome_json( ostream& out, const vector<string>& category_names ) const
+{
+  const pid_t pid = getpid();
+  const long tid = syscall( SYS_gettid );
+  const uint64_t count = min<uint64_t>( recorded_, events_.size() );
+
+  out << "{\"traceEvents\":[";
+  for ( uint64_t i = recorded_ - count; i < recorded_; i++ ) {
+    const Event& event = events_[i % events_.size()];
+
+    out << ( i == recorded_ - count ? "\n" : ",\n" );
+    out << "{\"name\":";
+    write_json_string( out, category_names.at( event.category_id ) );
+    out << ",\"cat\":\"EventLoop\",\"ph\":\"X\",\"ts\":";
+    write_us( out, Timer::ticks_to_timestamp_ns( event.start_ticks ) );
+    out << ",\"dur\":";
+    write_us( out, Timer::ticks_to_ns( event.end_ticks - event.start_ticks ) );
+    out << ",\"pid\":" << pid << ",\"tid\":" << tid;
+    out << ",\"args\":{\"bytes\":" << event.bytes << "}}";
+  }
+  out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void EventTrace::dump_on_signal( const int signum, const string& path_prefix )
+{
+  dump_path_prefix = path_prefix;
+
+  struct sigaction action {};
+  action.sa_handler = request_dump;
+  action.sa_flags = SA_RESTART;
+  CheckSystemCall( "sigemptyset", sigemptyset( &action.sa_mask ) );
+  CheckSystemCall( "sigaction", sigaction( signum, &action, nullptr ) );
+}
+
+string EventTrace::dump_path()
+{
+  return dump_path_prefix + to_string( syscall( SYS_gettid ) ) + ".json";
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//! \brief The most recent callbacks of one EventLoop, kept for latency debugging.
+//! \details One wakeup in every `sample_period` is traced: each callback run from that return from ppoll up
+//! to the next call to ppoll (so including the non-FD rules that the FD rules woke up) is recorded, with its
+//! category, start and end timestamps, and bytes read or written through FileDescriptors, in a fixed-size
+//! ring that overwrites the oldest events. The ring belongs to the loop's thread, so recording takes no locks
+//! and no atomics. Other wakeups cost one decrement.
+//!
+//! After dump_on_signal(), the signal makes every tracing loop write its ring, as Chrome trace JSON (open it
+//! in chrome://tracing or Perfetto), the next time it calls wait_next_event.
+class EventTrace
+{
+public:
+  struct Event
+  {
+    uint64_t start_ticks; //!< Timer::ticks() values
+    uint64_t end_ticks;
+    uint64_t bytes;
+    size_t category_id;
+  };
+
+private:
+  std::vector<Event> events_;
+  uint64_t recorded_ { 0 }; //!< events ever recorded; the next one goes at recorded_ % capacity
+  unsigned int sample_period_;
+  unsigned int countdown_;
+  uint64_t dumps_seen_;
+
+public:
+  EventTrace( const size_t capacity, const unsigned int sample_period );
+
+  //! Called when the loop wakes up from ppoll
+  //! \returns whether the callbacks until the next ppoll should be recorded
+  bool sample_wakeup()
+  {
+    if ( --countdown_ ) {
+      return false;
+    }
+    countdown_ = sample_period_;
+    return true;
+  }
+
+  void record( const Event& event ) { events_[recorded_++ % events_.size()] = event; }
+
+  //! Whether a dump has been requested (by signal) since this trace last checked
+  bool dump_requested();
+
+  //! Writes the events in the ring, oldest first, in Chrome's JSON trace event format
+  void write_chrome_json( std::ostream& out, const std::vector<std::string>& category_names ) const;
+
+  //! Makes `signum` request a dump from every EventTrace, to `path_prefix` followed by the thread ID and
+  //! ".json" (the previous dump from that thread is overwritten)
+  static void dump_on_signal( const int signum, const std::string& path_prefix );
+
+  //! Where dumps go, as given to dump_on_signal()
+  static std::string dump_path();
+};
@@ -1,17 +1,80 @@
 #include "eventloop.hh"
 #include "exception.hh"
+#include "prometheus.hh"
 #include "socket.hh"
 #include "timer.hh"
 
+#include <algorithm>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 
 using namespace std;
 
-unsigned int EventLoop::FDRule::service_count() const
+EventLoop::EventLoop()
+  : _post_fd( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
+{
+  add_rule( "posted tasks", _post_fd, Direction::In, [this] { run_posted_tasks(); } );
+}
+
+EventLoop::~EventLoop()
+{
+  while ( MPSCQueue::Node* const node = _posted.pop() ) {
+    delete static_cast<PostedTask*>( node );
+  }
+}
+
+void EventLoop::set_post_budget( const size_t budget )
+{
+  if ( budget == 0 ) {
+    throw invalid_argument( "EventLoop: post budget must be nonzero" );
+  }
+  _post_budget = budget;
+}
+
+void EventLoop::enqueue_post( PostedTask* task, const bool reserved )
+{
+  if ( not reserved ) {
+    _outstanding_posts.fetch_add( 1, memory_order_relaxed );
+  }
+  _posted.push( task );
+  wake_for_posts();
+}
+
+void EventLoop::wake_for_posts()
 {
-  return direction == Direction::In ? fd.read_count() : fd.write_count();
+  if ( not _post_wakeup_pending.exchange( true, memory_order_acq_rel ) ) {
+    // not FileDescriptor::write, whose bookkeeping belongs to the loop's thread
+    const uint64_t one = 1;
+    CheckSystemCall( "write", ::write( _post_fd.fd_num(), &one, sizeof( one ) ) );
+  }
+}
+
+void EventLoop::run_posted_tasks()
+{
+  uint64_t count;
+  _post_fd.read( { reinterpret_cast<char*>( &count ), sizeof( count ) } );
+
+  // posts that find the flag clear from here on will write to _post_fd again
+  _post_wakeup_pending.exchange( false, memory_order_acq_rel );
+
+  for ( size_t i = 0; i < _post_budget; i++ ) {
+    MPSCQueue::Node* const node = _posted.pop();
+    if ( not node ) {
+      return;
+    }
+
+    const unique_ptr<PostedTask> task { static_cast<PostedTask*>( node ) };
+    task->run();
+    _outstanding_posts.fetch_sub( 1, memory_order_relaxed );
+  }
+
+  // out of budget: come back on the next call to wait_next_event
+  wake_for_posts();
 }
 
 size_t EventLoop::add_category( const string& name )
@@ -20,201 +83,339 @@ size_t EventLoop::add_category( const string& name )
   return _rule_categories.size() - 1;
 }
 
-EventLoop::BasicRule::BasicRule( const size_t category_id, const InterestT& interest, const CallbackT& callback )
-  : category_id( category_id )
-  , interest( interest )
-  , callback( callback )
-  , cancel_requested( false )
-{}
-
-EventLoop::FDRule::FDRule( BasicRule&& base, FileDescriptor&& fd, const Direction direction, const CallbackT& cancel )
-  : BasicRule( base )
-  , fd( move( fd ) )
-  , direction( direction )
-  , cancel( cancel )
-{}
-
-EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
-                                           const FileDescriptor& fd,
-                                           const Direction direction,
-                                           const CallbackT& callback,
-                                           const InterestT& interest,
-                                           const CallbackT& cancel )
+void EventLoop::check_category( const size_t category_id ) const
 {
   if ( category_id >= _rule_categories.size() ) {
     throw out_of_range( "bad category_id" );
   }
+}
+
+void EventLoop::set_category_budget( const size_t category_id, const unsigned int runs )
+{
+  check_category( category_id );
+  _rule_categories[category_id].budget = runs;
+}
+
+void EventLoop::check_poll_error( const int fd_num, const size_t category_id ) const
+{
+  /* see if fd is a socket */
+  int socket_error = 0;
+  socklen_t optlen = sizeof( socket_error );
+  const int ret = getsockopt( fd_num, SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+  if ( ret == -1 and errno == ENOTSOCK ) {
+    throw runtime_error( "error on polled file descriptor for rule \"" + _rule_categories.at( category_id ).name
+                         + "\"" );
+  } else if ( ret == -1 ) {
+    throw unix_error( "getsockopt" );
+  } else if ( optlen != sizeof( socket_error ) ) {
+    throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+  } else if ( socket_error ) {
+    throw unix_error( "error on polled socket for rule \"" + _rule_categories.at( category_id ).name + "\"",
+                      socket_error );
+  }
+}
 
-  _fd_rules.emplace_back(
-    make_shared<FDRule>( BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel ) );
+void EventLoop::throw_busy_wait( const size_t category_id, const unsigned int iterations ) const
+{
+  throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( category_id ).name
+                       + "\" is still interested after " + to_string( iterations ) + " iterations" );
+}
 
-  return _fd_rules.back();
+void EventLoop::throw_busy_wait( const size_t category_id ) const
+{
+  throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( category_id ).name
+                       + "\" did not read/write fd and is still interested" );
 }
 
-EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
-                                           const CallbackT& callback,
-                                           const InterestT& interest )
+static constexpr size_t TIMER_HEAP_ARITY = 4;
+
+void EventLoop::push_timer( const TimerEntry& entry )
 {
-  if ( category_id >= _rule_categories.size() ) {
-    throw out_of_range( "bad category_id" );
+  size_t index = _timers.size();
+  _timers.push_back( entry );
+
+  while ( index > 0 ) {
+    const size_t parent = ( index - 1 ) / TIMER_HEAP_ARITY;
+    if ( _timers[parent].deadline <= entry.deadline ) {
+      break;
+    }
+    _timers[index] = _timers[parent];
+    index = parent;
   }
 
-  _non_fd_rules.emplace_back( make_shared<BasicRule>( category_id, interest, callback ) );
+  _timers[index] = entry;
+}
+
+void EventLoop::sift_timer_down( size_t index )
+{
+  const TimerEntry entry = _timers[index];
+
+  while ( true ) {
+    const size_t first_child = index * TIMER_HEAP_ARITY + 1;
+    if ( first_child >= _timers.size() ) {
+      break;
+    }
+
+    size_t earliest = first_child;
+    const size_t last_child = min( first_child + TIMER_HEAP_ARITY, _timers.size() );
+    for ( size_t child = first_child + 1; child < last_child; child++ ) {
+      if ( _timers[child].deadline < _timers[earliest].deadline ) {
+        earliest = child;
+      }
+    }
+
+    if ( _timers[earliest].deadline >= entry.deadline ) {
+      break;
+    }
+    _timers[index] = _timers[earliest];
+    index = earliest;
+  }
 
-  return _non_fd_rules.back();
+  _timers[index] = entry;
 }
 
-void EventLoop::RuleHandle::cancel()
+EventLoop::TimerEntry EventLoop::pop_timer()
 {
-  const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
-  if ( rule_shared_ptr ) {
-    rule_shared_ptr->cancel_requested = true;
+  const TimerEntry ret = _timers.front();
+  _timers.front() = _timers.back();
+  _timers.pop_back();
+  if ( not _timers.empty() ) {
+    sift_timer_down( 0 );
+  }
+  return ret;
+}
+
+void EventLoop::timer_cancelled()
+{
+  _live_timers--;
+
+  if ( _timers.size() <= 1024 or _timers.size() <= 2 * _live_timers ) {
+    return;
+  }
+
+  // drop the entries of cancelled timers and restore the heap property
+  _timers.erase( remove_if( _timers.begin(),
+                            _timers.end(),
+                            []( const TimerEntry& entry ) {
+                              return not entry.table->live( entry.index, entry.generation );
+                            } ),
+                 _timers.end() );
+
+  for ( size_t i = _timers.size() / TIMER_HEAP_ARITY + 1; i-- > 0; ) {
+    if ( i < _timers.size() ) {
+      sift_timer_down( i );
+    }
+  }
+}
+
+bool EventLoop::run_timers()
+{
+  bool timer_fired = false;
+  const uint64_t now = Timer::timestamp_ns();
+
+  while ( not _timers.empty() and _timers.front().deadline <= now ) {
+    const TimerEntry entry = pop_timer();
+    const auto outcome = entry.table->fire( entry.index, entry.generation, entry.deadline, now );
+    timer_fired |= outcome.fired;
+    if ( outcome.next_deadline ) {
+      push_timer( { outcome.next_deadline, entry.table, entry.index, entry.generation } );
+    }
+  }
+
+  return timer_fired;
+}
+
+void EventLoop::enable_tracing( const size_t capacity, const unsigned int sample_period )
+{
+  _trace = make_unique<EventTrace>( capacity, sample_period );
+}
+
+bool EventLoop::enable_perf_counters( const unsigned int sample_period )
+{
+  if ( sample_period == 0 ) {
+    throw invalid_argument( "EventLoop: performance counter sample period must be nonzero" );
+  }
+
+  _perf = make_unique<PerfCounters>();
+  _perf_sample_period = _perf_countdown = sample_period;
+  return _perf->available();
+}
+
+void EventLoop::start_counting()
+{
+  PerfCounters::Reading reading;
+  if ( _perf->read( reading ) ) {
+    _counters_at_start = reading;
+  } else {
+    _counters_at_start.reset();
+  }
+}
+
+void EventLoop::stop_counting( const size_t category_id )
+{
+  PerfCounters::Reading end;
+  if ( not _counters_at_start.has_value() or not _perf->read( end ) ) {
+    return;
+  }
+
+  // if the group was multiplexed out for part of the callback, the counts don't cover all of it
+  const PerfCounters::Reading& start = *_counters_at_start;
+  if ( end.time_running - start.time_running != end.time_enabled - start.time_enabled ) {
+    return;
+  }
+
+  RuleCategory& category = _rule_categories[category_id];
+  for ( size_t i = 0; i < PerfCounters::num_events; i++ ) {
+    category.counted[i] += end.values[i] - start.values[i];
+  }
+  category.counted_callbacks++;
+}
+
+void EventLoop::dump_trace() const
+{
+  vector<string> category_names;
+  for ( const auto& category : _rule_categories ) {
+    category_names.push_back( category.name );
+  }
+
+  // a failed dump shouldn't take the loop down with it
+  const string path = EventTrace::dump_path();
+  ofstream out { path };
+  _trace->write_chrome_json( out, category_names );
+  out.close();
+  if ( not out ) {
+    cerr << "EventLoop: could not write trace to " << path << "\n";
   }
 }
 
 EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 {
-  // first, handle the non-file-descriptor-related rules
+  if ( _trace and _trace->dump_requested() ) {
+    dump_trace();
+  }
+
+  // timers that are due go first, since they may make other rules interested
+  run_timers();
+
+  // then, handle the non-file-descriptor-related rules
   {
     unsigned int iterations = 0;
     while ( true ) {
       ++iterations;
       bool rule_fired = false;
-      for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
-        auto& this_rule = **it;
-
-        if ( this_rule.cancel_requested ) {
-          it = _non_fd_rules.erase( it );
-          continue;
-        }
-
-        if ( this_rule.interest() ) {
-          if ( iterations > 128 ) {
-            throw runtime_error( "EventLoop: busy wait detected: rule \""
-                                 + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
-                                 + to_string( iterations ) + " iterations" );
-          }
-
-          rule_fired = true;
-          RecordScopeTimer<Timer::Category::Nonblock> record_timer {
-            _rule_categories.at( this_rule.category_id ).timer
-          };
-          this_rule.callback();
-        }
-
-        ++it;
+      // NOTE: callbacks may add tables, so don't hold on to iterators
+      for ( size_t i = 0; i < _non_fd_tables.size(); i++ ) {
+        rule_fired |= _non_fd_tables[i]->run_interested( iterations );
       }
 
+      // rules woken during this pass will be considered on the next one
+      _running.swap( _runnable );
+      for ( const auto& rule : _running ) {
+        rule_fired |= rule.table->run( rule.index, iterations );
+      }
+      _running.clear();
+
       if ( not rule_fired ) {
         break;
       }
     }
   }
 
+  // rules that ran out of budget go first on the next call, and meanwhile the loop mustn't sleep
+  const bool work_deferred = _work_deferred;
+  _work_deferred = false;
+  _runnable.insert( _runnable.end(), _deferred.begin(), _deferred.end() );
+  _deferred.clear();
+
   // now the file-descriptor-related rules. poll any "interested" file descriptors
-  vector<pollfd> pollfds {};
-  pollfds.reserve( _fd_rules.size() );
-  bool something_to_poll = false;
+  vector<pollfd>& pollfds = _pollfds;
+  pollfds.clear();
+  size_t interested = 0;
 
   // set up the pollfd for each rule
-  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
-    auto& this_rule = **it;
-
-    if ( this_rule.cancel_requested ) {
-      /* this_rule.cancel(); */
-      it = _fd_rules.erase( it );
-      continue;
-    }
-
-    if ( this_rule.direction == Direction::In && this_rule.fd.eof() ) {
-      // no more reading on this rule, it's reached eof
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
-    }
+  const size_t table_count = _fd_tables.size();
+  for ( size_t i = 0; i < table_count; i++ ) {
+    interested += _fd_tables[i]->prepare( pollfds );
+  }
 
-    if ( this_rule.fd.closed() ) {
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
-    }
+  // quit if there is nothing left to poll or wait for (the posted-tasks rule doesn't count)
+  if ( interested <= 1 and not work_deferred and _live_timers == 0
+       and _outstanding_posts.load( memory_order_relaxed ) == 0 ) {
+    return Result::Exit;
+  }
 
-    if ( this_rule.interest() ) {
-      pollfds.push_back( { this_rule.fd.fd_num(), static_cast<short>( this_rule.direction ), 0 } );
-      something_to_poll = true;
-    } else {
-      pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
+  // don't sleep past the next timer's deadline
+  optional<uint64_t> timeout_ns;
+  if ( work_deferred ) {
+    timeout_ns = 0;
+  } else if ( timeout_ms >= 0 ) {
+    timeout_ns = uint64_t( timeout_ms ) * 1'000'000;
+  }
+  bool woken_for_timer = false;
+  if ( not _timers.empty() ) {
+    const uint64_t now = Timer::timestamp_ns();
+    const uint64_t until_deadline = _timers.front().deadline > now ? _timers.front().deadline - now : 0;
+    if ( not timeout_ns.has_value() or until_deadline < *timeout_ns ) {
+      timeout_ns = until_deadline;
+      woken_for_timer = true;
     }
-    ++it;
   }
 
-  // quit if there is nothing left to poll
-  if ( not something_to_poll ) {
-    return Result::Exit;
+  // the work done since the last wakeup is over
+  _tracing_wakeup = false;
+  _counting_wakeup = false;
+  const uint64_t poll_start = Timer::ticks();
+  if ( _poll_wakeups ) {
+    _rules_per_wakeup.record( _rules_fired - _rules_fired_at_wakeup );
+    _rules_per_wakeup_sum += _rules_fired - _rules_fired_at_wakeup;
+
+    const uint64_t busy = poll_start - _wakeup_ticks;
+    _iteration.log( busy );
+    _average_iteration = _average_iteration - _average_iteration / 8 + busy / 8;
   }
 
   // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
+  int ready_count;
   {
-    GlobalScopeTimer<Timer::Category::WaitingForEvent> timer;
-    if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
-      return Result::Timeout;
-    }
-  }
-
-  // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), size_t( 0 ) ); it != _fd_rules.end(); ++idx ) {
-    const auto& this_pollfd = pollfds[idx];
-    auto& this_rule = **it;
-
-    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
-    if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        throw runtime_error( "error on polled file descriptor for rule \""
-                             + _rule_categories.at( this_rule.category_id ).name + "\"" );
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        throw unix_error( "error on polled socket for rule \"" + _rule_categories.at( this_rule.category_id ).name
-                            + "\"",
-                          socket_error );
-      }
-
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+    RecordScopeTimer<Timer::Category::WaitingForEvent> timer { _poll_wait };
+    timespec timeout {};
+    if ( timeout_ns.has_value() ) {
+      timeout.tv_sec = *timeout_ns / 1'000'000'000;
+      timeout.tv_nsec = *timeout_ns % 1'000'000'000;
     }
+    ready_count = ::ppoll( pollfds.data(), pollfds.size(), timeout_ns.has_value() ? &timeout : nullptr, nullptr );
 
-    const auto poll_ready = static_cast<bool>( this_pollfd.revents & this_pollfd.events );
-    const auto poll_hup = static_cast<bool>( this_pollfd.revents & POLLHUP );
-    if ( poll_hup && this_pollfd.events && !poll_ready ) {
-      // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
-      //   - if it was POLLIN and nothing is readable, no more will ever be readable
-      //   - if it was POLLOUT, it will not be writable again
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+    // a signal (e.g. asking for a trace dump) cut the wait short
+    if ( ready_count < 0 and errno == EINTR ) {
+      ready_count = 0;
     }
+    CheckSystemCall( "ppoll", ready_count );
+  }
 
-    if ( poll_ready ) {
-      RecordScopeTimer<Timer::Category::Nonblock> record_timer { _rule_categories.at( this_rule.category_id ).timer };
-      // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
+  _poll_wakeups++;
+  _rules_fired_at_wakeup = _rules_fired;
+  _wakeup_ticks = Timer::ticks();
 
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
-      }
-    }
+  // while the loop waited it wasn't behind at all, so time asleep pays the average busy time down (otherwise a
+  // burst would keep an idle loop looking overloaded until enough wakeups had averaged it away)
+  const uint64_t slept = _wakeup_ticks - poll_start;
+  _average_iteration = _average_iteration > slept ? _average_iteration - slept : 0;
+  if ( _trace ) {
+    _tracing_wakeup = _trace->sample_wakeup();
+  }
+  if ( _perf and _perf->available() and --_perf_countdown == 0 ) {
+    _perf_countdown = _perf_sample_period;
+    _counting_wakeup = true;
+  }
+
+  if ( ready_count == 0 ) {
+    return ( work_deferred or ( woken_for_timer and run_timers() ) ) ? Result::Success : Result::Timeout;
+  }
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+  // go through the poll results (tables added by callbacks in the meantime have nothing to dispatch)
+  size_t next = 0;
+  for ( size_t i = 0; i < table_count; i++ ) {
+    _fd_tables[i]->dispatch( pollfds, next );
   }
 
   return Result::Success;
@@ -222,6 +423,38 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 
 constexpr double THOUSAND = 1000.0;
 
+using PerfEvent = PerfCounters::Event;
+
+static uint64_t counted( const array<uint64_t, PerfCounters::num_events>& counts, const PerfEvent event )
+{
+  return counts[static_cast<size_t>( event )];
+}
+
+void EventLoop::write_counted( ostream& out, const RuleCategory& rule ) const
+{
+  const double callbacks = rule.counted_callbacks;
+  out << setprecision( 2 ) << fixed;
+  if ( _perf->has( PerfEvent::Cycles ) and _perf->has( PerfEvent::Instructions )
+       and counted( rule.counted, PerfEvent::Cycles ) ) {
+    out << " [IPC=" << double( counted( rule.counted, PerfEvent::Instructions ) )
+                         / counted( rule.counted, PerfEvent::Cycles )
+        << "]";
+  }
+  if ( _perf->has( PerfEvent::CacheMisses ) ) {
+    out << " [LLC misses/call=" << counted( rule.counted, PerfEvent::CacheMisses ) / callbacks << "]";
+  }
+  if ( _perf->has( PerfEvent::BranchMisses ) ) {
+    out << " [branch misses/call=" << counted( rule.counted, PerfEvent::BranchMisses ) / callbacks << "]";
+  }
+  out << " [sampled=" << rule.counted_callbacks << "]";
+}
+
+uint64_t EventLoop::lag_ns() const
+{
+  const uint64_t current = _poll_wakeups ? Timer::ticks() - _wakeup_ticks : 0;
+  return Timer::ticks_to_ns( max( current, _average_iteration ) );
+}
+
 string EventLoop::summary() const
 {
   ostringstream out;
@@ -234,12 +467,120 @@ string EventLoop::summary() const
 
     out << "   " << name << ": ";
     out << string( 32 - name.size(), ' ' );
-    out << Timer::pp_ns( timer.total_ns );
+    out << Timer::pp_ticks( timer.total_ticks.load() );
 
-    out << "     [max=" << Timer::pp_ns( timer.max_ns ) << "]";
-    out << " [count=" << timer.count << "]";
+    out << "     [max=" << Timer::pp_ticks( timer.max_ticks.load() ) << "]";
+    out << " [p99=" << Timer::pp_ticks( timer.histogram.quantile( 0.99 ) ) << "]";
+    out << " [count=" << timer.count.load() << "]";
+    if ( rule.budget ) {
+      out << " [deferred=" << rule.deferred << "]";
+    }
+    if ( rule.counted_callbacks ) {
+      write_counted( out, rule );
+    }
     out << "\n";
   }
 
+  out << "\n   Iteration (busy time per wakeup): " << Timer::pp_ticks( _iteration.total_ticks.load() );
+  out << "     [max=" << Timer::pp_ticks( _iteration.max_ticks.load() ) << "]";
+  out << " [p99=" << Timer::pp_ticks( _iteration.histogram.quantile( 0.99 ) ) << "]";
+  out << " [count=" << _iteration.count.load() << "]\n";
+  out << "   Dispatch lag (ready to callback):  [max=" << Timer::pp_ticks( _dispatch_lag.max_ticks.load() ) << "]";
+  out << " [p99=" << Timer::pp_ticks( _dispatch_lag.histogram.quantile( 0.99 ) ) << "]";
+  out << " [count=" << _dispatch_lag.count.load() << "]\n";
+
+  if ( _perf and not _perf->unavailable_reason().empty() ) {
+    out << "\n   Performance counters missing (" << _perf->unavailable_reason() << ")\n";
+  }
+
   return out.str();
 }
+
+void EventLoop::write_metrics( PrometheusText& out ) const
+{
+  out.family( "eventloop_callback_seconds", "histogram", "Time spent in the callbacks of each rule category" );
+  for ( const auto& rule : _rule_categories ) {
+    out.duration_histogram(
+      "eventloop_callback_seconds", PrometheusText::label( "category", rule.name ), rule.timer );
+  }
+
+  out.family( "eventloop_deferred_total", "counter", "Times a rule ran out of its category's budget" );
+  for ( const auto& rule : _rule_categories ) {
+    if ( rule.budget ) {
+      out.sample( "eventloop_deferred_total", PrometheusText::label( "category", rule.name ), rule.deferred );
+    }
+  }
+
+  out.family( "eventloop_poll_wakeups_total", "counter", "Returns from ppoll" );
+  out.sample( "eventloop_poll_wakeups_total", "", _poll_wakeups );
+
+  out.family( "eventloop_rules_fired_total", "counter", "Rule callbacks run" );
+  out.sample( "eventloop_rules_fired_total", "", _rules_fired );
+
+  out.family( "eventloop_rules_per_wakeup", "histogram", "Rule callbacks run after each return from ppoll" );
+  out.histogram( "eventloop_rules_per_wakeup", "", _rules_per_wakeup, _rules_per_wakeup_sum, 16 );
+
+  out.family( "eventloop_poll_wait_seconds", "histogram", "Time spent waiting in ppoll" );
+  out.duration_histogram( "eventloop_poll_wait_seconds", "", _poll_wait );
+
+  out.family( "eventloop_iteration_seconds", "histogram", "Time from each return from ppoll to the next call" );
+  out.duration_histogram( "eventloop_iteration_seconds", "", _iteration );
+
+  out.family( "eventloop_dispatch_lag_seconds",
+              "histogram",
+              "Time from a return from ppoll to each ready file descriptor's callback starting" );
+  out.duration_histogram( "eventloop_dispatch_lag_seconds", "", _dispatch_lag );
+
+  out.family( "eventloop_lag_seconds", "gauge", "How far behind the loop is running (see EventLoop::lag_ns)" );
+  out.sample( "eventloop_lag_seconds", "", lag_ns() / 1e9 );
+
+  if ( not _perf or not _perf->available() ) {
+    return;
+  }
+
+  out.family( "eventloop_perf_sampled_callbacks_total",
+              "counter",
+              "Callbacks that the performance counters were read around, by category" );
+  for ( const auto& rule : _rule_categories ) {
+    out.sample( "eventloop_perf_sampled_callbacks_total",
+                PrometheusText::label( "category", rule.name ),
+                rule.counted_callbacks );
+  }
+
+  out.family( "eventloop_perf_events_total", "counter", "Hardware events counted in sampled callbacks, by category" );
+  for ( const auto& rule : _rule_categories ) {
+    for ( size_t i = 0; i < PerfCounters::num_events; i++ ) {
+      if ( _perf->has( static_cast<PerfEvent>( i ) ) ) {
+        out.sample( "eventloop_perf_events_total",
+                    PrometheusText::label( "category", rule.name ) + ","
+                      + PrometheusText::label( "event", PerfCounters::event_names[i] ),
+                    rule.counted[i] );
+      }
+    }
+  }
+
+  if ( _perf->has( PerfEvent::Cycles ) and _perf->has( PerfEvent::Instructions ) ) {
+    out.family( "eventloop_perf_instructions_per_cycle", "gauge", "IPC of sampled callbacks, by category" );
+    for ( const auto& rule : _rule_categories ) {
+      if ( counted( rule.counted, PerfEvent::Cycles ) ) {
+        out.sample( "eventloop_perf_instructions_per_cycle",
+                    PrometheusText::label( "category", rule.name ),
+                    double( counted( rule.counted, PerfEvent::Instructions ) )
+                      / counted( rule.counted, PerfEvent::Cycles ) );
+      }
+    }
+  }
+
+  out.family(
+    "eventloop_perf_events_per_callback", "gauge", "Cache and branch misses per sampled callback, by category" );
+  for ( const auto& rule : _rule_categories ) {
+    for ( const PerfEvent event : { PerfEvent::CacheMisses, PerfEvent::BranchMisses } ) {
+      if ( _perf->has( event ) and rule.counted_callbacks ) {
+        out.sample( "eventloop_perf_events_per_callback",
+                    PrometheusText::label( "category", rule.name ) + ","
+                      + PrometheusText::label( "event", PerfCounters::event_names[static_cast<size_t>( event )] ),
+                    double( counted( rule.counted, event ) ) / rule.counted_callbacks );
+      }
+    }
+  }
+}
@@ -1,16 +1,37 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <functional>
-#include <list>
 #include <memory>
+#include <optional>
 #include <string_view>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
 
 #include <poll.h>
 
+#include "event_trace.hh"
 #include "file_descriptor.hh"
+#include "mpsc_queue.hh"
+#include "perf_counters.hh"
 #include "timer.hh"
 
+class PrometheusText;
+
 //! Waits for events on file descriptors and executes corresponding callbacks.
+//! \details Rules are kept in tables, one per combination of callable types, so that rules added from the same
+//! place in the code (e.g. the per-connection lambdas of a server) sit next to each other in memory and are
+//! dispatched with direct calls. Rules given as std::function still work; they share one table per signature.
+//!
+//! A rule without a file descriptor is either polled (its interest is evaluated on every pass) or wakeup-driven
+//! (it is only considered after RuleHandle::wake, so idle rules cost nothing).
+//!
+//! Timers are kept in a 4-ary min-heap of deadlines, and the poll timeout is cut short by the next deadline.
+//! A cancelled timer's slot is freed at once; its heap entry is skipped when it comes up, and the heap is
+//! rebuilt when such entries outnumber the live ones.
 class EventLoop
 {
 public:
@@ -21,42 +42,680 @@ public:
     Out = POLLOUT //!< Callback will be triggered when Rule::fd is writable.
   };
 
-private:
-  using CallbackT = std::function<void( void )>;
-  using InterestT = std::function<bool( void )>;
+  //! Default interest: the rule always wants to run
+  struct AlwaysInterested
+  {
+    bool operator()() const { return true; }
+  };
 
+  //! Default cancel callback: do nothing
+  struct NoCancel
+  {
+    void operator()() const {}
+  };
+
+private:
   struct RuleCategory
   {
     std::string name;
     Timer::Record timer;
+    unsigned int budget { 0 }; //!< runs per rule per call to wait_next_event (0: unlimited)
+    uint64_t deferred { 0 };   //!< times a rule ran out of budget
+    std::array<uint64_t, PerfCounters::num_events> counted {}; //!< performance counters, over sampled callbacks
+    uint64_t counted_callbacks { 0 };
   };
 
-  struct BasicRule
+  //! Bookkeeping common to every rule
+  struct RuleState
   {
-    size_t category_id;
-    InterestT interest;
-    CallbackT callback;
+    uint32_t generation; //!< incremented each time the slot is freed, so stale handles can be detected
     bool cancel_requested;
+    bool runnable; //!< a wakeup-driven rule that is waiting in EventLoop::_runnable
+    bool running;  //!< a timer whose callback is running
+    size_t category_id;
+  };
+
+  //! Around a callback: counts it, times it into its category's record (and the global Nonblock category),
+  //! and traces it and reads the performance counters around it if the current wakeup is sampled for those
+  class CallbackScope
+  {
+    EventLoop& loop_;
+    size_t category_id_;
+    uint64_t start_ticks_;
+    uint64_t start_bytes_ { 0 };
+
+  public:
+    CallbackScope( EventLoop& loop, const size_t category_id )
+      : loop_( loop )
+      , category_id_( category_id )
+      , start_ticks_( Timer::ticks() )
+    {
+      loop_._rules_fired++;
+      global_timer().start<Timer::Category::Nonblock>( start_ticks_ );
+      if ( loop_._tracing_wakeup ) {
+        start_bytes_ = FileDescriptor::bytes_moved_on_this_thread();
+      }
+      if ( loop_._counting_wakeup ) {
+        loop_.start_counting();
+      }
+    }
+
+    ~CallbackScope()
+    {
+      if ( loop_._counting_wakeup ) {
+        loop_.stop_counting( category_id_ );
+      }
+      const uint64_t now = Timer::ticks();
+      loop_._rule_categories[category_id_].timer.log( now - start_ticks_ );
+      global_timer().stop<Timer::Category::Nonblock>( now );
+      if ( loop_._tracing_wakeup ) {
+        loop_._trace->record(
+          { start_ticks_, now, FileDescriptor::bytes_moved_on_this_thread() - start_bytes_, category_id_ } );
+      }
+    }
+
+    uint64_t start_ticks() const { return start_ticks_; }
+
+    /* Disallow copying */
+    CallbackScope( const CallbackScope& other ) = delete;
+    CallbackScope& operator=( const CallbackScope& other ) = delete;
+  };
+
+  //! Storage for rules of one type, with a free list of slots.
+  //! \details Slots live in fixed-size chunks and never move, so a callback may add rules (even to the
+  //! slab that holds the callback itself) while it is running.
+  template<class Rule>
+  class RuleSlab
+  {
+    static constexpr size_t CHUNK_SIZE = 256;
+
+    struct Slot
+    {
+      RuleState state {};
+      std::optional<Rule> rule {};
+    };
+
+    std::vector<std::unique_ptr<std::array<Slot, CHUNK_SIZE>>> chunks_ {};
+    std::vector<uint32_t> free_slots_ {};
+    uint32_t size_ { 0 }; //!< one past the highest slot ever used
+
+  public:
+    uint32_t size() const { return size_; }
+
+    Slot& at( const uint32_t index ) { return ( *chunks_[index / CHUNK_SIZE] )[index % CHUNK_SIZE]; }
+
+    //! \returns the slot that now holds the rule
+    template<class... Args>
+    uint32_t emplace( const size_t category_id, Args&&... args )
+    {
+      uint32_t index;
+      if ( free_slots_.empty() ) {
+        if ( size_ % CHUNK_SIZE == 0 ) {
+          chunks_.push_back( std::make_unique<std::array<Slot, CHUNK_SIZE>>() );
+        }
+        index = size_++;
+      } else {
+        index = free_slots_.back();
+        free_slots_.pop_back();
+      }
+
+      Slot& slot = at( index );
+      slot.rule.emplace( Rule { std::forward<Args>( args )... } );
+      slot.state.cancel_requested = false;
+      slot.state.runnable = false;
+      slot.state.running = false;
+      slot.state.category_id = category_id;
+      return index;
+    }
+
+    void erase( const uint32_t index )
+    {
+      Slot& slot = at( index );
+      slot.rule.reset();
+      slot.state.generation++;
+      free_slots_.push_back( index );
+    }
+  };
+
+  //! A table of rules, as seen by RuleHandle
+  class RuleTable
+  {
+  protected:
+    EventLoop& loop_;
+
+  public:
+    explicit RuleTable( EventLoop& loop )
+      : loop_( loop )
+    {}
+
+    virtual void request_cancel( const uint32_t index, const uint32_t generation ) = 0;
+
+    //! Only wakeup-driven rules need to be woken; the others are considered on every pass anyway
+    virtual void wake( const uint32_t, const uint32_t ) {}
+
+    virtual ~RuleTable() = default;
+  };
+
+  //! A table of polled rules that are not associated with a file descriptor
+  class NonFDRuleTable : public RuleTable
+  {
+  public:
+    using RuleTable::RuleTable;
+
+    //! Runs the callback of every interested rule and frees the slots of cancelled rules
+    //! \returns true if any rule fired
+    virtual bool run_interested( const unsigned int iterations ) = 0;
+  };
+
+  //! A table of wakeup-driven rules
+  class WakeupRuleTable : public RuleTable
+  {
+  public:
+    using RuleTable::RuleTable;
+
+    //! Runs the callback of a rule taken from EventLoop::_runnable if it is interested, or frees its slot if it
+    //! was cancelled. A rule that fired stays runnable, since it may still be interested.
+    //! \returns true if the rule fired
+    virtual bool run( const uint32_t index, const unsigned int iterations ) = 0;
+  };
+
+  //! A table of rules that wait for a file descriptor to become readable or writable
+  class FDRuleTable : public RuleTable
+  {
+  public:
+    using RuleTable::RuleTable;
+
+    //! Frees the slots of cancelled or defunct rules, and appends a pollfd for each remaining rule
+    //! \returns the number of rules that are interested
+    virtual size_t prepare( std::vector<pollfd>& pollfds ) = 0;
+
+    //! Acts on the poll results for the rules that prepare() saw, starting at pollfds[next]
+    virtual void dispatch( const std::vector<pollfd>& pollfds, size_t& next ) = 0;
+  };
+
+  //! A table of timers
+  class TimerTable : public RuleTable
+  {
+  public:
+    using RuleTable::RuleTable;
+
+    struct Outcome
+    {
+      bool fired;             //!< false if the timer had been cancelled
+      uint64_t next_deadline; //!< 0 if the timer is done (and its slot has been freed)
+    };
 
-    BasicRule( const size_t category_id, const InterestT& interest, const CallbackT& callback );
+    virtual bool live( const uint32_t index, const uint32_t generation ) = 0;
+
+    //! Runs the timer's callback if the timer is still live
+    virtual Outcome fire( const uint32_t index, const uint32_t generation, const uint64_t deadline, const uint64_t now )
+      = 0;
   };
 
-  struct FDRule : public BasicRule
+  template<class Callback>
+  struct TimerRule
   {
-    FileDescriptor fd;   //!< FileDescriptor to monitor for activity.
-    Direction direction; //!< Direction::In for reading from fd, Direction::Out for writing to fd.
-    CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on hangup)
+    Callback callback;
+    uint64_t period_ns; //!< 0 for a one-shot timer
+  };
 
-    FDRule( BasicRule&& base, FileDescriptor&& fd, const Direction direction, const CallbackT& cancel );
+  template<class Callback, class Interest>
+  struct BasicRule
+  {
+    Callback callback;
+    Interest interest;
+  };
+
+  template<class Callback, class Interest, class Cancel>
+  struct FDRule
+  {
+    const FileDescriptor* fd; //!< FileDescriptor to monitor for activity (not owned).
+    Direction direction;      //!< Direction::In for reading from fd, Direction::Out for writing to fd.
+    Callback callback;
+    Interest interest;
+    Cancel cancel; //!< A callback that is called when the rule is cancelled (e.g. on hangup)
 
     //! Returns the number of times fd has been read or written, depending on the value of Rule::direction.
-    //! \details This function is used internally by EventLoop; you will not need to call it
-    unsigned int service_count() const;
+    unsigned int service_count() const
+    {
+      return direction == Direction::In ? fd->read_count() : fd->write_count();
+    }
+  };
+
+  template<class Callback, class Interest>
+  class BasicRuleTable : public NonFDRuleTable
+  {
+    RuleSlab<BasicRule<Callback, Interest>> rules_ {};
+
+  public:
+    using NonFDRuleTable::NonFDRuleTable;
+
+    RuleSlab<BasicRule<Callback, Interest>>& rules() { return rules_; }
+
+    void request_cancel( const uint32_t index, const uint32_t generation ) override
+    {
+      auto& slot = rules_.at( index );
+      if ( slot.rule and slot.state.generation == generation ) {
+        slot.state.cancel_requested = true;
+      }
+    }
+
+    bool run_interested( const unsigned int iterations ) override
+    {
+      bool rule_fired = false;
+
+      for ( uint32_t i = 0; i < rules_.size(); i++ ) {
+        auto& slot = rules_.at( i );
+        if ( not slot.rule ) {
+          continue;
+        }
+
+        if ( slot.state.cancel_requested ) {
+          rules_.erase( i );
+          continue;
+        }
+
+        if ( slot.rule->interest() ) {
+          if ( loop_.out_of_budget( slot.state.category_id, iterations ) ) {
+            continue;
+          }
+
+          rule_fired = true;
+          CallbackScope callback_scope { loop_, slot.state.category_id };
+          slot.rule->callback();
+        }
+      }
+
+      return rule_fired;
+    }
+  };
+
+  template<class Callback, class Interest>
+  class WakeupRuleTableOf : public WakeupRuleTable
+  {
+    RuleSlab<BasicRule<Callback, Interest>> rules_ {};
+
+  public:
+    using WakeupRuleTable::WakeupRuleTable;
+
+    RuleSlab<BasicRule<Callback, Interest>>& rules() { return rules_; }
+
+    void request_cancel( const uint32_t index, const uint32_t generation ) override
+    {
+      auto& slot = rules_.at( index );
+      if ( slot.rule and slot.state.generation == generation ) {
+        slot.state.cancel_requested = true;
+        wake( index, generation ); // so that the loop frees the slot
+      }
+    }
+
+    void wake( const uint32_t index, const uint32_t generation ) override
+    {
+      auto& slot = rules_.at( index );
+      if ( slot.rule and slot.state.generation == generation and not slot.state.runnable ) {
+        slot.state.runnable = true;
+        loop_._runnable.push_back( { this, index } );
+      }
+    }
+
+    bool run( const uint32_t index, const unsigned int iterations ) override
+    {
+      auto& slot = rules_.at( index );
+      slot.state.runnable = false;
+
+      if ( slot.state.cancel_requested ) {
+        rules_.erase( index );
+        return false;
+      }
+
+      if ( not slot.rule->interest() ) {
+        return false;
+      }
+
+      if ( loop_.out_of_budget( slot.state.category_id, iterations ) ) {
+        slot.state.runnable = true;
+        loop_._deferred.push_back( { this, index } );
+        return false;
+      }
+
+      {
+        CallbackScope callback_scope { loop_, slot.state.category_id };
+        slot.rule->callback();
+      }
+
+      wake( index, slot.state.generation );
+      return true;
+    }
+  };
+
+  template<class Callback>
+  class TimerTableOf : public TimerTable
+  {
+    RuleSlab<TimerRule<Callback>> rules_ {};
+
+  public:
+    using TimerTable::TimerTable;
+
+    RuleSlab<TimerRule<Callback>>& rules() { return rules_; }
+
+    bool live( const uint32_t index, const uint32_t generation ) override
+    {
+      auto& slot = rules_.at( index );
+      return slot.rule and slot.state.generation == generation;
+    }
+
+    void request_cancel( const uint32_t index, const uint32_t generation ) override
+    {
+      auto& slot = rules_.at( index );
+      if ( not slot.rule or slot.state.generation != generation ) {
+        return;
+      }
+
+      if ( slot.state.running ) {
+        slot.state.cancel_requested = true; // fire() frees the slot once the callback returns
+      } else {
+        rules_.erase( index );
+        loop_.timer_cancelled();
+      }
+    }
+
+    Outcome fire( const uint32_t index,
+                  const uint32_t generation,
+                  const uint64_t deadline,
+                  const uint64_t now ) override
+    {
+      auto& slot = rules_.at( index );
+      if ( not slot.rule or slot.state.generation != generation ) {
+        return { false, 0 };
+      }
+
+      slot.state.running = true;
+      {
+        CallbackScope callback_scope { loop_, slot.state.category_id };
+        slot.rule->callback();
+      }
+      slot.state.running = false;
+
+      if ( slot.state.cancel_requested or slot.rule->period_ns == 0 ) {
+        rules_.erase( index );
+        loop_._live_timers--;
+        return { true, 0 };
+      }
+
+      // a periodic timer that fell behind skips the ticks it missed
+      const uint64_t next_deadline = deadline + slot.rule->period_ns;
+      return { true, next_deadline > now ? next_deadline : now + slot.rule->period_ns };
+    }
+  };
+
+  template<class Callback, class Interest, class Cancel>
+  class FDRuleTableOf : public FDRuleTable
+  {
+    RuleSlab<FDRule<Callback, Interest, Cancel>> rules_ {};
+    std::vector<uint32_t> polled_ {}; //!< the slots that prepare() made a pollfd for, in order
+
+  public:
+    using FDRuleTable::FDRuleTable;
+
+    RuleSlab<FDRule<Callback, Interest, Cancel>>& rules() { return rules_; }
+
+    void request_cancel( const uint32_t index, const uint32_t generation ) override
+    {
+      auto& slot = rules_.at( index );
+      if ( slot.rule and slot.state.generation == generation ) {
+        slot.state.cancel_requested = true;
+      }
+    }
+
+    size_t prepare( std::vector<pollfd>& pollfds ) override
+    {
+      size_t interested = 0;
+      polled_.clear();
+
+      for ( uint32_t i = 0; i < rules_.size(); i++ ) {
+        auto& slot = rules_.at( i );
+        if ( not slot.rule ) {
+          continue;
+        }
+
+        // a cancelled rule's fd may already be gone, so check the flag before touching it
+        if ( slot.state.cancel_requested ) {
+          rules_.erase( i );
+          continue;
+        }
+
+        auto& rule = *slot.rule;
+
+        if ( ( rule.direction == Direction::In and rule.fd->eof() ) or rule.fd->closed() ) {
+          // no more reading or writing on this rule
+          rule.cancel();
+          rules_.erase( i );
+          continue;
+        }
+
+        polled_.push_back( i );
+        if ( rule.interest() ) {
+          pollfds.push_back( { rule.fd->fd_num(), static_cast<short>( rule.direction ), 0 } );
+          interested++;
+        } else {
+          pollfds.push_back( { rule.fd->fd_num(), 0, 0 } ); // placeholder --- we still want errors
+        }
+      }
+
+      return interested;
+    }
+
+    void dispatch( const std::vector<pollfd>& pollfds, size_t& next ) override
+    {
+      for ( const uint32_t index : polled_ ) {
+        const auto& this_pollfd = pollfds[next++];
+        if ( this_pollfd.revents == 0 ) {
+          continue;
+        }
+
+        auto& slot = rules_.at( index );
+        if ( slot.state.cancel_requested ) {
+          continue; // cancelled by an earlier callback in this round
+        }
+
+        auto& rule = *slot.rule;
+
+        if ( this_pollfd.revents & ( POLLERR | POLLNVAL ) ) {
+          loop_.check_poll_error( rule.fd->fd_num(), slot.state.category_id );
+          rule.cancel();
+          rules_.erase( index );
+          continue;
+        }
+
+        const auto poll_ready = static_cast<bool>( this_pollfd.revents & this_pollfd.events );
+        const auto poll_hup = static_cast<bool>( this_pollfd.revents & POLLHUP );
+        if ( poll_hup && this_pollfd.events && !poll_ready ) {
+          // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
+          //   - if it was POLLIN and nothing is readable, no more will ever be readable
+          //   - if it was POLLOUT, it will not be writable again
+          rule.cancel();
+          rules_.erase( index );
+          continue;
+        }
+
+        if ( poll_ready ) {
+          CallbackScope callback_scope { loop_, slot.state.category_id };
+          loop_._dispatch_lag.log( callback_scope.start_ticks() - loop_._wakeup_ticks );
+          // we only want to call callback if revents includes the event we asked for
+          const auto count_before = rule.service_count();
+          rule.callback();
+
+          if ( not slot.state.cancel_requested and count_before == rule.service_count()
+               and ( not rule.fd->closed() ) and rule.interest() ) {
+            loop_.throw_busy_wait( slot.state.category_id );
+          }
+        }
+      }
+    }
   };
 
   std::vector<RuleCategory> _rule_categories {};
-  std::list<std::shared_ptr<FDRule>> _fd_rules {};
-  std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
+  std::vector<std::unique_ptr<FDRuleTable>> _fd_tables {};
+  std::vector<std::unique_ptr<NonFDRuleTable>> _non_fd_tables {};
+  std::vector<std::unique_ptr<WakeupRuleTable>> _wakeup_tables {};
+  std::vector<std::unique_ptr<TimerTable>> _timer_tables {};
+  std::unordered_map<std::type_index, RuleTable*> _tables_by_type {};
+  std::vector<pollfd> _pollfds {}; //!< reused by each call to wait_next_event
+
+  struct RunnableRule
+  {
+    WakeupRuleTable* table;
+    uint32_t index;
+  };
+
+  std::vector<RunnableRule> _runnable {}; //!< wakeup-driven rules to consider on the next pass
+  std::vector<RunnableRule> _running {};  //!< the ones being considered on this pass
+  std::vector<RunnableRule> _deferred {}; //!< the ones that ran out of budget during this call
+
+  bool _work_deferred { false }; //!< a rule ran out of budget during this call
+
+  uint64_t _poll_wakeups { 0 };          //!< returns from ppoll
+  uint64_t _rules_fired { 0 };           //!< callbacks run, including timers and posted-task batches
+  uint64_t _rules_fired_at_wakeup { 0 }; //!< _rules_fired when ppoll last returned
+  Timer::Histogram _rules_per_wakeup {}; //!< callbacks run between one return from ppoll and the next call
+  uint64_t _rules_per_wakeup_sum { 0 };
+  Timer::Record _poll_wait {};           //!< time spent in ppoll
+
+  uint64_t _wakeup_ticks { 0 };      //!< when ppoll last returned
+  Timer::Record _dispatch_lag {};    //!< from a return from ppoll to each file descriptor's callback starting
+  Timer::Record _iteration {};       //!< from a return from ppoll to the next call (the loop's busy time)
+  uint64_t _average_iteration { 0 }; //!< of _iteration, in ticks, exponentially weighted over ~8 iterations,
+                                     //!< less the time since spent in ppoll
+
+  std::unique_ptr<EventTrace> _trace {};
+  bool _tracing_wakeup { false }; //!< the callbacks since ppoll last returned are being traced
+
+  //! Writes the trace to EventTrace::dump_path()
+  void dump_trace() const;
+
+  std::unique_ptr<PerfCounters> _perf {};
+  unsigned int _perf_sample_period { 0 };
+  unsigned int _perf_countdown { 0 };
+  bool _counting_wakeup { false };             //!< the callbacks since ppoll last returned are being counted
+  std::optional<PerfCounters::Reading> _counters_at_start {}; //!< as the current callback started
+
+  void start_counting();
+  void stop_counting( const size_t category_id );
+
+  //! Adds IPC and misses per callback to a category's line of the summary
+  void write_counted( std::ostream& out, const RuleCategory& rule ) const;
+
+  //! Whether a rule that is still interested on pass `iterations` must wait for the next call to
+  //! wait_next_event (throws if its category has no budget and the rule looks like a busy wait)
+  bool out_of_budget( const size_t category_id, const unsigned int iterations )
+  {
+    RuleCategory& category = _rule_categories[category_id];
+
+    if ( category.budget == 0 ) {
+      if ( iterations > 128 ) {
+        throw_busy_wait( category_id, iterations );
+      }
+      return false;
+    }
+
+    // wakeup-driven and polled rules run at most once per pass
+    if ( iterations > category.budget ) {
+      category.deferred++;
+      _work_deferred = true;
+      return true;
+    }
+
+    return false;
+  }
+
+  struct TimerEntry
+  {
+    uint64_t deadline;
+    TimerTable* table;
+    uint32_t index;
+    uint32_t generation;
+  };
+
+  std::vector<TimerEntry> _timers {}; //!< 4-ary min-heap on deadline, including entries of cancelled timers
+  size_t _live_timers { 0 };
+
+  void push_timer( const TimerEntry& entry );
+  TimerEntry pop_timer();
+  void sift_timer_down( size_t index );
+
+  //! Drops the heap entries of cancelled timers once they outnumber the live ones
+  void timer_cancelled();
+
+  //! Fires the timers that are due
+  //! \returns true if any timer fired
+  bool run_timers();
+
+  //! A callable posted from another thread
+  struct PostedTask : public MPSCQueue::Node
+  {
+    virtual void run() = 0;
+  };
+
+  template<class Callable>
+  struct PostedTaskOf : public PostedTask
+  {
+    Callable callable;
+
+    explicit PostedTaskOf( Callable&& c )
+      : callable( std::move( c ) )
+    {}
+
+    explicit PostedTaskOf( const Callable& c )
+      : callable( c )
+    {}
+
+    void run() override { callable(); }
+  };
+
+  // Posted tasks wait in _posted. A poster that finds _post_wakeup_pending clear sets it and writes to
+  // _post_fd, whose rule (always interested, but not counted when deciding whether to exit) drains the queue.
+  FileDescriptor _post_fd;
+  MPSCQueue _posted {};
+  std::atomic<bool> _post_wakeup_pending { false };
+  std::atomic<size_t> _outstanding_posts { 0 }; //!< posted but not yet run; the loop doesn't exit until zero
+  size_t _post_budget { 256 };
+
+  void enqueue_post( PostedTask* task, const bool reserved );
+  void wake_for_posts();
+
+  //! Runs up to _post_budget posted tasks
+  void run_posted_tasks();
+
+  template<class Table>
+  Table& table()
+  {
+    const auto it = _tables_by_type.find( typeid( Table ) );
+    if ( it != _tables_by_type.end() ) {
+      return static_cast<Table&>( *it->second );
+    }
+
+    auto table = std::make_unique<Table>( *this );
+    Table& ret = *table;
+    if constexpr ( std::is_base_of_v<FDRuleTable, Table> ) {
+      _fd_tables.push_back( std::move( table ) );
+    } else if constexpr ( std::is_base_of_v<WakeupRuleTable, Table> ) {
+      _wakeup_tables.push_back( std::move( table ) );
+    } else if constexpr ( std::is_base_of_v<TimerTable, Table> ) {
+      _timer_tables.push_back( std::move( table ) );
+    } else {
+      _non_fd_tables.push_back( std::move( table ) );
+    }
+    _tables_by_type.emplace( typeid( Table ), &ret );
+    return ret;
+  }
+
+  void check_category( const size_t category_id ) const;
+
+  //! Throws unless the polled fd is a socket without a pending error
+  void check_poll_error( const int fd_num, const size_t category_id ) const;
+
+  [[noreturn]] void throw_busy_wait( const size_t category_id, const unsigned int iterations ) const;
+  [[noreturn]] void throw_busy_wait( const size_t category_id ) const;
 
 public:
   //! Returned by each call to EventLoop::wait_next_event.
@@ -67,45 +726,229 @@ public:
     Exit //!< All rules have been canceled or were uninterested; make no further calls to EventLoop::wait_next_event.
   };
 
+  EventLoop();
+  ~EventLoop();
+
+  /* Disallow copying */
+  EventLoop( const EventLoop& other ) = delete;
+  EventLoop& operator=( const EventLoop& other ) = delete;
+
   size_t add_category( const std::string& name );
 
+  //! Limits each non-file-descriptor rule in a category to `runs` callbacks per call to wait_next_event, so
+  //! that a busy client can't starve the others. A rule that is still interested after that waits for the
+  //! next call, which then polls without sleeping. With no budget (the default), a rule that is still
+  //! interested after 128 passes is reported as a busy wait.
+  void set_category_budget( const size_t category_id, const unsigned int runs );
+
+  //! Refers to a rule; cancelling a rule that is already gone does nothing.
+  //! \details A handle must not be used after its EventLoop has been destroyed.
   class RuleHandle
   {
-    std::weak_ptr<BasicRule> rule_weak_ptr_;
+    RuleTable* table_;
+    uint32_t index_;
+    uint32_t generation_;
 
   public:
-    template<class RuleType>
-    RuleHandle( const std::shared_ptr<RuleType> x )
-      : rule_weak_ptr_( x )
+    RuleHandle( RuleTable& table, const uint32_t index, const uint32_t generation )
+      : table_( &table )
+      , index_( index )
+      , generation_( generation )
     {}
 
-    void cancel();
+    RuleHandle( const RuleHandle& other ) = default;
+    RuleHandle& operator=( const RuleHandle& other ) = default;
+
+    void cancel() { table_->request_cancel( index_, generation_ ); }
+
+    //! Tells the loop that a wakeup-driven rule may have become interested (to be called on the loop's thread)
+    void wake() { table_->wake( index_, generation_ ); }
   };
 
-  RuleHandle add_rule(
-    const size_t category_id,
-    const FileDescriptor& fd,
-    const Direction direction,
-    const CallbackT& callback,
-    const InterestT& interest = [] { return true; },
-    const CallbackT& cancel = [] {} );
+  //! Lets a producer (e.g. a TCPSession that has just read bytes) wake the rule that consumes what it produced
+  class Wakeup
+  {
+    std::optional<RuleHandle> rule_ {};
+
+  public:
+    void set( const RuleHandle& rule ) { rule_.emplace( rule ); }
+
+    void notify()
+    {
+      if ( rule_ ) {
+        rule_->wake();
+      }
+    }
+  };
+
+  //! Adds a rule that runs `callback` when `fd` is ready in `direction` and `interest` returns true.
+  //! \details The rule keeps a pointer to `fd`, which must stay in place until the rule is cancelled
+  //! (destroying `fd` from within `cancel` or from a callback that also cancels the rule is fine).
+  template<class Callback, class Interest = AlwaysInterested, class Cancel = NoCancel>
+  RuleHandle add_rule( const size_t category_id,
+                       const FileDescriptor& fd,
+                       const Direction direction,
+                       Callback&& callback,
+                       Interest&& interest = {},
+                       Cancel&& cancel = {} )
+  {
+    check_category( category_id );
+
+    auto& rule_table
+      = table<FDRuleTableOf<std::decay_t<Callback>, std::decay_t<Interest>, std::decay_t<Cancel>>>();
+    const uint32_t index = rule_table.rules().emplace( category_id,
+                                                       &fd,
+                                                       direction,
+                                                       std::forward<Callback>( callback ),
+                                                       std::forward<Interest>( interest ),
+                                                       std::forward<Cancel>( cancel ) );
+
+    return { rule_table, index, rule_table.rules().at( index ).state.generation };
+  }
+
+  //! Adds a rule that runs `callback` whenever `interest` returns true.
+  template<class Callback, class Interest = AlwaysInterested>
+  RuleHandle add_rule( const size_t category_id, Callback&& callback, Interest&& interest = {} )
+  {
+    check_category( category_id );
+
+    auto& rule_table = table<BasicRuleTable<std::decay_t<Callback>, std::decay_t<Interest>>>();
+    const uint32_t index = rule_table.rules().emplace(
+      category_id, std::forward<Callback>( callback ), std::forward<Interest>( interest ) );
+
+    return { rule_table, index, rule_table.rules().at( index ).state.generation };
+  }
+
+  //! Adds a rule that runs `callback` when `interest` returns true, but only evaluates `interest` after the rule
+  //! was woken (see RuleHandle::wake and Wakeup). The rule starts out woken, and stays woken for as long as it
+  //! fires, so whoever changes the state that `interest` depends on needs to wake it.
+  template<class Callback, class Interest>
+  RuleHandle add_wakeup_rule( const size_t category_id, Callback&& callback, Interest&& interest )
+  {
+    check_category( category_id );
+
+    auto& rule_table = table<WakeupRuleTableOf<std::decay_t<Callback>, std::decay_t<Interest>>>();
+    const uint32_t index = rule_table.rules().emplace(
+      category_id, std::forward<Callback>( callback ), std::forward<Interest>( interest ) );
+    const uint32_t generation = rule_table.rules().at( index ).state.generation;
+    rule_table.wake( index, generation );
+
+    return { rule_table, index, generation };
+  }
+
+  //! Adds a timer that runs `callback` once, at `deadline_ns` (a Timer::timestamp_ns() value).
+  //! \details Cancel it through the returned handle; cancelling a timer that has fired does nothing.
+  template<class Callback>
+  RuleHandle add_timer( const size_t category_id, const uint64_t deadline_ns, Callback&& callback )
+  {
+    return add_timer_rule( category_id, deadline_ns, 0, std::forward<Callback>( callback ) );
+  }
+
+  //! Adds a timer that runs `callback` every `period_ns` nanoseconds, starting one period from now, until it is
+  //! cancelled.
+  template<class Callback>
+  RuleHandle add_periodic_timer( const size_t category_id, const uint64_t period_ns, Callback&& callback )
+  {
+    if ( period_ns == 0 ) {
+      throw std::invalid_argument( "EventLoop: periodic timer needs a nonzero period" );
+    }
+
+    return add_timer_rule(
+      category_id, Timer::timestamp_ns() + period_ns, period_ns, std::forward<Callback>( callback ) );
+  }
+
+  //! Queues `callable` to run on the loop's thread, from any thread.
+  //! \details Each call to wait_next_event runs at most `budget` posted tasks (see set_post_budget), in the order
+  //! they were posted (per posting thread). Tasks still queued when the loop is destroyed are dropped unrun.
+  template<class Callable>
+  void post( Callable&& callable )
+  {
+    enqueue_post( new PostedTaskOf<std::decay_t<Callable>>( std::forward<Callable>( callable ) ), false );
+  }
 
-  RuleHandle add_rule(
-    const size_t category_id,
-    const CallbackT& callback,
-    const InterestT& interest = [] { return true; } );
+  //! Keeps the loop from exiting until a matching post_reserved() has run, e.g. while a background job whose
+  //! completion will be posted is running (any thread)
+  void reserve_post() { _outstanding_posts.fetch_add( 1, std::memory_order_relaxed ); }
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! Like post(), but uses up a reservation made with reserve_post()
+  template<class Callable>
+  void post_reserved( Callable&& callable )
+  {
+    enqueue_post( new PostedTaskOf<std::decay_t<Callable>>( std::forward<Callable>( callable ) ), true );
+  }
+
+  //! Sets how many posted tasks each call to wait_next_event may run
+  void set_post_budget( const size_t budget );
+
+  //! Traces the callbacks that follow one return from ppoll in every `sample_period`, keeping the most recent
+  //! `capacity` of them (see EventTrace, and EventTrace::dump_on_signal to get them out)
+  void enable_tracing( const size_t capacity = 65536, const unsigned int sample_period = 100 );
+
+  //! Reads the hardware performance counters (see PerfCounters) around the callbacks that follow one return
+  //! from ppoll in every `sample_period`, and adds them up by category. Each read is a system call, so the
+  //! sampled callbacks take about a microsecond longer.
+  //! \returns false if no counters are available here (the loop then runs as if this was never called)
+  bool enable_perf_counters( const unsigned int sample_period = 100 );
+
+  //! Runs the timers that are due, calls [ppoll(2)](\ref man2::ppoll) (waiting no later than the next timer's
+  //! deadline) and then executes callback for each ready fd.
   Result wait_next_event( const int timeout_ms );
 
+  //! How far behind the loop is running: the larger of its recent busy time per iteration (from a return from
+  //! ppoll to the next call, averaged over about 8 iterations, less the time it has since spent waiting in
+  //! ppoll) and how long the current iteration has run. A file descriptor that becomes ready now will wait about
+  //! this long for its callback.
+  uint64_t lag_ns() const;
+
   std::string summary() const;
 
+  //! Adds the callback durations of each category, poll wakeups, callbacks per wakeup, time spent waiting,
+  //! the loop's lag, and (if enabled) performance counters by category
+  void write_metrics( PrometheusText& out ) const;
+
   // convenience function to add category and rule at the same time
   template<typename... Targs>
   auto add_rule( const std::string& name, Targs&&... Fargs )
   {
     return add_rule( add_category( name ), std::forward<Targs>( Fargs )... );
   }
+
+  template<typename... Targs>
+  auto add_timer( const std::string& name, Targs&&... Fargs )
+  {
+    return add_timer( add_category( name ), std::forward<Targs>( Fargs )... );
+  }
+
+  template<typename... Targs>
+  auto add_periodic_timer( const std::string& name, Targs&&... Fargs )
+  {
+    return add_periodic_timer( add_category( name ), std::forward<Targs>( Fargs )... );
+  }
+
+private:
+  template<class Callback>
+  RuleHandle add_timer_rule( const size_t category_id,
+                             const uint64_t deadline_ns,
+                             const uint64_t period_ns,
+                             Callback&& callback );
 };
 
+template<class Callback>
+EventLoop::RuleHandle EventLoop::add_timer_rule( const size_t category_id,
+                                                 const uint64_t deadline_ns,
+                                                 const uint64_t period_ns,
+                                                 Callback&& callback )
+{
+  check_category( category_id );
+
+  auto& rule_table = table<TimerTableOf<std::decay_t<Callback>>>();
+  const uint32_t index = rule_table.rules().emplace( category_id, std::forward<Callback>( callback ), period_ns );
+  const uint32_t generation = rule_table.rules().at( index ).state.generation;
+
+  push_timer( { deadline_ns, &rule_table, index, generation } );
+  _live_timers++;
+
+  return { rule_table, index, generation };
+}
+
 using Direction = EventLoop::Direction;
@@ -11,6 +11,13 @@
 
 using namespace std;
 
+static thread_local uint64_t bytes_moved_on_thread = 0;
+
+uint64_t FileDescriptor::bytes_moved_on_this_thread()
+{
+  return bytes_moved_on_thread;
+}
+
 //! \param[in] fd is the file descriptor number returned by [open(2)](\ref man2::open) or similar
 FileDescriptor::FDWrapper::FDWrapper( const int fd )
   : _fd( fd )
@@ -75,6 +82,7 @@ size_t FileDescriptor::read( simple_string_span buffer )
   }
 
   register_read();
+  bytes_moved_on_thread += bytes_read;
 
   if ( bytes_read == 0 ) {
     _internal_fd->_eof = true;
@@ -91,6 +99,7 @@ size_t FileDescriptor::write( const string_view buffer )
 {
   const ssize_t bytes_written = CheckSystemCall( "write", ::write( fd_num(), buffer.data(), buffer.size() ) );
   register_write();
+  bytes_moved_on_thread += bytes_written;
 
   if ( bytes_written == 0 and buffer.size() != 0 ) {
     throw runtime_error( "write returned 0 given non-empty input buffer" );
@@ -113,6 +122,7 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
 
   const ssize_t bytes_written = CheckSystemCall( "writev", ::writev( fd_num(), iovecs.data(), iovecs.size() ) );
   register_write();
+  bytes_moved_on_thread += bytes_written;
 
   return bytes_written;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <vector>
@@ -78,6 +79,9 @@ public:
   //! Close the underlying file descriptor
   void close() { _internal_fd->close(); }
 
+  //! Bytes read and written through any FileDescriptor by the calling thread
+  static uint64_t bytes_moved_on_this_thread();
+
   //! Copy a FileDescriptor explicitly, increasing the FDWrapper refcount
   FileDescriptor duplicate() const;
 
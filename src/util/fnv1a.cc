@@ -0,0 +1,13 @@
+#include "fnv1a.hh"
+
+using namespace std;
+
+uint64_t fnv1a( const string_view data )
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  for ( const char ch : data ) {
+    hash ^= static_cast<uint8_t>( ch );
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+//! 64-bit FNV-1a hash of `data`: cheap, and (unlike std::hash) the same in every process, build and machine, so
+//! it can be shared through memory or stored in files.
+uint64_t fnv1a( const std::string_view data );
@@ -0,0 +1,119 @@
+#include "hot_keys.hh"
+#include "prometheus.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+HotKeys::HotKeys( const size_t k, const uint32_t sample_period )
+  : k_( k )
+  , sample_period_( sample_period )
+  , countdown_( 1 )
+  , random_state_( 0 )
+{
+  if ( k == 0 or sample_period == 0 ) {
+    throw invalid_argument( "HotKeys: k and sample period must be nonzero" );
+  }
+
+  auto generator = get_random_generator();
+  random_state_ = ( uint64_t( generator() ) << 32 | generator() ) | 1;
+  top_.reserve( k );
+  countdown_ = next_gap();
+}
+
+uint32_t HotKeys::next_gap()
+{
+  // xorshift64
+  random_state_ ^= random_state_ << 13;
+  random_state_ ^= random_state_ >> 7;
+  random_state_ ^= random_state_ << 17;
+  return 1 + random_state_ % ( 2 * uint64_t( sample_period_ ) - 1 );
+}
+
+void HotKeys::count( const string_view key )
+{
+  sampled_++;
+
+  // the rows' indices come from two halves of one hash (Kirsch and Mitzenmacher)
+  const uint64_t hash = std::hash<string_view> {}( key );
+  const uint32_t h1 = hash;
+  const uint32_t h2 = ( hash >> 32 ) | 1;
+
+  array<uint32_t*, DEPTH> cells {};
+  uint32_t estimate = UINT32_MAX;
+  for ( size_t row = 0; row < DEPTH; row++ ) {
+    cells[row] = &counters_[row][( h1 + row * h2 ) & ( WIDTH - 1 )];
+    estimate = min( estimate, *cells[row] );
+  }
+
+  if ( estimate == UINT32_MAX ) {
+    return;
+  }
+  estimate++;
+
+  for ( uint32_t* cell : cells ) {
+    *cell = max( *cell, estimate );
+  }
+
+  // already a top key?
+  for ( auto& entry : top_ ) {
+    if ( entry.hash == hash and entry.key == key ) {
+      entry.count = estimate;
+      return;
+    }
+  }
+
+  if ( top_.size() < k_ ) {
+    top_.push_back( { string( key ), hash, estimate } );
+    return;
+  }
+
+  auto coldest
+    = min_element( top_.begin(), top_.end(), []( const Entry& a, const Entry& b ) { return a.count < b.count; } );
+  if ( estimate > coldest->count ) {
+    *coldest = { string( key ), hash, estimate };
+  }
+}
+
+void HotKeys::decay()
+{
+  for ( auto& row : counters_ ) {
+    for ( auto& counter : row ) {
+      counter >>= 1;
+    }
+  }
+
+  for ( auto& entry : top_ ) {
+    entry.count >>= 1;
+  }
+  top_.erase( remove_if( top_.begin(), top_.end(), []( const Entry& entry ) { return entry.count == 0; } ),
+              top_.end() );
+}
+
+vector<HotKeys::Entry> HotKeys::top() const
+{
+  vector<Entry> ret = top_;
+  sort( ret.begin(), ret.end(), []( const Entry& a, const Entry& b ) { return a.count > b.count; } );
+  return ret;
+}
+
+bool HotKeys::is_hot( const string_view key, const uint64_t min_requests ) const
+{
+  const uint64_t hash = std::hash<string_view> {}( key );
+  for ( const auto& entry : top_ ) {
+    if ( entry.hash == hash and entry.key == key ) {
+      return requests( entry.count ) >= min_requests;
+    }
+  }
+  return false;
+}
+
+void HotKeys::write_metrics( PrometheusText& out, const string_view name ) const
+{
+  for ( const auto& entry : top() ) {
+    out.sample( name, PrometheusText::label( "key", entry.key ), requests( entry.count ) );
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class PrometheusText;
+
+//! \brief Finds the most requested keys in a stream of requests, from a sample of it.
+//! \details offer() counts one key in every `sample_period` on average (the gaps between samples are random, so
+//! that traffic with a period of its own can't hide a key from the sample). Sampled keys are counted in a
+//! count-min sketch of DEPTH rows of WIDTH counters, with conservative update (only the counters that hold the
+//! key's current minimum go up), and the `k` keys with the highest estimates are kept alongside. k is small, so
+//! the top keys are a plain array searched by hash, not a heap. decay() halves every count, so the estimates
+//! follow what is hot now rather than what was hot since startup.
+//!
+//! An unsampled offer() is a decrement and a branch; a sampled one hashes the key and touches DEPTH counters
+//! and the top-k array. One thread (the event loop's) uses each HotKeys.
+class HotKeys
+{
+public:
+  static constexpr size_t DEPTH = 4;
+  static constexpr size_t WIDTH = 4096; //!< a power of two
+
+  struct Entry
+  {
+    std::string key;
+    uint64_t hash;
+    uint32_t count; //!< estimated sampled requests
+  };
+
+private:
+  std::array<std::array<uint32_t, WIDTH>, DEPTH> counters_ {};
+  std::vector<Entry> top_ {}; //!< at most k_, unordered
+  size_t k_;
+  uint32_t sample_period_;
+  uint32_t countdown_;
+  uint64_t random_state_;
+  uint64_t sampled_ {};
+
+  //! Gap until the next sample: uniform in [1, 2 * sample_period - 1]
+  uint32_t next_gap();
+
+  void count( const std::string_view key );
+
+public:
+  HotKeys( const size_t k, const uint32_t sample_period );
+
+  //! Called for every request
+  void offer( const std::string_view key )
+  {
+    if ( --countdown_ ) {
+      return;
+    }
+    countdown_ = next_gap();
+    count( key );
+  }
+
+  //! Halves every count, and forgets top keys whose count reaches zero
+  void decay();
+
+  //! The top keys, most requested first
+  std::vector<Entry> top() const;
+
+  //! Whether `key` is among the top keys with an estimate of at least `min_requests` (scaled up from the sample)
+  bool is_hot( const std::string_view key, const uint64_t min_requests ) const;
+
+  uint32_t sample_period() const { return sample_period_; }
+  uint64_t sampled() const { return sampled_; }
+
+  //! Writes the top keys as a gauge of estimated requests, labelled with the key
+  void write_metrics( PrometheusText& out, const std::string_view name ) const;
+
+  //! Estimated requests for a count (scaled up from the sample)
+  uint64_t requests( const uint32_t count ) const { return uint64_t( count ) * sample_period_; }
+};
@@ -0,0 +1,52 @@
+#include "mpsc_queue.hh"
+
+using namespace std;
+
+MPSCQueue::MPSCQueue()
+  : head_( &stub_ )
+  , tail_( &stub_ )
+{}
+
+void MPSCQueue::push( Node* node )
+{
+  node->next.store( nullptr, memory_order_relaxed );
+  Node* const previous = head_.exchange( node, memory_order_acq_rel );
+  // until this store, the consumer can't get from `previous` to `node`
+  previous->next.store( node, memory_order_release );
+}
+
+MPSCQueue::Node* MPSCQueue::pop()
+{
+  Node* tail = tail_;
+  Node* next = tail->next.load( memory_order_acquire );
+
+  // skip over the stub
+  if ( tail == &stub_ ) {
+    if ( not next ) {
+      return nullptr;
+    }
+    tail_ = next;
+    tail = next;
+    next = next->next.load( memory_order_acquire );
+  }
+
+  if ( next ) {
+    tail_ = next;
+    return tail;
+  }
+
+  // `tail` looks like the last node; if it isn't, a push is in progress
+  if ( tail != head_.load( memory_order_acquire ) ) {
+    return nullptr;
+  }
+
+  // put the stub back behind `tail` so that `tail` can be handed out
+  push( &stub_ );
+  next = tail->next.load( memory_order_acquire );
+  if ( next ) {
+    tail_ = next;
+    return tail;
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//! \brief An intrusive queue that any number of threads push to and one thread pops from.
+//! \details This is Dmitry Vyukov's non-intrusive-stub MPSC design: push() is one atomic exchange plus a
+//! store, and never waits; pop() takes no locks, but may return nullptr while a push() is halfway done (the
+//! element then becomes visible once that push() finishes). Callers that sleep when the queue looks empty
+//! need a separate wakeup that producers trigger after pushing (see EventLoop::post).
+class MPSCQueue
+{
+public:
+  struct Node
+  {
+    std::atomic<Node*> next { nullptr };
+
+    Node() = default;
+    virtual ~Node() = default;
+
+    /* Disallow copying */
+    Node( const Node& other ) = delete;
+    Node& operator=( const Node& other ) = delete;
+  };
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+
+  alignas( CACHE_LINE ) std::atomic<Node*> head_; //!< most recently pushed (producers)
+  alignas( CACHE_LINE ) Node* tail_;              //!< next to pop (consumer)
+  Node stub_ {};
+
+public:
+  MPSCQueue();
+
+  /* Disallow copying */
+  MPSCQueue( const MPSCQueue& other ) = delete;
+  MPSCQueue& operator=( const MPSCQueue& other ) = delete;
+
+  //! Producer side (any thread): the queue does not own `node` while it is queued
+  void push( Node* node );
+
+  //! Consumer side (one thread at a time)
+  //! \returns the oldest node, or nullptr if the queue is empty (or a push is in progress)
+  Node* pop();
+};
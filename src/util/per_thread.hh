@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//! A counter that only one thread changes, and that any thread may read
+//! \details Updates are a plain load and store (no locked instruction), so they cost the same as on a
+//! non-atomic integer. Decrements wrap around, so counters that go up on one thread and down on another
+//! still add up to the right total. A copy is a snapshot of the value.
+class RelaxedCounter
+{
+  std::atomic<uint64_t> value_ { 0 };
+
+public:
+  RelaxedCounter() = default;
+  RelaxedCounter( const RelaxedCounter& other )
+    : value_( other.load() )
+  {}
+
+  RelaxedCounter& operator=( const RelaxedCounter& other )
+  {
+    value_.store( other.load(), std::memory_order_relaxed );
+    return *this;
+  }
+
+  void add( const uint64_t n )
+  {
+    value_.store( value_.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed );
+  }
+
+  //! Raises the value to `n`, if it is less
+  void raise_to( const uint64_t n )
+  {
+    if ( n > load() ) {
+      value_.store( n, std::memory_order_relaxed );
+    }
+  }
+
+  void sub( const uint64_t n ) { add( -n ); }
+  RelaxedCounter& operator++()
+  {
+    add( 1 );
+    return *this;
+  }
+
+  uint64_t load() const { return value_.load( std::memory_order_relaxed ); }
+};
+
+//! \brief One instance of T for each thread that asks for it, each on its own cache lines.
+//! \details A thread updates its own instance (from local()) without contending with anyone; readers visit
+//! every instance with for_each() and add them up. Instances outlive their threads, so nothing that was
+//! counted is lost. There is one set of instances per type T.
+template<class T>
+class PerThread
+{
+  struct alignas( 64 ) Slot
+  {
+    T value {};
+  };
+
+  static inline std::mutex mutex_ {};
+  static inline std::vector<std::unique_ptr<Slot>> slots_ {}; //!< guarded by mutex_
+
+  static T* add_slot()
+  {
+    std::lock_guard<std::mutex> lock { mutex_ };
+    slots_.push_back( std::make_unique<Slot>() );
+    return &slots_.back()->value;
+  }
+
+public:
+  //! The calling thread's instance
+  static T& local()
+  {
+    thread_local T* const value = add_slot();
+    return *value;
+  }
+
+  //! Calls `f` with each thread's instance
+  template<class F>
+  static void for_each( F&& f )
+  {
+    std::lock_guard<std::mutex> lock { mutex_ };
+    for ( const auto& slot : slots_ ) {
+      f( static_cast<const T&>( slot->value ) );
+    }
+  }
+};
@@ -0,0 +1,83 @@
+#include "perf_counters.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static perf_event_attr event_attributes( const PerfCounters::Event event )
+{
+  perf_event_attr attr {};
+  attr.size = sizeof( attr );
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  switch ( event ) {
+    case PerfCounters::Event::Cycles:
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PerfCounters::Event::Instructions:
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PerfCounters::Event::CacheMisses:
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case PerfCounters::Event::BranchMisses:
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PerfCounters::Event::count:
+      break;
+  }
+
+  return attr;
+}
+
+PerfCounters::PerfCounters()
+{
+  positions_.fill( -1 );
+
+  for ( size_t i = 0; i < num_events; i++ ) {
+    perf_event_attr attr = event_attributes( static_cast<Event>( i ) );
+    const int fd = syscall( SYS_perf_event_open, &attr, 0, -1, leader_fd_, PERF_FLAG_FD_CLOEXEC );
+    if ( fd < 0 ) {
+      unavailable_reason_ += string( unavailable_reason_.empty() ? "" : ", " ) + event_names.at( i ) + ": "
+                             + strerror( errno );
+      continue;
+    }
+
+    fds_.at( i ).emplace( fd );
+    positions_.at( i ) = opened_++;
+    if ( leader_fd_ < 0 ) {
+      leader_fd_ = fd;
+    }
+  }
+}
+
+bool PerfCounters::read( Reading& reading ) const
+{
+  if ( not available() ) {
+    return false;
+  }
+
+  // PERF_FORMAT_GROUP layout: nr, time_enabled, time_running, then one value per counter
+  array<uint64_t, 3 + num_events> buffer;
+
+  // a plain read(2), not FileDescriptor::read, which would count these bytes as I/O
+  const ssize_t bytes_read = ::read( leader_fd_, buffer.data(), sizeof( buffer ) );
+  if ( bytes_read < ssize_t( ( 3 + opened_ ) * sizeof( uint64_t ) ) or buffer[0] != opened_ ) {
+    return false;
+  }
+
+  reading.time_enabled = buffer[1];
+  reading.time_running = buffer[2];
+  for ( size_t i = 0; i < num_events; i++ ) {
+    reading.values[i] = positions_[i] < 0 ? 0 : buffer[3 + positions_[i]];
+  }
+
+  return true;
+}
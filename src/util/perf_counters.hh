@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "file_descriptor.hh"
+
+//! \brief Hardware performance counters (cycles, instructions, last-level cache misses and branch mispredictions)
+//! for the calling thread, counted in user space only.
+//! \details The counters that the kernel will open form one perf_event group, so they count over exactly the
+//! same instructions and one read() returns them all. Counters that can't be opened (no PMU, as in most VMs
+//! and containers, or perf_event_paranoid too high) are simply left out; if none can, available() is false.
+class PerfCounters
+{
+public:
+  enum class Event
+  {
+    Cycles,
+    Instructions,
+    CacheMisses,
+    BranchMisses,
+    count
+  };
+
+  constexpr static size_t num_events = static_cast<size_t>( Event::count );
+
+  constexpr static std::array<const char*, num_events> event_names {
+    { "cycles", "instructions", "llc_misses", "branch_misses" }
+  };
+
+  struct Reading
+  {
+    std::array<uint64_t, num_events> values; //!< 0 for counters that aren't open
+    uint64_t time_enabled;
+    uint64_t time_running; //!< less than time_enabled if the group had to share the PMU
+  };
+
+private:
+  std::array<std::optional<FileDescriptor>, num_events> fds_ {};
+  int leader_fd_ { -1 };                     //!< the first counter that opened, which leads the group
+  std::array<int, num_events> positions_ {}; //!< of each event in a read of the group
+  size_t opened_ { 0 };
+  std::string unavailable_reason_ {};
+
+public:
+  //! Opens the counters for the calling thread (which is the only one they count)
+  PerfCounters();
+
+  bool available() const { return opened_ > 0; }
+  bool has( const Event event ) const { return fds_[static_cast<size_t>( event )].has_value(); }
+
+  //! Why counters are missing (empty if all of them opened)
+  const std::string& unavailable_reason() const { return unavailable_reason_; }
+
+  //! Reads every open counter at once
+  //! \returns false if the counters are unavailable or the read failed
+  bool read( Reading& reading ) const;
+};
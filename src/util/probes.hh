@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+
+//! \file
+//! \brief USDT (user-level statically defined tracing) probes, in the format of SystemTap's <sys/sdt.h>.
+//! \details Each probe site is a single nop, described by an ELF note (in .note.stapsdt) that tools such as
+//! bpftrace, bcc, perf and SystemTap read to find the site and its arguments; attaching replaces the nop with
+//! a breakpoint. Nothing happens at run time unless something is attached, and there is no library to link.
+//!
+//! Every probe has a semaphore, which attached tracers increment, so that arguments that cost something to
+//! compute need only be computed when USDT_ENABLED() says someone is listening. Declare it once per file,
+//! at namespace scope, with USDT_SEMAPHORE( provider, name ). Arguments are passed as uint64_t.
+//!
+//!     USDT_SEMAPHORE( mycached, accept );
+//!     ...
+//!     USDT_PROBE1( mycached, accept, client_id );
+//!
+//!     bpftrace -e 'usdt:./mycached:mycached:accept { printf( "%d\n", arg0 ); }'
+//!
+//! On targets other than x86-64 ELF, probes compile to nothing.
+
+#define USDT_SEMAPHORE_NAME( provider, name ) provider##_##name##_semaphore
+
+#define USDT_SEMAPHORE( provider, name )                                                                       \
+  __attribute__( ( section( ".probes" ), used ) ) static volatile unsigned short                               \
+    USDT_SEMAPHORE_NAME( provider, name ) = 0
+
+#define USDT_ENABLED( provider, name ) ( __builtin_expect( USDT_SEMAPHORE_NAME( provider, name ) != 0, 0 ) )
+
+#if defined( __x86_64__ ) && defined( __ELF__ )
+
+// the note: name "stapsdt", type 3, then the probe's address, the base (so tools can tell how far the binary
+// was relocated), the semaphore's address, and the provider, name and argument descriptions ("8@%rax" is an
+// 8-byte unsigned value in %rax); .stapsdt.base is one byte, shared by every probe in the binary
+#define USDT_ASM( provider, name, args )                                                                       \
+  __asm__ __volatile__( "990: nop\n"                                                                           \
+                        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                          \
+                        ".balign 4\n"                                                                          \
+                        ".4byte 992f-991f, 994f-993f, 3\n"                                                     \
+                        "991: .asciz \"stapsdt\"\n"                                                            \
+                        "992: .balign 4\n"                                                                     \
+                        "993: .8byte 990b\n"                                                                   \
+                        ".8byte _.stapsdt.base\n"                                                              \
+                        ".8byte %c[semaphore]\n"                                                               \
+                        ".asciz \"" #provider "\"\n"                                                           \
+                        ".asciz \"" #name "\"\n"                                                               \
+                        ".asciz \"" args "\"\n"                                                                \
+                        "994: .balign 4\n"                                                                     \
+                        ".popsection\n"                                                                        \
+                        ".ifndef _.stapsdt.base\n"                                                             \
+                        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"                \
+                        ".weak _.stapsdt.base\n"                                                               \
+                        ".hidden _.stapsdt.base\n"                                                             \
+                        "_.stapsdt.base: .space 1\n"                                                           \
+                        ".size _.stapsdt.base, 1\n"                                                            \
+                        ".popsection\n"                                                                        \
+                        ".endif\n"
+
+#define USDT_SEMAPHORE_OPERAND( provider, name ) [semaphore] "i"( &USDT_SEMAPHORE_NAME( provider, name ) )
+#define USDT_ARG( n, value ) [a##n] "nor"( static_cast<uint64_t>( value ) )
+
+#define USDT_PROBE0( provider, name )                                                                          \
+  USDT_ASM( provider, name, "" ) : : USDT_SEMAPHORE_OPERAND( provider, name ) )
+
+#define USDT_PROBE1( provider, name, a0 )                                                                      \
+  USDT_ASM( provider, name, "8@%[a0]" ) : : USDT_SEMAPHORE_OPERAND( provider, name ), USDT_ARG( 0, a0 ) )
+
+#define USDT_PROBE2( provider, name, a0, a1 )                                                                  \
+  USDT_ASM( provider, name, "8@%[a0] 8@%[a1]" )                                                                \
+  : : USDT_SEMAPHORE_OPERAND( provider, name ), USDT_ARG( 0, a0 ), USDT_ARG( 1, a1 ) )
+
+#define USDT_PROBE3( provider, name, a0, a1, a2 )                                                              \
+  USDT_ASM( provider, name, "8@%[a0] 8@%[a1] 8@%[a2]" )                                                        \
+  : : USDT_SEMAPHORE_OPERAND( provider, name ), USDT_ARG( 0, a0 ), USDT_ARG( 1, a1 ), USDT_ARG( 2, a2 ) )
+
+#else
+
+#define USDT_PROBE0( provider, name ) ( (void)USDT_SEMAPHORE_NAME( provider, name ) )
+#define USDT_PROBE1( provider, name, a0 ) ( (void)USDT_SEMAPHORE_NAME( provider, name ), (void)( a0 ) )
+#define USDT_PROBE2( provider, name, a0, a1 )                                                                  \
+  ( (void)USDT_SEMAPHORE_NAME( provider, name ), (void)( a0 ), (void)( a1 ) )
+#define USDT_PROBE3( provider, name, a0, a1, a2 )                                                              \
+  ( (void)USDT_SEMAPHORE_NAME( provider, name ), (void)( a0 ), (void)( a1 ), (void)( a2 ) )
+
+#endif
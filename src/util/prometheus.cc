@@ -0,0 +1,116 @@
+#include "prometheus.hh"
+
+#include <iomanip>
+
+using namespace std;
+
+PrometheusText::PrometheusText()
+{
+  out_ << setprecision( 12 );
+}
+
+string PrometheusText::label( const string_view name, const string_view value )
+{
+  string ret { name };
+  ret += "=\"";
+
+  for ( const char c : value ) {
+    switch ( c ) {
+      case '\\':
+        ret += "\\\\";
+        break;
+      case '"':
+        ret += "\\\"";
+        break;
+      case '\n':
+        ret += "\\n";
+        break;
+      default:
+        ret += c;
+    }
+  }
+
+  ret += "\"";
+  return ret;
+}
+
+void PrometheusText::family( const string_view name, const string_view type, const string_view help )
+{
+  out_ << "# HELP " << name << " " << help << "\n";
+  out_ << "# TYPE " << name << " " << type << "\n";
+}
+
+void PrometheusText::sample_name( const string_view name, const string_view labels )
+{
+  out_ << name;
+  if ( not labels.empty() ) {
+    out_ << "{" << labels << "}";
+  }
+  out_ << " ";
+}
+
+void PrometheusText::sample( const string_view name, const string_view labels, const uint64_t value )
+{
+  sample_name( name, labels );
+  out_ << value << "\n";
+}
+
+void PrometheusText::sample( const string_view name, const string_view labels, const double value )
+{
+  sample_name( name, labels );
+  out_ << value << "\n";
+}
+
+static string with_le( const string_view labels, const string& le )
+{
+  string ret { labels };
+  if ( not ret.empty() ) {
+    ret += ",";
+  }
+  return ret + PrometheusText::label( "le", le );
+}
+
+void PrometheusText::histogram( const string_view name,
+                                const string_view labels,
+                                const Timer::Histogram& histogram,
+                                const uint64_t sum,
+                                const unsigned int max_exponent )
+{
+  const string bucket_name = string( name ) + "_bucket";
+
+  for ( unsigned int exponent = 0; exponent <= max_exponent; exponent++ ) {
+    const uint64_t bound = uint64_t( 1 ) << exponent;
+    sample( bucket_name, with_le( labels, to_string( bound ) ), histogram.count_at_most( bound ) );
+  }
+
+  const uint64_t count = histogram.count();
+  sample( bucket_name, with_le( labels, "+Inf" ), count );
+  sample( string( name ) + "_sum", labels, sum );
+  sample( string( name ) + "_count", labels, count );
+}
+
+void PrometheusText::duration_histogram( const string_view name,
+                                         const string_view labels,
+                                         const Timer::Record& record )
+{
+  const string bucket_name = string( name ) + "_bucket";
+
+  for ( uint64_t decade = 100; decade <= 10'000'000'000; decade *= 10 ) {
+    for ( const uint64_t bound_ns : { decade, decade * 5 / 2, decade * 5 } ) {
+      if ( bound_ns > 10'000'000'000 ) {
+        break;
+      }
+
+      ostringstream le;
+      le << setprecision( 12 ) << bound_ns / 1e9;
+      sample(
+        bucket_name, with_le( labels, le.str() ), record.histogram.count_at_most( Timer::ns_to_ticks( bound_ns ) ) );
+    }
+  }
+
+  // counted after the buckets, so that it is at least as large as they are even while another thread logs
+  const uint64_t count = record.histogram.count();
+  sample( bucket_name, with_le( labels, "+Inf" ), count );
+  sample( string( name ) + "_sum", labels, Timer::ticks_to_ns( record.total_ticks.load() ) / 1e9 );
+  sample( string( name ) + "_count", labels, count );
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "timer.hh"
+
+//! \brief Builds a page of metrics in the Prometheus text exposition format (version 0.0.4).
+//! \details Each family() line must be followed by that family's samples, before the next family. The count
+//! for a histogram's `le` boundary includes the whole Timer::Histogram bucket holding the boundary, so it may
+//! take in values up to 1/16 above it.
+class PrometheusText
+{
+  std::ostringstream out_ {};
+
+  void sample_name( const std::string_view name, const std::string_view labels );
+
+public:
+  PrometheusText();
+
+  static constexpr const char* CONTENT_TYPE = "text/plain; version=0.0.4";
+
+  //! `name="value"`, with the value escaped, for use as (part of) a sample's labels
+  static std::string label( const std::string_view name, const std::string_view value );
+
+  //! Writes the HELP and TYPE lines for a family (`type` is "counter", "gauge" or "histogram")
+  void family( const std::string_view name, const std::string_view type, const std::string_view help );
+
+  void sample( const std::string_view name, const std::string_view labels, const uint64_t value );
+  void sample( const std::string_view name, const std::string_view labels, const double value );
+
+  //! Writes a histogram sample with `le` boundaries at powers of two up to 2^max_exponent
+  void histogram( const std::string_view name,
+                  const std::string_view labels,
+                  const Timer::Histogram& histogram,
+                  const uint64_t sum,
+                  const unsigned int max_exponent );
+
+  //! Writes a histogram sample of durations in seconds, with `le` boundaries at 1, 2.5 and 5 times each
+  //! power of ten from 100 ns to 10 s
+  void duration_histogram( const std::string_view name, const std::string_view labels, const Timer::Record& record );
+
+  std::string str() const { return out_.str(); }
+};
@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include "exception.hh"
+#include "prometheus.hh"
 #include "ring_buffer.hh"
 
 using namespace std;
@@ -32,7 +35,7 @@ MMap_Region::~MMap_Region()
   }
 }
 
-RingBuffer::RingBuffer( const size_t capacity )
+MirroredMapping::MirroredMapping( const size_t capacity )
   : fd_( [&] {
     if ( capacity % sysconf( _SC_PAGESIZE ) ) {
       throw runtime_error( "RingBuffer capacity must be multiple of page size (" + to_string( sysconf( _SC_PAGESIZE ) )
@@ -55,14 +58,18 @@ RingBuffer::RingBuffer( const size_t capacity )
                      fd_.fd_num() )
 {}
 
+RingBuffer::RingBuffer( const size_t capacity )
+  : storage_( capacity )
+{}
+
 std::string_view RingBuffer::writable_region() const
 {
-  return { virtual_address_space_.addr() + next_index_to_write_, capacity() - bytes_stored_ };
+  return { storage_.addr() + next_index_to_write_, capacity() - bytes_stored_ };
 }
 
 simple_string_span RingBuffer::writable_region()
 {
-  return { virtual_address_space_.addr() + next_index_to_write_, capacity() - bytes_stored_ };
+  return { storage_.addr() + next_index_to_write_, capacity() - bytes_stored_ };
 }
 
 void RingBuffer::push( const size_t num_bytes )
@@ -79,7 +86,7 @@ std::string_view RingBuffer::readable_region() const
 {
   const size_t next_index_to_read = ( next_index_to_write_ + capacity() - bytes_stored_ ) % capacity();
 
-  return { virtual_address_space_.addr() + next_index_to_read, bytes_stored_ };
+  return { storage_.addr() + next_index_to_read, bytes_stored_ };
 }
 
 void RingBuffer::pop( const size_t num_bytes )
@@ -102,3 +109,254 @@ void RingBuffer::read_from( string_view& str )
 {
   str.remove_prefix( write( str ) );
 }
+
+void RingBuffer::reset()
+{
+  next_index_to_write_ = 0;
+  bytes_stored_ = 0;
+}
+
+RingBufferPool::RingBufferPool( const vector<size_t>& capacities, const size_t max_idle_bytes_per_class )
+  : max_idle_bytes_per_class_( max_idle_bytes_per_class )
+{
+  for ( const size_t capacity : capacities ) {
+    if ( capacity % sysconf( _SC_PAGESIZE ) ) {
+      throw runtime_error( "RingBufferPool: capacity class must be multiple of page size" );
+    }
+
+    classes_.push_back( { capacity } );
+  }
+
+  if ( classes_.empty() ) {
+    throw runtime_error( "RingBufferPool: no capacity classes" );
+  }
+
+  sort( classes_.begin(), classes_.end(), []( const auto& a, const auto& b ) { return a.capacity < b.capacity; } );
+}
+
+unique_ptr<RingBuffer> RingBufferPool::acquire( const size_t min_capacity )
+{
+  for ( auto& capacity_class : classes_ ) {
+    if ( capacity_class.capacity < min_capacity ) {
+      continue;
+    }
+
+    if ( capacity_class.idle.empty() ) {
+      capacity_class.stats.misses++;
+      return make_unique<RingBuffer>( capacity_class.capacity );
+    }
+
+    capacity_class.stats.hits++;
+    unique_ptr<RingBuffer> ret = move( capacity_class.idle.back() );
+    capacity_class.idle.pop_back();
+    return ret;
+  }
+
+  throw runtime_error( "RingBufferPool: " + to_string( min_capacity ) + " bytes exceeds the largest capacity class" );
+}
+
+void RingBufferPool::release( unique_ptr<RingBuffer>&& buffer )
+{
+  if ( not buffer ) {
+    return;
+  }
+
+  for ( auto& capacity_class : classes_ ) {
+    if ( capacity_class.capacity != buffer->capacity() ) {
+      continue;
+    }
+
+    if ( ( capacity_class.idle.size() + 1 ) * capacity_class.capacity <= max_idle_bytes_per_class_ ) {
+      capacity_class.stats.releases++;
+      buffer->reset();
+      capacity_class.idle.push_back( move( buffer ) );
+    } else {
+      capacity_class.stats.discards++;
+      buffer.reset();
+    }
+
+    return;
+  }
+
+  throw runtime_error( "RingBufferPool: released buffer does not belong to any capacity class" );
+}
+
+RingBufferPool::Statistics RingBufferPool::statistics() const
+{
+  Statistics ret {};
+
+  for ( const auto& capacity_class : classes_ ) {
+    ret.hits += capacity_class.stats.hits;
+    ret.misses += capacity_class.stats.misses;
+    ret.releases += capacity_class.stats.releases;
+    ret.discards += capacity_class.stats.discards;
+  }
+
+  return ret;
+}
+
+size_t RingBufferPool::idle_bytes() const
+{
+  size_t ret = 0;
+
+  for ( const auto& capacity_class : classes_ ) {
+    ret += capacity_class.capacity * capacity_class.idle.size();
+  }
+
+  return ret;
+}
+
+string RingBufferPool::summary() const
+{
+  ostringstream out;
+
+  out << "RingBufferPool summary\n----------------------\n\n";
+
+  for ( const auto& capacity_class : classes_ ) {
+    const string name = to_string( capacity_class.capacity / 1024 ) + " KiB";
+
+    out << "   " << name << ": ";
+    out << string( 32 - name.size(), ' ' );
+    out << "[hits=" << capacity_class.stats.hits << "]";
+    out << " [misses=" << capacity_class.stats.misses << "]";
+    out << " [releases=" << capacity_class.stats.releases << "]";
+    out << " [discards=" << capacity_class.stats.discards << "]";
+    out << " [idle=" << capacity_class.idle.size() << "]";
+    out << "\n";
+  }
+
+  return out.str();
+}
+
+static vector<size_t> capacity_classes( const AdaptiveRingBufferPolicy& policy )
+{
+  vector<size_t> ret;
+  for ( size_t capacity = policy.initial_capacity; capacity <= policy.max_capacity; capacity *= 2 ) {
+    ret.push_back( capacity );
+  }
+  return ret;
+}
+
+AdaptiveRingBufferContext::AdaptiveRingBufferContext( const AdaptiveRingBufferPolicy& policy )
+  : policy_( policy )
+  , pool_( capacity_classes( policy ), policy.max_idle_bytes )
+{}
+
+string AdaptiveRingBufferContext::summary() const
+{
+  ostringstream out;
+
+  out << "AdaptiveRingBuffer summary\n--------------------------\n\n";
+  out << "   Buffers: " << string( 23, ' ' ) << stats_.buffers << "\n";
+  out << "   Resident: " << string( 22, ' ' ) << stats_.resident_bytes << " bytes";
+  if ( stats_.buffers ) {
+    out << " (" << stats_.resident_bytes / stats_.buffers << " per buffer)";
+  }
+  out << "\n";
+  out << "   Grows: " << string( 25, ' ' ) << stats_.grows << "\n";
+  out << "   Shrinks: " << string( 23, ' ' ) << stats_.shrinks << "\n\n";
+  out << pool_.summary();
+
+  return out.str();
+}
+
+void AdaptiveRingBufferContext::write_metrics( PrometheusText& out ) const
+{
+  out.family( "session_buffers", "gauge", "AdaptiveRingBuffers in existence" );
+  out.sample( "session_buffers", "", stats_.buffers );
+
+  out.family( "session_buffer_resident_bytes", "gauge", "Capacity of the RingBuffers held by AdaptiveRingBuffers" );
+  out.sample( "session_buffer_resident_bytes", "", stats_.resident_bytes );
+
+  out.family( "session_buffer_resizes_total", "counter", "AdaptiveRingBuffer capacity changes" );
+  out.sample( "session_buffer_resizes_total", PrometheusText::label( "direction", "grow" ), stats_.grows );
+  out.sample( "session_buffer_resizes_total", PrometheusText::label( "direction", "shrink" ), stats_.shrinks );
+
+  const auto pool = pool_.statistics();
+  out.family( "session_buffer_pool_operations_total", "counter", "RingBufferPool acquires and releases, by outcome" );
+  out.sample( "session_buffer_pool_operations_total", PrometheusText::label( "outcome", "hit" ), pool.hits );
+  out.sample( "session_buffer_pool_operations_total", PrometheusText::label( "outcome", "miss" ), pool.misses );
+  out.sample( "session_buffer_pool_operations_total", PrometheusText::label( "outcome", "release" ), pool.releases );
+  out.sample( "session_buffer_pool_operations_total", PrometheusText::label( "outcome", "discard" ), pool.discards );
+
+  out.family( "session_buffer_pool_idle_bytes", "gauge", "Capacity of the idle RingBuffers kept by the pool" );
+  out.sample( "session_buffer_pool_idle_bytes", "", uint64_t( pool_.idle_bytes() ) );
+}
+
+AdaptiveRingBufferContext& session_buffer_context()
+{
+  thread_local AdaptiveRingBufferContext context { AdaptiveRingBufferPolicy {} };
+  return context;
+}
+
+AdaptiveRingBuffer::AdaptiveRingBuffer( AdaptiveRingBufferContext& context )
+  : context_( &context )
+  , capacity_( context.policy_.initial_capacity )
+{
+  context_->stats_.buffers++;
+}
+
+AdaptiveRingBuffer::~AdaptiveRingBuffer()
+{
+  if ( buffer_ ) {
+    context_->stats_.resident_bytes -= buffer_->capacity();
+    context_->pool_.release( move( buffer_ ) );
+  }
+
+  context_->stats_.buffers--;
+}
+
+RingBuffer& AdaptiveRingBuffer::get()
+{
+  if ( not buffer_ ) {
+    buffer_ = context_->pool_.acquire( capacity_ );
+    context_->stats_.resident_bytes += buffer_->capacity();
+  }
+
+  return *buffer_;
+}
+
+void AdaptiveRingBuffer::update()
+{
+  if ( not buffer_ ) {
+    return;
+  }
+
+  const size_t stored = buffer_->readable_region().size();
+  peak_ = max<size_t>( peak_, stored );
+
+  if ( stored == 0 ) {
+    // drained: decide how big the next buffer should be, and give this one back
+    if ( peak_ * 4 <= capacity_ ) {
+      low_peak_drains_++;
+    } else {
+      low_peak_drains_ = 0;
+    }
+
+    if ( low_peak_drains_ >= context_->policy_.shrink_after and capacity_ > context_->policy_.initial_capacity ) {
+      capacity_ /= 2;
+      low_peak_drains_ = 0;
+      context_->stats_.shrinks++;
+    }
+
+    peak_ = 0;
+    context_->stats_.resident_bytes -= buffer_->capacity();
+    context_->pool_.release( move( buffer_ ) );
+    return;
+  }
+
+  if ( stored == buffer_->capacity() and capacity_ < context_->policy_.max_capacity ) {
+    // full: the producer is outpacing the consumer, so move to a buffer twice the size
+    capacity_ *= 2;
+    low_peak_drains_ = 0;
+    context_->stats_.grows++;
+
+    unique_ptr<RingBuffer> larger = context_->pool_.acquire( capacity_ );
+    larger->write( buffer_->readable_region() );
+
+    context_->stats_.resident_bytes += larger->capacity();
+    context_->stats_.resident_bytes -= buffer_->capacity();
+    context_->pool_.release( move( buffer_ ) );
+    buffer_ = move( larger );
+  }
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "file_descriptor.hh"
@@ -28,18 +31,32 @@ public:
   size_t length() const { return length_; }
 };
 
+//! \brief `capacity` bytes of memory mapped twice, back to back.
+//! \details Any range of up to `capacity` bytes starting inside the first mapping is contiguous in memory, even
+//! when it wraps around the end of the buffer.
+class MirroredMapping
+{
+  FileDescriptor fd_;
+  MMap_Region virtual_address_space_, first_mapping_, second_mapping_;
+
+public:
+  explicit MirroredMapping( const size_t capacity );
+
+  char* addr() const { return virtual_address_space_.addr(); }
+  size_t capacity() const { return first_mapping_.length(); }
+};
+
 class RingBuffer
 {
   size_t next_index_to_write_ = 0;
   size_t bytes_stored_ = 0;
 
-  FileDescriptor fd_;
-  MMap_Region virtual_address_space_, first_mapping_, second_mapping_;
+  MirroredMapping storage_;
 
 public:
   explicit RingBuffer( const size_t capacity );
 
-  size_t capacity() const { return first_mapping_.length(); }
+  size_t capacity() const { return storage_.capacity(); }
 
   simple_string_span writable_region();
   std::string_view writable_region() const;
@@ -53,4 +70,134 @@ public:
 
   size_t write( const std::string_view str );
   void read_from( std::string_view& str );
+
+  //! Discard the stored bytes
+  void reset();
+};
+
+class PrometheusText;
+
+//! Keeps idle RingBuffers (and their mappings) so they can be handed out again without any system calls
+class RingBufferPool
+{
+public:
+  struct Statistics
+  {
+    uint64_t hits;     //!< acquire() calls served by an idle buffer
+    uint64_t misses;   //!< acquire() calls that had to map a new buffer
+    uint64_t releases; //!< buffers taken back and kept for reuse
+    uint64_t discards; //!< buffers taken back and unmapped because the class was at its idle budget
+  };
+
+private:
+  struct CapacityClass
+  {
+    size_t capacity;
+    std::vector<std::unique_ptr<RingBuffer>> idle {};
+    Statistics stats {};
+  };
+
+  size_t max_idle_bytes_per_class_;
+  std::vector<CapacityClass> classes_ {};
+
+public:
+  //! \param[in] capacities are the capacity classes; each must be a multiple of the page size
+  //! \param[in] max_idle_bytes_per_class bounds the capacity held in idle buffers of each class
+  RingBufferPool( const std::vector<size_t>& capacities, const size_t max_idle_bytes_per_class );
+
+  //! Returns an empty RingBuffer from the smallest class that holds at least `min_capacity` bytes
+  std::unique_ptr<RingBuffer> acquire( const size_t min_capacity );
+
+  //! Takes back a RingBuffer; anything still stored in it is discarded
+  void release( std::unique_ptr<RingBuffer>&& buffer );
+
+  size_t largest_capacity() const { return classes_.back().capacity; }
+
+  //! Sum of the counters of all classes
+  Statistics statistics() const;
+
+  //! Bytes held in idle buffers
+  size_t idle_bytes() const;
+
+  std::string summary() const;
+};
+
+//! How an AdaptiveRingBuffer's capacity follows the traffic through it
+struct AdaptiveRingBufferPolicy
+{
+  size_t initial_capacity { 4096 };  //!< capacity of a new buffer, and the floor for shrinking
+  size_t max_capacity { 1048576 };   //!< ceiling for growing
+  unsigned int shrink_after { 16 };  //!< drains in a row that peaked at a quarter full or less before halving
+  size_t max_idle_bytes { 16777216 }; //!< pool budget for idle buffers, per capacity class
+};
+
+//! The pool, the policy and the counters shared by a thread's AdaptiveRingBuffers
+class AdaptiveRingBufferContext
+{
+public:
+  struct Statistics
+  {
+    uint64_t buffers;        //!< AdaptiveRingBuffers in existence
+    uint64_t resident_bytes; //!< capacity of the RingBuffers they currently hold
+    uint64_t grows;
+    uint64_t shrinks;
+  };
+
+private:
+  friend class AdaptiveRingBuffer;
+
+  AdaptiveRingBufferPolicy policy_;
+  RingBufferPool pool_;
+  Statistics stats_ {};
+
+public:
+  explicit AdaptiveRingBufferContext( const AdaptiveRingBufferPolicy& policy );
+
+  const AdaptiveRingBufferPolicy& policy() const { return policy_; }
+  const RingBufferPool& pool() const { return pool_; }
+  const Statistics& statistics() const { return stats_; }
+
+  std::string summary() const;
+
+  //! Adds the buffer counters and the pool's counters
+  void write_metrics( PrometheusText& out ) const;
+};
+
+//! The per-thread context used by TCPSession and SSLSession
+AdaptiveRingBufferContext& session_buffer_context();
+
+//! \brief A RingBuffer that is held only while it stores data, and whose capacity adapts to the traffic.
+//! \details The underlying RingBuffer is taken from the context's pool when first needed and given back
+//! once it has been drained. A buffer that fills up is replaced by one from the next capacity class (the
+//! stored bytes are copied over, so the readable and writable regions stay contiguous); if it keeps being
+//! drained while mostly empty, the next buffer it takes is half the size.
+class AdaptiveRingBuffer
+{
+  AdaptiveRingBufferContext* context_;
+  std::unique_ptr<RingBuffer> buffer_ {};
+  uint32_t capacity_;             //!< capacity to use for the next buffer
+  uint32_t peak_ { 0 };           //!< most bytes stored since the buffer was last empty
+  uint32_t low_peak_drains_ { 0 }; //!< drains in a row with peak_ at or below a quarter of capacity_
+
+public:
+  explicit AdaptiveRingBuffer( AdaptiveRingBufferContext& context = session_buffer_context() );
+  ~AdaptiveRingBuffer();
+
+  /* Disallow copying */
+  AdaptiveRingBuffer( const AdaptiveRingBuffer& other ) = delete;
+  AdaptiveRingBuffer& operator=( const AdaptiveRingBuffer& other ) = delete;
+
+  //! The underlying RingBuffer, taken from the pool if not already held
+  RingBuffer& get();
+
+  //! \name Queries that don't take a buffer from the pool
+  //!@{
+  bool empty() const { return not buffer_ or buffer_->readable_region().empty(); }
+  bool full() const { return buffer_ and buffer_->writable_region().empty(); }
+  bool has_space() const { return not full(); }
+  size_t resident_bytes() const { return buffer_ ? buffer_->capacity() : 0; }
+  //!@}
+
+  //! To be called after bytes were pushed or popped: grows a full buffer, and gives an empty one back
+  void update();
 };
@@ -224,31 +224,41 @@ int SSLSession::get_error( const int return_value ) const
 
 bool SSLSession::want_read() const
 {
-  return ( not read_waiting_on_write_ ) and ( not inbound_plaintext_.writable_region().empty() )
-         and ( not incoming_stream_terminated_ );
+  return ( not read_waiting_on_write_ ) and inbound_plaintext_.has_space() and ( not incoming_stream_terminated_ );
 }
 
 bool SSLSession::want_write() const
 {
-  return ( not write_waiting_on_read_ ) and ( not outbound_plaintext_.readable_region().empty() );
+  return ( not write_waiting_on_read_ ) and ( not outbound_plaintext_.empty() );
+}
+
+void SSLSession::update_buffers()
+{
+  outbound_plaintext_.update();
+  inbound_plaintext_.update();
 }
 
 void SSLSession::do_read()
 {
   OpenSSL::check( "SSLSession::do_read()" );
 
-  simple_string_span target = inbound_plaintext_.writable_region();
+  simple_string_span target = inbound_plaintext_.get().writable_region();
 
   const auto read_count_before = socket_.read_count();
   const int bytes_read = SSL_read( ssl_.get(), target.mutable_data(), target.size() );
   const auto read_count_after = socket_.read_count();
 
+  if ( bytes_read > 0 ) {
+    inbound_plaintext_.get().push( bytes_read );
+  }
+
+  inbound_plaintext_.update();
+
   if ( read_count_after > read_count_before or bytes_read > 0 ) {
     write_waiting_on_read_ = false;
   }
 
   if ( bytes_read > 0 ) {
-    inbound_plaintext_.push( bytes_read );
     return;
   }
 
@@ -276,18 +286,23 @@ void SSLSession::do_write()
 {
   OpenSSL::check( "SSLSession::do_write()" );
 
-  const string_view source = outbound_plaintext_.readable_region();
+  const string_view source = outbound_plaintext_.get().readable_region();
 
   const auto write_count_before = socket_.write_count();
   const int bytes_written = SSL_write( ssl_.get(), source.data(), source.size() );
   const auto write_count_after = socket_.write_count();
 
+  if ( bytes_written > 0 ) {
+    outbound_plaintext_.get().pop( bytes_written );
+  }
+
+  outbound_plaintext_.update();
+
   if ( write_count_after > write_count_before or bytes_written > 0 ) {
     read_waiting_on_write_ = false;
   }
 
   if ( bytes_written > 0 ) {
-    outbound_plaintext_.pop( bytes_written );
     return;
   }
 
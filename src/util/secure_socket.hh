@@ -134,15 +134,14 @@ public:
 /* SSL session */
 class SSLSession
 {
-  static constexpr size_t storage_size = 65536;
-
   SSL_handle ssl_;
 
   TCPSocketBIO socket_;
   bool incoming_stream_terminated_ = false;
 
-  RingBuffer outbound_plaintext_ { storage_size };
-  RingBuffer inbound_plaintext_ { storage_size };
+  // held only while they store data, and sized by the traffic (see AdaptiveRingBuffer)
+  AdaptiveRingBuffer outbound_plaintext_ {};
+  AdaptiveRingBuffer inbound_plaintext_ {};
 
   int get_error( const int return_value ) const;
 
@@ -152,10 +151,22 @@ class SSLSession
 public:
   SSLSession( SSL_handle&& ssl, TCPSocket&& sock, const std::string& hostname );
 
-  RingBuffer& outbound_plaintext() { return outbound_plaintext_; }
-  RingBuffer& inbound_plaintext() { return inbound_plaintext_; }
+  RingBuffer& outbound_plaintext() { return outbound_plaintext_.get(); }
+  RingBuffer& inbound_plaintext() { return inbound_plaintext_.get(); }
   TCPSocket& socket() { return socket_; }
 
+  //! \name Queries that don't take a buffer from the pool
+  //!@{
+  bool inbound_plaintext_empty() const { return inbound_plaintext_.empty(); }
+  bool outbound_plaintext_full() const { return outbound_plaintext_.full(); }
+  //!@}
+
+  //! To be called after the plaintext buffers were read or written by someone else: resizes or releases them
+  void update_buffers();
+
+  //! Bytes of buffer capacity this session currently holds
+  size_t resident_bytes() const { return outbound_plaintext_.resident_bytes() + inbound_plaintext_.resident_bytes(); }
+
   void do_read();
   void do_write();
 
@@ -0,0 +1,349 @@
+#include <cstring>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exception.hh"
+#include "fnv1a.hh"
+#include "shared_store.hh"
+
+using namespace std;
+using namespace shared_store;
+
+static constexpr size_t HEADER_SPACE = 64; // the slot table starts on its own cache line
+
+static_assert( sizeof( Header ) <= HEADER_SPACE );
+static_assert( sizeof( Slot ) == 64 );
+
+static size_t round_up_to_power_of_two( const size_t n )
+{
+  size_t ret = 1;
+  while ( ret < n ) {
+    ret <<= 1;
+  }
+  return ret;
+}
+
+static size_t segment_length( const size_t slot_count, const size_t arena_size )
+{
+  return HEADER_SPACE + slot_count * sizeof( Slot ) + arena_size;
+}
+
+static void begin_write( Slot& slot )
+{
+  slot.sequence.store( slot.sequence.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+  atomic_thread_fence( memory_order_release );
+}
+
+static void end_write( Slot& slot )
+{
+  slot.sequence.store( slot.sequence.load( memory_order_relaxed ) + 1, memory_order_release );
+}
+
+void SharedStoreWriter::mark_incomplete()
+{
+  incomplete_ = true;
+  header_.incomplete.store( 1, memory_order_release );
+}
+
+void SharedStoreWriter::delete_slot( Slot& slot )
+{
+  begin_write( slot );
+  slot.state.store( DELETED, memory_order_relaxed );
+  end_write( slot );
+
+  live_bytes_ -= slot.allocation.load( memory_order_relaxed );
+  tombstones_++;
+}
+
+SharedStoreWriter::SharedStoreWriter( const size_t slot_count, const size_t arena_size )
+  : fd_( [&] {
+    FileDescriptor fd { CheckSystemCall( "memfd_create",
+                                         memfd_create( "SharedStore", MFD_ALLOW_SEALING | MFD_CLOEXEC ) ) };
+    CheckSystemCall( "ftruncate",
+                     ftruncate( fd.fd_num(), segment_length( round_up_to_power_of_two( slot_count ), arena_size ) ) );
+
+    // readers may rely on the size never changing under their mapping
+    CheckSystemCall( "fcntl", fcntl( fd.fd_num(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL ) );
+    return fd;
+  }() )
+  , region_( nullptr,
+             segment_length( round_up_to_power_of_two( slot_count ), arena_size ),
+             PROT_READ | PROT_WRITE,
+             MAP_SHARED,
+             fd_.fd_num() )
+  , header_( *reinterpret_cast<Header*>( region_.addr() ) )
+  , slots_( reinterpret_cast<Slot*>( region_.addr() + HEADER_SPACE ) )
+  , arena_( region_.addr() + HEADER_SPACE + round_up_to_power_of_two( slot_count ) * sizeof( Slot ) )
+{
+  header_.slot_count = round_up_to_power_of_two( slot_count );
+  header_.arena_size = arena_size;
+  atomic_thread_fence( memory_order_release );
+  header_.magic = MAGIC;
+}
+
+Slot* SharedStoreWriter::find( const string_view key, const uint64_t hash, const bool for_insert )
+{
+  const uint64_t mask = header_.slot_count - 1;
+  Slot* first_free = nullptr;
+
+  for ( uint64_t i = 0; i < header_.slot_count; i++ ) {
+    Slot& slot = slots_[( hash + i ) & mask];
+
+    switch ( slot.state.load( memory_order_relaxed ) ) {
+      case EMPTY:
+        return for_insert ? ( first_free ? first_free : &slot ) : nullptr;
+
+      case DELETED:
+        if ( not first_free ) {
+          first_free = &slot;
+        }
+        break;
+
+      case LIVE:
+        if ( slot.hash.load( memory_order_relaxed ) == hash
+             and slot.key_length.load( memory_order_relaxed ) == key.size()
+             and memcmp( arena_ + slot.offset.load( memory_order_relaxed ), key.data(), key.size() ) == 0 ) {
+          return &slot;
+        }
+        break;
+    }
+  }
+
+  return for_insert ? first_free : nullptr;
+}
+
+bool SharedStoreWriter::put( const string_view key, const string_view value )
+{
+  changes_since_rebuild_++;
+  const uint64_t key_hash = fnv1a( key );
+  Slot* const slot = find( key, key_hash, true );
+
+  if ( not slot ) {
+    mark_incomplete();
+    return false;
+  }
+
+  const uint32_t state = slot->state.load( memory_order_relaxed );
+  const uint64_t needed = key.size() + value.size();
+  uint64_t offset = slot->offset.load( memory_order_relaxed );
+  uint64_t allocation = slot->allocation.load( memory_order_relaxed );
+
+  if ( needed > allocation ) {
+    // the slot's old space is given up until the next rebuild
+    const uint64_t rounded = ( needed + 7 ) & ~uint64_t( 7 );
+    if ( rounded > header_.arena_size - arena_used_ ) {
+      if ( state == LIVE ) {
+        delete_slot( *slot );
+      }
+
+      mark_incomplete();
+      return false;
+    }
+
+    offset = arena_used_;
+    allocation = rounded;
+    arena_used_ += rounded;
+  }
+
+  if ( state == LIVE ) {
+    live_bytes_ -= slot->allocation.load( memory_order_relaxed );
+  } else if ( state == DELETED ) {
+    tombstones_--;
+  }
+  live_bytes_ += allocation;
+
+  begin_write( *slot );
+  slot->state.store( LIVE, memory_order_relaxed );
+  slot->hash.store( key_hash, memory_order_relaxed );
+  slot->offset.store( offset, memory_order_relaxed );
+  slot->key_length.store( key.size(), memory_order_relaxed );
+  slot->value_length.store( value.size(), memory_order_relaxed );
+  slot->allocation.store( allocation, memory_order_relaxed );
+  memcpy( arena_ + offset, key.data(), key.size() );
+  memcpy( arena_ + offset + key.size(), value.data(), value.size() );
+  end_write( *slot );
+
+  return true;
+}
+
+void SharedStoreWriter::erase( const string_view key )
+{
+  changes_since_rebuild_++;
+  Slot* const slot = find( key, fnv1a( key ), false );
+
+  if ( slot ) {
+    delete_slot( *slot );
+  }
+}
+
+bool SharedStoreWriter::fits( const uint64_t items, const uint64_t bytes ) const
+{
+  // at most three quarters full, so probes stay short; each allocation is rounded up to 8 bytes
+  return items <= header_.slot_count / 4 * 3 and bytes <= header_.arena_size
+         and items * 7 <= header_.arena_size - bytes;
+}
+
+bool SharedStoreWriter::wants_rebuild( const uint64_t items, const uint64_t bytes ) const
+{
+  // tombstones lengthen every probe, whether or not the store fits
+  if ( tombstones_ > header_.slot_count / 4 ) {
+    return true;
+  }
+
+  // reclaimed space only helps if the whole store then fits: otherwise the index would fill up again with
+  // whichever keys came first, and be rebuilt, incomplete again, over and over
+  return fits( items, bytes )
+         and ( arena_used_ - live_bytes_ > header_.arena_size / 4
+               or ( incomplete_ and changes_since_rebuild_ > header_.slot_count / 8 ) );
+}
+
+void SharedStoreWriter::begin_rebuild()
+{
+  // readers that see an odd generation, or a different one after they looked, fall back to the server
+  header_.generation.store( header_.generation.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+  atomic_thread_fence( memory_order_release );
+
+  // each slot's sequence moves on (by two, so it stays even), so no Version taken before the rebuild matches
+  // whatever the slot holds after it
+  for ( uint64_t i = 0; i < header_.slot_count; i++ ) {
+    Slot& slot = slots_[i];
+    slot.sequence.store( slot.sequence.load( memory_order_relaxed ) + 2, memory_order_relaxed );
+    slot.state.store( EMPTY, memory_order_relaxed );
+    slot.allocation.store( 0, memory_order_relaxed );
+  }
+
+  // give the arena's pages back; put() starts from the bottom again
+  const uint64_t arena_offset = arena_ - region_.addr();
+  if ( arena_used_ ) {
+    CheckSystemCall( "fallocate",
+                     fallocate( fd_.fd_num(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, arena_offset, arena_used_ ) );
+  }
+
+  arena_used_ = 0;
+  live_bytes_ = 0;
+  tombstones_ = 0;
+  incomplete_ = false;
+}
+
+void SharedStoreWriter::end_rebuild()
+{
+  if ( not incomplete_ ) {
+    header_.incomplete.store( 0, memory_order_relaxed );
+  }
+  header_.generation.store( header_.generation.load( memory_order_relaxed ) + 1, memory_order_release );
+
+  changes_since_rebuild_ = 0;
+  rebuilds_++;
+}
+
+static size_t file_size( const FileDescriptor& fd )
+{
+  struct stat info;
+  CheckSystemCall( "fstat", fstat( fd.fd_num(), &info ) );
+  return info.st_size;
+}
+
+SharedStoreReader::SharedStoreReader( const FileDescriptor& fd )
+  : region_( nullptr, file_size( fd ), PROT_READ, MAP_SHARED, fd.fd_num() )
+  , header_( *reinterpret_cast<const Header*>( region_.addr() ) )
+  , slots_( reinterpret_cast<const Slot*>( region_.addr() + HEADER_SPACE ) )
+  , arena_( region_.addr() + HEADER_SPACE + header_.slot_count * sizeof( Slot ) )
+{
+  if ( region_.length() < HEADER_SPACE or header_.magic != MAGIC ) {
+    throw runtime_error( "SharedStoreReader: not a shared store segment" );
+  }
+
+  if ( ( header_.slot_count & ( header_.slot_count - 1 ) ) != 0
+       or segment_length( header_.slot_count, header_.arena_size ) > region_.length() ) {
+    throw runtime_error( "SharedStoreReader: bad segment geometry" );
+  }
+}
+
+SharedStoreReader::Result SharedStoreReader::get( const string_view key,
+                                                  string& value,
+                                                  const unsigned int max_attempts,
+                                                  Version* version ) const
+{
+  const uint64_t generation = header_.generation.load( memory_order_acquire );
+  if ( generation & 1 ) {
+    return Result::Fallback; // the writer is rebuilding the index
+  }
+
+  const Result result = probe( key, value, max_attempts, version );
+
+  atomic_thread_fence( memory_order_acquire );
+  if ( header_.generation.load( memory_order_relaxed ) != generation ) {
+    return Result::Fallback; // a rebuild started while we were probing
+  }
+
+  return result;
+}
+
+SharedStoreReader::Result SharedStoreReader::probe( const string_view key,
+                                                    string& value,
+                                                    const unsigned int max_attempts,
+                                                    Version* version ) const
+{
+  const uint64_t key_hash = fnv1a( key );
+  const uint64_t mask = header_.slot_count - 1;
+
+  const auto miss = [&] {
+    // if the writer ever dropped a key, absence from the index proves nothing
+    return header_.incomplete.load( memory_order_acquire ) ? Result::Fallback : Result::Miss;
+  };
+
+  for ( uint64_t i = 0; i < header_.slot_count; i++ ) {
+    const uint64_t slot_index = ( key_hash + i ) & mask;
+    const Slot& slot = slots_[slot_index];
+
+    for ( unsigned int attempt = 0;; attempt++ ) {
+      if ( attempt == max_attempts ) {
+        return Result::Fallback;
+      }
+
+      const uint32_t sequence_before = slot.sequence.load( memory_order_acquire );
+      if ( sequence_before & 1 ) {
+        continue; // write in progress
+      }
+
+      const uint32_t state = slot.state.load( memory_order_relaxed );
+      const uint64_t offset = slot.offset.load( memory_order_relaxed );
+      const uint64_t key_length = slot.key_length.load( memory_order_relaxed );
+      const uint64_t value_length = slot.value_length.load( memory_order_relaxed );
+
+      // a torn read can produce any offset and length, so check them before touching the arena
+      bool match = false;
+      if ( state == LIVE and slot.hash.load( memory_order_relaxed ) == key_hash and key_length == key.size()
+           and offset <= header_.arena_size and key_length <= header_.arena_size - offset
+           and value_length <= header_.arena_size - offset - key_length ) {
+        match = memcmp( arena_ + offset, key.data(), key_length ) == 0;
+        if ( match ) {
+          value.assign( arena_ + offset + key_length, value_length );
+        }
+      }
+
+      atomic_thread_fence( memory_order_acquire );
+      if ( slot.sequence.load( memory_order_relaxed ) != sequence_before ) {
+        continue; // the writer touched the slot while we were reading it
+      }
+
+      if ( state == EMPTY ) {
+        return miss();
+      }
+
+      if ( match ) {
+        if ( version ) {
+          *version = { slot_index, sequence_before };
+        }
+        return Result::Hit;
+      }
+
+      break; // try the next slot
+    }
+  }
+
+  return miss();
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "file_descriptor.hh"
+#include "ring_buffer.hh"
+
+//! \brief Memory layout of a key-value index published in a shared-memory segment.
+//! \details The segment is a sealed memfd holding a Header, a power-of-two open-addressing table of Slots
+//! (linear probing, deletions leave tombstones) and an arena with the key and value bytes.
+//! Exactly one process writes (SharedStoreWriter); any process that was handed the memfd can read
+//! (SharedStoreReader) without a system call. Each Slot is guarded by a sequence lock: the writer makes
+//! `sequence` odd while it modifies the slot and the bytes it points to, and a reader discards its copy if
+//! `sequence` was odd or changed while it was copying.
+//!
+//! Tombstones and arena space given up by erased or grown values are only reclaimed by rebuilding the whole
+//! index in place, which the Header's `generation` guards like a sequence lock over the entire segment.
+namespace shared_store {
+
+constexpr uint64_t MAGIC = 0x6d79636163686564; // "mycached"
+
+//! Payload sent along with the memfd when a reader connects
+constexpr std::string_view GREETING = "mycached-shared-store";
+
+struct Header
+{
+  uint64_t magic;
+  uint64_t slot_count;
+  uint64_t arena_size;
+  std::atomic<uint64_t> incomplete; //!< nonzero while some key is missing (the table or arena was full)
+  std::atomic<uint64_t> generation; //!< odd while the writer rebuilds the index, bumped by each rebuild
+};
+
+enum SlotState : uint32_t
+{
+  EMPTY = 0,
+  LIVE,
+  DELETED
+};
+
+struct alignas( 64 ) Slot
+{
+  std::atomic<uint32_t> sequence;
+  std::atomic<uint32_t> state;
+  std::atomic<uint64_t> hash;
+  std::atomic<uint64_t> offset; //!< key bytes start here in the arena, followed by the value bytes
+  std::atomic<uint64_t> key_length;
+  std::atomic<uint64_t> value_length;
+  std::atomic<uint64_t> allocation; //!< arena bytes owned by this slot (only used by the writer)
+};
+
+static_assert( std::atomic<uint64_t>::is_always_lock_free, "shared-memory atomics must be lock-free" );
+
+}
+
+class SharedStoreWriter
+{
+  FileDescriptor fd_;
+  MMap_Region region_;
+
+  shared_store::Header& header_;
+  shared_store::Slot* const slots_;
+  char* const arena_;
+  uint64_t arena_used_ { 0 };
+  uint64_t live_bytes_ { 0 };            //!< arena bytes owned by LIVE slots
+  uint64_t tombstones_ { 0 };            //!< DELETED slots
+  uint64_t changes_since_rebuild_ { 0 }; //!< puts and erases
+  bool incomplete_ { false };
+  uint64_t rebuilds_ { 0 };
+
+  shared_store::Slot* find( const std::string_view key, const uint64_t hash, const bool for_insert );
+  void mark_incomplete();
+  void delete_slot( shared_store::Slot& slot );
+
+  void begin_rebuild();
+  void end_rebuild();
+
+  //! Whether `items` keys of `bytes` key and value bytes in all are sure to fit in an empty index
+  bool fits( const uint64_t items, const uint64_t bytes ) const;
+
+public:
+  //! \param[in] slot_count is the number of index slots (rounded up to a power of two)
+  //! \param[in] arena_size is the number of bytes available for keys and values
+  SharedStoreWriter( const size_t slot_count, const size_t arena_size );
+
+  /* Disallow copying */
+  SharedStoreWriter( const SharedStoreWriter& other ) = delete;
+  SharedStoreWriter& operator=( const SharedStoreWriter& other ) = delete;
+
+  //! The memfd to hand out to readers
+  const FileDescriptor& fd() const { return fd_; }
+
+  //! Publish `value` under `key`, replacing any previous value
+  //! \returns false if the table or the arena is full (readers will then fall back to the server)
+  bool put( const std::string_view key, const std::string_view value );
+
+  //! Remove `key` from the published index
+  void erase( const std::string_view key );
+
+  //! Whether rebuild() would pay off: a quarter of the slots are tombstones, or the whole store (`items` keys
+  //! of `bytes` key and value bytes in all) would fit and either a quarter of the arena is space no live value
+  //! uses or some key is missing and enough has changed since the last rebuild
+  bool wants_rebuild( const uint64_t items, const uint64_t bytes ) const;
+
+  //! Republishes `entries`, which must be every key-value pair the server holds, from an empty table and
+  //! arena. Readers get Result::Fallback while it runs. If every entry fits, the index is complete again.
+  template<class Entries>
+  void rebuild( const Entries& entries )
+  {
+    begin_rebuild();
+    for ( const auto& [key, value] : entries ) {
+      put( key, value );
+    }
+    end_rebuild();
+  }
+
+  size_t arena_used() const { return arena_used_; }
+  uint64_t rebuilds() const { return rebuilds_; }
+};
+
+class SharedStoreReader
+{
+  MMap_Region region_;
+
+  const shared_store::Header& header_;
+  const shared_store::Slot* const slots_;
+  const char* const arena_;
+
+public:
+  enum class Result
+  {
+    Hit,     //!< `value` holds a consistent copy of the published value
+    Miss,    //!< the key is not stored on the server
+    Fallback //!< no answer from shared memory (writer kept interfering, or the index is incomplete)
+  };
+
+  //! Where a Hit was found, and the slot's sequence number when it was: the writer changes the sequence whenever
+  //! it changes the slot, so while the sequence stays the same, so does the value
+  struct Version
+  {
+    uint64_t slot;
+    uint32_t sequence;
+  };
+
+private:
+  //! get() within one generation of the index
+  Result probe( const std::string_view key,
+                std::string& value,
+                const unsigned int max_attempts,
+                Version* version ) const;
+
+public:
+  //! \param[in] fd is a memfd received from the server
+  explicit SharedStoreReader( const FileDescriptor& fd );
+
+  /* Disallow copying */
+  SharedStoreReader( const SharedStoreReader& other ) = delete;
+  SharedStoreReader& operator=( const SharedStoreReader& other ) = delete;
+
+  //! Look `key` up, retrying each slot at most `max_attempts` times if a concurrent write is detected
+  //! \param[out] version if not null, is set to the Version of a Hit
+  Result get( const std::string_view key,
+              std::string& value,
+              const unsigned int max_attempts = 16,
+              Version* version = nullptr ) const;
+
+  //! Whether the value found at `version` is still the published one. This is one load, of a cache line that
+  //! only the writer writes, and only when it changes that slot, so readers of an unchanging key don't contend.
+  bool unchanged( const Version& version ) const
+  {
+    return slots_[version.slot].sequence.load( std::memory_order_acquire ) == version.sequence;
+  }
+};
@@ -1,9 +1,12 @@
 #include "socket.hh"
 
 #include "exception.hh"
+#include "timer.hh"
 
 #include <cstddef>
+#include <cstring>
 #include <stdexcept>
+#include <sys/un.h>
 #include <unistd.h>
 
 using namespace std;
@@ -199,24 +202,164 @@ void Socket::throw_if_error() const
   }
 }
 
+// fill in a sockaddr_un for a filesystem path
+static sockaddr_un make_local_address( const string& path )
+{
+  sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+
+  if ( path.size() >= sizeof( address.sun_path ) ) {
+    throw runtime_error( "Unix-domain socket path too long: " + path );
+  }
+
+  memcpy( address.sun_path, path.data(), path.size() );
+  return address;
+}
+
+//! \param[in] path is the filesystem path to bind; it must not exist yet
+void LocalStreamSocket::bind( const string& path )
+{
+  const sockaddr_un address = make_local_address( path );
+  CheckSystemCall( "bind", ::bind( fd_num(), reinterpret_cast<const sockaddr*>( &address ), sizeof( address ) ) );
+}
+
+//! \param[in] path is the filesystem path of a listening socket
+void LocalStreamSocket::connect( const string& path )
+{
+  const sockaddr_un address = make_local_address( path );
+  CheckSystemCall( "connect",
+                   ::connect( fd_num(), reinterpret_cast<const sockaddr*>( &address ), sizeof( address ) ) );
+}
+
+//! \param[in] backlog is the number of waiting connections to queue (see [listen(2)](\ref man2::listen))
+void LocalStreamSocket::listen( const int backlog )
+{
+  CheckSystemCall( "listen", ::listen( fd_num(), backlog ) );
+}
+
+//! \returns a new LocalStreamSocket connected to the peer.
+LocalStreamSocket LocalStreamSocket::accept()
+{
+  register_read();
+  return LocalStreamSocket( FileDescriptor( CheckSystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) ) );
+}
+
+//! \param[in] fd is the file descriptor to pass; the peer receives its own descriptor for the same open file
+//! \param[in] payload is sent as ordinary data along with the descriptor (it must not be empty)
+void LocalStreamSocket::send_fd( const FileDescriptor& fd, const string_view payload )
+{
+  if ( payload.empty() ) {
+    throw runtime_error( "LocalStreamSocket::send_fd: payload must not be empty" );
+  }
+
+  iovec iov { const_cast<char*>( payload.data() ), payload.size() };
+
+  alignas( cmsghdr ) char control[CMSG_SPACE( sizeof( int ) )] {};
+
+  msghdr message {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof( control );
+
+  cmsghdr* const header = CMSG_FIRSTHDR( &message );
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN( sizeof( int ) );
+
+  const int fd_to_send = fd.fd_num();
+  memcpy( CMSG_DATA( header ), &fd_to_send, sizeof( fd_to_send ) );
+
+  const ssize_t bytes_sent = CheckSystemCall( "sendmsg", ::sendmsg( fd_num(), &message, MSG_NOSIGNAL ) );
+  if ( bytes_sent != ssize_t( payload.size() ) ) {
+    throw runtime_error( "LocalStreamSocket::send_fd: short write" );
+  }
+
+  register_write();
+}
+
+//! \param[out] payload receives the data that accompanied the descriptor
+//! \returns the received file descriptor
+FileDescriptor LocalStreamSocket::recv_fd( string& payload )
+{
+  payload.resize( 4096 );
+  iovec iov { payload.data(), payload.size() };
+
+  alignas( cmsghdr ) char control[CMSG_SPACE( sizeof( int ) )] {};
+
+  msghdr message {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof( control );
+
+  const ssize_t bytes_received = CheckSystemCall( "recvmsg", ::recvmsg( fd_num(), &message, MSG_CMSG_CLOEXEC ) );
+  register_read();
+  payload.resize( bytes_received );
+
+  if ( message.msg_flags & MSG_CTRUNC ) {
+    throw runtime_error( "LocalStreamSocket::recv_fd: ancillary data truncated" );
+  }
+
+  const cmsghdr* const header = CMSG_FIRSTHDR( &message );
+  if ( not header or header->cmsg_level != SOL_SOCKET or header->cmsg_type != SCM_RIGHTS
+       or header->cmsg_len != CMSG_LEN( sizeof( int ) ) ) {
+    throw runtime_error( "LocalStreamSocket::recv_fd: no file descriptor received" );
+  }
+
+  int received_fd;
+  memcpy( &received_fd, CMSG_DATA( header ), sizeof( received_fd ) );
+  return FileDescriptor { received_fd };
+}
+
+void TCPSession::update_buffers()
+{
+  outbound_plaintext_.update();
+  inbound_plaintext_.update();
+}
+
 void TCPSession::do_read()
 {
-  simple_string_span target = inbound_plaintext_.writable_region();
+  simple_string_span target = inbound_plaintext_.get().writable_region();
   const int bytes_read = socket_.read( target );
 
   if ( bytes_read > 0 ) {
-    inbound_plaintext_.push( bytes_read );
+    inbound_plaintext_.get().push( bytes_read );
+    inbound_bytes_ += bytes_read;
+    arrivals_[reads_++ % ARRIVAL_LOG_SIZE] = { inbound_bytes_, Timer::ticks() };
+    inbound_wakeup_.notify();
+  }
+
+  inbound_plaintext_.update();
+}
+
+uint64_t TCPSession::inbound_arrival( const uint64_t offset ) const
+{
+  if ( reads_ == 0 ) {
+    return Timer::ticks();
   }
+
+  const uint64_t oldest = reads_ > ARRIVAL_LOG_SIZE ? reads_ - ARRIVAL_LOG_SIZE : 0;
+  for ( uint64_t i = oldest; i < reads_; i++ ) {
+    const Arrival& arrival = arrivals_[i % ARRIVAL_LOG_SIZE];
+    if ( offset < arrival.end ) {
+      return arrival.ticks;
+    }
+  }
+
+  return arrivals_[( reads_ - 1 ) % ARRIVAL_LOG_SIZE].ticks;
 }
 
 void TCPSession::do_write()
 {
-  const string_view source = outbound_plaintext_.readable_region();
+  const string_view source = outbound_plaintext_.get().readable_region();
   const int bytes_written = socket_.write( source );
 
   if ( bytes_written > 0 ) {
-    outbound_plaintext_.pop( bytes_written );
+    outbound_plaintext_.get().pop( bytes_written );
+    outbound_bytes_ += bytes_written;
+    outbound_wakeup_.notify();
   }
 
-  return;
+  outbound_plaintext_.update();
 }
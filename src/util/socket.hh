@@ -1,9 +1,11 @@
 #pragma once
 
 #include "address.hh"
+#include "eventloop.hh"
 #include "file_descriptor.hh"
 #include "ring_buffer.hh"
 
+#include <array>
 #include <cstdint>
 #include <functional>
 #include <string>
@@ -114,29 +116,104 @@ public:
   TCPSocket accept();
 };
 
-class TCPSession
+//! A wrapper around [Unix-domain stream sockets](\ref man7::unix)
+class LocalStreamSocket : public Socket
 {
 private:
-  static constexpr size_t storage_size = 65536;
+  //! \brief Construct from FileDescriptor (used by accept())
+  //! \param[in] fd is the FileDescriptor from which to construct
+  explicit LocalStreamSocket( FileDescriptor&& fd )
+    : Socket( std::move( fd ), AF_UNIX, SOCK_STREAM )
+  {}
+
+public:
+  //! Default: construct an unbound, unconnected Unix-domain stream socket
+  LocalStreamSocket()
+    : Socket( AF_UNIX, SOCK_STREAM )
+  {}
+
+  //! Bind the socket to a filesystem path
+  void bind( const std::string& path );
+
+  //! Connect the socket to a filesystem path
+  void connect( const std::string& path );
+
+  //! Mark a socket as listening for incoming connections
+  void listen( const int backlog = 16 );
+
+  //! Accept a new incoming connection
+  LocalStreamSocket accept();
+
+  //! Pass a file descriptor (and a short payload) to the peer as [SCM_RIGHTS](\ref man7::unix) ancillary data
+  void send_fd( const FileDescriptor& fd, const std::string_view payload );
+
+  //! Receive a file descriptor sent with send_fd(); the payload that came with it is stored in `payload`
+  FileDescriptor recv_fd( std::string& payload );
+};
 
+class TCPSession
+{
+private:
   TCPSocket socket_;
 
-  RingBuffer outbound_plaintext_ { storage_size };
-  RingBuffer inbound_plaintext_ { storage_size };
+  // held only while they store data, and sized by the traffic (see AdaptiveRingBuffer)
+  AdaptiveRingBuffer outbound_plaintext_ {};
+  AdaptiveRingBuffer inbound_plaintext_ {};
+
+  EventLoop::Wakeup inbound_wakeup_ {}, outbound_wakeup_ {};
+
+  //! One read from the socket: the inbound stream offset just past its bytes, and when it happened
+  struct Arrival
+  {
+    uint64_t end;
+    uint64_t ticks;
+  };
+
+  static constexpr size_t ARRIVAL_LOG_SIZE = 8;
+
+  std::array<Arrival, ARRIVAL_LOG_SIZE> arrivals_ {}; //!< the most recent reads, at reads_ % ARRIVAL_LOG_SIZE
+  uint64_t reads_ { 0 };
+  uint64_t inbound_bytes_ { 0 };  //!< ever read from the socket
+  uint64_t outbound_bytes_ { 0 }; //!< ever written to the socket
 
 public:
   TCPSession( TCPSocket&& sock )
     : socket_( std::move( sock ) )
   {}
 
-  RingBuffer& outbound_plaintext() { return outbound_plaintext_; }
-  RingBuffer& inbound_plaintext() { return inbound_plaintext_; }
+  RingBuffer& outbound_plaintext() { return outbound_plaintext_.get(); }
+  RingBuffer& inbound_plaintext() { return inbound_plaintext_.get(); }
+
+  //! \name Queries that don't take a buffer from the pool
+  //!@{
+  bool inbound_plaintext_empty() const { return inbound_plaintext_.empty(); }
+  bool outbound_plaintext_full() const { return outbound_plaintext_.full(); }
+  //!@}
+
+  //! To be called after the plaintext buffers were read or written by someone else: resizes or releases them
+  void update_buffers();
+
+  //! Bytes of buffer capacity this session currently holds
+  size_t resident_bytes() const { return outbound_plaintext_.resident_bytes() + inbound_plaintext_.resident_bytes(); }
 
   TCPSocket& socket() { return socket_; }
 
+  //! Notified by do_read() when bytes were added to the inbound plaintext
+  EventLoop::Wakeup& inbound_wakeup() { return inbound_wakeup_; }
+
+  //! Notified by do_write() when space was freed in the outbound plaintext
+  EventLoop::Wakeup& outbound_wakeup() { return outbound_wakeup_; }
+
   void do_read();
   void do_write();
 
-  bool want_read() const { return not inbound_plaintext_.writable_region().empty(); }
-  bool want_write() const { return not outbound_plaintext_.readable_region().empty(); }
+  uint64_t inbound_bytes() const { return inbound_bytes_; }
+  uint64_t outbound_bytes() const { return outbound_bytes_; }
+
+  //! When the inbound byte at `offset` (counting from the first byte ever read) was read from the socket, as
+  //! Timer::ticks(); bytes older than the last few reads get the time of the oldest one remembered
+  uint64_t inbound_arrival( const uint64_t offset ) const;
+
+  bool want_read() const { return inbound_plaintext_.has_space(); }
+  bool want_write() const { return not outbound_plaintext_.empty(); }
 };
@@ -0,0 +1,87 @@
+#include <stdexcept>
+
+#include "spsc_ring_buffer.hh"
+
+using namespace std;
+
+SpscRingBuffer::SpscRingBuffer( const size_t capacity, const size_t publish_batch )
+  : storage_( capacity )
+  , publish_batch_( publish_batch )
+{}
+
+simple_string_span SpscRingBuffer::writable_region( const size_t min_bytes )
+{
+  if ( capacity() - ( producer_.write_position - producer_.cached_read_position ) < min_bytes ) {
+    producer_.cached_read_position = published_read_position_.load( memory_order_acquire );
+
+    if ( capacity() - ( producer_.write_position - producer_.cached_read_position ) < min_bytes ) {
+      publish_push();
+    }
+  }
+
+  return { storage_.addr() + producer_.write_position % capacity(),
+           capacity() - ( producer_.write_position - producer_.cached_read_position ) };
+}
+
+void SpscRingBuffer::push( const size_t num_bytes )
+{
+  if ( num_bytes > capacity() - ( producer_.write_position - producer_.cached_read_position ) ) {
+    throw runtime_error( "SpscRingBuffer::push exceeded size of writable region" );
+  }
+
+  producer_.write_position += num_bytes;
+
+  if ( producer_.write_position - producer_.published_write_position >= publish_batch_ ) {
+    publish_push();
+  }
+}
+
+void SpscRingBuffer::publish_push()
+{
+  if ( producer_.published_write_position != producer_.write_position ) {
+    producer_.published_write_position = producer_.write_position;
+    published_write_position_.store( producer_.write_position, memory_order_release );
+  }
+}
+
+size_t SpscRingBuffer::write( const string_view str )
+{
+  const size_t bytes_written = writable_region().copy( str );
+  push( bytes_written );
+  return bytes_written;
+}
+
+string_view SpscRingBuffer::readable_region( const size_t min_bytes )
+{
+  if ( consumer_.cached_write_position - consumer_.read_position < min_bytes ) {
+    consumer_.cached_write_position = published_write_position_.load( memory_order_acquire );
+
+    if ( consumer_.cached_write_position - consumer_.read_position < min_bytes ) {
+      publish_pop();
+    }
+  }
+
+  return { storage_.addr() + consumer_.read_position % capacity(),
+           consumer_.cached_write_position - consumer_.read_position };
+}
+
+void SpscRingBuffer::pop( const size_t num_bytes )
+{
+  if ( num_bytes > consumer_.cached_write_position - consumer_.read_position ) {
+    throw runtime_error( "SpscRingBuffer::pop exceeded size of readable region" );
+  }
+
+  consumer_.read_position += num_bytes;
+
+  if ( consumer_.read_position - consumer_.published_read_position >= publish_batch_ ) {
+    publish_pop();
+  }
+}
+
+void SpscRingBuffer::publish_pop()
+{
+  if ( consumer_.published_read_position != consumer_.read_position ) {
+    consumer_.published_read_position = consumer_.read_position;
+    published_read_position_.store( consumer_.read_position, memory_order_release );
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "ring_buffer.hh"
+#include "simple_string_span.hh"
+
+//! \brief A RingBuffer that one thread fills while another thread drains it.
+//! \details Like RingBuffer, the writable and readable regions are contiguous thanks to the mirrored
+//! mapping. The producer owns writable_region()/push(), and the consumer owns readable_region()/pop().
+//! Each side publishes its position to the other through an atomic index on its own cache line (release
+//! on store, acquire on load); positions are published in batches of at least `publish_batch` bytes, or
+//! when publish_push()/publish_pop() is called. Each side keeps a cached copy of the other side's index and
+//! reloads it only when the cached view holds fewer than `min_bytes` of space (producer) or data (consumer),
+//! so a side that needs whole fixed-size records asks for that many rather than seeing a stale remainder
+//! forever. A side that finds itself stuck that way also publishes its own position, so batching can't make
+//! both sides wait forever.
+class SpscRingBuffer
+{
+  static constexpr size_t CACHE_LINE = 64;
+
+  MirroredMapping storage_;
+  const size_t publish_batch_;
+
+  // positions count bytes since construction; the offset into storage_ is position % capacity
+  alignas( CACHE_LINE ) std::atomic<uint64_t> published_write_position_ { 0 };
+  alignas( CACHE_LINE ) std::atomic<uint64_t> published_read_position_ { 0 };
+
+  struct alignas( CACHE_LINE ) ProducerState
+  {
+    uint64_t write_position;
+    uint64_t published_write_position;
+    uint64_t cached_read_position;
+  } producer_ { 0, 0, 0 };
+
+  struct alignas( CACHE_LINE ) ConsumerState
+  {
+    uint64_t read_position;
+    uint64_t published_read_position;
+    uint64_t cached_write_position;
+  } consumer_ { 0, 0, 0 };
+
+public:
+  //! \param[in] capacity must be a multiple of the page size
+  //! \param[in] publish_batch is the number of bytes pushed or popped before the position is published
+  explicit SpscRingBuffer( const size_t capacity, const size_t publish_batch = 1 );
+
+  size_t capacity() const { return storage_.capacity(); }
+
+  //! \name Producer side
+  //!@{
+  simple_string_span writable_region( const size_t min_bytes = 1 );
+  void push( const size_t num_bytes );
+  size_t write( const std::string_view str );
+  void publish_push();
+  //!@}
+
+  //! \name Consumer side
+  //!@{
+  std::string_view readable_region( const size_t min_bytes = 1 );
+  void pop( const size_t num_bytes );
+  void publish_pop();
+  //!@}
+};
@@ -1,10 +1,19 @@
 #include "timer.hh"
 #include "exception.hh"
+#include "prometheus.hh"
 
+#include <cmath>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#endif
 
 using namespace std;
 
@@ -12,34 +21,146 @@ constexpr double THOUSAND = 1000.0;
 constexpr double MILLION = 1000000.0;
 constexpr double BILLION = 1000000000.0;
 
-string Timer::summary() const
+// CPUID leaf 0x80000007 ("advanced power management"), EDX bit 8: the TSC is invariant
+static bool tsc_is_invariant()
 {
-  const uint64_t now = timestamp_ns();
+#if defined( __x86_64__ ) || defined( __i386__ )
+  unsigned int eax, ebx, ecx, edx;
+  if ( not __get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx ) ) {
+    return false;
+  }
+  return edx & ( 1 << 8 );
+#else
+  return false;
+#endif
+}
 
-  const uint64_t elapsed = now - _beginning_timestamp;
+#if defined( __x86_64__ ) || defined( __i386__ )
+// Reads the TSC and steady_clock together. Of a few tries, keeps the one where the two TSC reads around
+// steady_clock are closest, so the pair is least disturbed by interrupts.
+static pair<uint64_t, uint64_t> tsc_and_ns()
+{
+  pair<uint64_t, uint64_t> best {};
+  uint64_t best_gap = UINT64_MAX;
 
-  ostringstream out;
+  for ( unsigned int i = 0; i < 8; i++ ) {
+    const uint64_t before = __rdtsc();
+    const uint64_t ns = Timer::timestamp_ns();
+    const uint64_t after = __rdtsc();
+    if ( after - before < best_gap ) {
+      best_gap = after - before;
+      best = { before + ( after - before ) / 2, ns };
+    }
+  }
 
-  out << "Global timing summary\n---------------------\n\n";
+  return best;
+}
+#endif
+
+Timer::TickCalibration Timer::TickCalibration::measure()
+{
+  static constexpr auto CALIBRATION_TIME = chrono::milliseconds( 2 );
 
-  out << "Total time: " << pp_ns( now - _beginning_timestamp ) << "\n";
+  TickCalibration ret { false, 1.0, 0, 0 };
 
+#if defined( __x86_64__ ) || defined( __i386__ )
+  if ( tsc_is_invariant() ) {
+    const auto [start_tsc, start_ns] = tsc_and_ns();
+    this_thread::sleep_for( CALIBRATION_TIME );
+    const auto [end_tsc, end_ns] = tsc_and_ns();
+
+    // a TSC slower than 100 MHz, or one that went backwards, is not one to trust
+    if ( end_tsc > start_tsc and ( end_tsc - start_tsc ) > ( end_ns - start_ns ) / 10 ) {
+      ret.tsc = true;
+      ret.ns_per_tick = double( end_ns - start_ns ) / double( end_tsc - start_tsc );
+      ret.origin_ticks = end_tsc;
+      ret.origin_ns = end_ns;
+      return ret;
+    }
+  }
+#endif
+
+  ret.origin_ns = ret.origin_ticks = timestamp_ns();
+  return ret;
+}
+
+Timer::Timer()
+  : _thread_id( syscall( SYS_gettid ) )
+{}
+
+void Timer::write_breakdown( ostream& out,
+                             const uint64_t elapsed,
+                             const array<Record, num_categories>& records,
+                             const array<RelaxedCounter, num_categories>& exclusive_ticks )
+{
   uint64_t accounted = 0;
 
   for ( unsigned int i = 0; i < num_categories; i++ ) {
+    const Record& record = records.at( i );
+    const uint64_t exclusive = exclusive_ticks.at( i ).load();
+
     out << "   " << _category_names.at( i ) << ": ";
     out << string( 32 - strlen( _category_names.at( i ) ), ' ' );
-    out << fixed << setw( 5 ) << setprecision( 1 ) << 100 * _records.at( i ).total_ns / double( elapsed ) << "%";
-    accounted += _records.at( i ).total_ns;
+    out << fixed << setw( 5 ) << setprecision( 1 ) << 100 * exclusive / double( elapsed ) << "%";
+    accounted += exclusive;
 
-    out << "     [max=" << pp_ns( _records.at( i ).max_ns ) << "]";
-    out << " [count=" << _records.at( i ).count << "]";
+    out << "     ";
+    if ( record.total_ticks.load() != exclusive ) {
+      out << "[inclusive=" << pp_ticks( record.total_ticks.load() ) << "] ";
+    }
+    out << "[max=" << pp_ticks( record.max_ticks.load() ) << "]";
+    out << " [p99=" << pp_ticks( record.histogram.quantile( 0.99 ) ) << "]";
+    out << " [count=" << record.count.load() << "]";
     out << "\n";
   }
 
-  const uint64_t unaccounted = elapsed - accounted;
+  const uint64_t unaccounted = elapsed > accounted ? elapsed - accounted : 0;
   out << "\n   Unaccounted: " << string( 23, ' ' );
   out << 100 * unaccounted / double( elapsed ) << "%\n";
+}
+
+string Timer::summary()
+{
+  const uint64_t now = ticks();
+
+  uint64_t elapsed = 0;
+  array<Record, num_categories> records {};
+  array<RelaxedCounter, num_categories> exclusive_ticks {};
+  ostringstream per_thread;
+  size_t threads = 0;
+
+  PerThread<Timer>::for_each( [&]( const Timer& timer ) {
+    const uint64_t thread_elapsed = now - timer._beginning_timestamp;
+    elapsed += thread_elapsed;
+    for ( unsigned int i = 0; i < num_categories; i++ ) {
+      records.at( i ).add( timer._records.at( i ) );
+      exclusive_ticks.at( i ).add( timer._exclusive_ticks.at( i ).load() );
+    }
+    threads++;
+
+    per_thread << "\nThread " << timer._thread_id << ": " << pp_ticks( thread_elapsed ) << "\n";
+    write_breakdown( per_thread, thread_elapsed, timer._records, timer._exclusive_ticks );
+  } );
+
+  ostringstream out;
+
+  out << "Global timing summary\n---------------------\n\n";
+
+  out << "Total time: " << pp_ticks( elapsed );
+  if ( threads > 1 ) {
+    out << " across " << threads << " threads";
+  }
+  if ( tick_calibration().tsc ) {
+    out << " (timed with the TSC, at " << setprecision( 3 ) << 1 / tick_calibration().ns_per_tick << " GHz)\n";
+  } else {
+    out << " (timed with steady_clock)\n";
+  }
+
+  write_breakdown( out, elapsed, records, exclusive_ticks );
+
+  if ( threads > 1 ) {
+    out << per_thread.str();
+  }
 
   return out.str();
 }
@@ -62,3 +183,103 @@ std::string Timer::pp_ns( const uint64_t duration_ns )
 
   return out.str();
 }
+
+void Timer::write_metrics( PrometheusText& out )
+{
+  array<Record, num_categories> records {};
+  array<uint64_t, num_categories> exclusive_ticks {};
+  PerThread<Timer>::for_each( [&]( const Timer& timer ) {
+    for ( unsigned int i = 0; i < num_categories; i++ ) {
+      records.at( i ).add( timer._records.at( i ) );
+      exclusive_ticks.at( i ) += timer._exclusive_ticks.at( i ).load();
+    }
+  } );
+
+  out.family( "timer_seconds", "histogram", "Time spent in each global timer category, including nested ones" );
+  for ( unsigned int i = 0; i < num_categories; i++ ) {
+    out.duration_histogram(
+      "timer_seconds", PrometheusText::label( "category", _category_names.at( i ) ), records.at( i ) );
+  }
+
+  out.family(
+    "timer_exclusive_seconds_total", "counter", "Time spent in each global timer category, less nested ones" );
+  for ( unsigned int i = 0; i < num_categories; i++ ) {
+    out.sample( "timer_exclusive_seconds_total",
+                PrometheusText::label( "category", _category_names.at( i ) ),
+                ticks_to_ns( exclusive_ticks.at( i ) ) / 1e9 );
+  }
+}
+
+void Timer::Record::add( const Record& other )
+{
+  count.add( other.count.load() );
+  total_ticks.add( other.total_ticks.load() );
+  max_ticks.raise_to( other.max_ticks.load() );
+  histogram.add( other.histogram );
+}
+
+void Timer::Histogram::add( const Histogram& other )
+{
+  for ( size_t i = 0; i < NUM_BUCKETS; i++ ) {
+    buckets_[i].add( other.buckets_[i].load() );
+  }
+}
+
+uint64_t Timer::Histogram::bucket_lower_bound( const size_t index )
+{
+  if ( index < SUB_BUCKETS ) {
+    return index;
+  }
+
+  const unsigned int shift = ( index >> SUB_BUCKET_BITS ) - 1;
+  return ( SUB_BUCKETS + ( index & ( SUB_BUCKETS - 1 ) ) ) << shift;
+}
+
+uint64_t Timer::Histogram::bucket_upper_bound( const size_t index )
+{
+  if ( index + 1 >= NUM_BUCKETS ) {
+    return UINT64_MAX;
+  }
+
+  return bucket_lower_bound( index + 1 ) - 1;
+}
+
+uint64_t Timer::Histogram::count() const
+{
+  uint64_t ret = 0;
+  for ( const auto& bucket : buckets_ ) {
+    ret += bucket.load();
+  }
+  return ret;
+}
+
+uint64_t Timer::Histogram::count_at_most( const uint64_t value ) const
+{
+  uint64_t ret = 0;
+  const size_t last = bucket_index( value );
+  for ( size_t i = 0; i <= last; i++ ) {
+    ret += buckets_[i].load();
+  }
+  return ret;
+}
+
+uint64_t Timer::Histogram::quantile( const double q ) const
+{
+  const uint64_t total = count();
+  if ( total == 0 ) {
+    return 0;
+  }
+
+  // the rank of the value we're after, counting from 1
+  const uint64_t rank = max<uint64_t>( 1, ceil( q * total ) );
+
+  uint64_t seen = 0;
+  for ( size_t i = 0; i < NUM_BUCKETS; i++ ) {
+    seen += buckets_[i].load();
+    if ( seen >= rank ) {
+      return bucket_upper_bound( i );
+    }
+  }
+
+  return bucket_upper_bound( NUM_BUCKETS - 1 );
+}
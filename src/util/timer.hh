@@ -2,10 +2,18 @@
 
 #include <array>
 #include <chrono>
-#include <optional>
+#include <ostream>
 #include <string>
 #include <type_traits>
 
+#include "per_thread.hh"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+class PrometheusText;
+
 class Timer
 {
 public:
@@ -16,20 +24,132 @@ public:
     return std::chrono::steady_clock::now().time_since_epoch().count();
   }
 
+  //! \brief How Timer::ticks() values relate to nanoseconds.
+  //! \details Measured once per process, on first use. When the CPU has an invariant TSC (one that ticks at
+  //! a constant rate in every power state, and across cores), ticks are read with RDTSC and their rate is
+  //! calibrated against steady_clock. Otherwise ticks are just steady_clock nanoseconds.
+  struct TickCalibration
+  {
+    bool tsc;
+    double ns_per_tick;
+    uint64_t origin_ticks; //!< ticks() at calibration...
+    uint64_t origin_ns;    //!< ...and timestamp_ns() at the same moment
+
+    static TickCalibration measure();
+  };
+
+  static inline const TickCalibration& tick_calibration()
+  {
+    static const TickCalibration calibration = TickCalibration::measure();
+    return calibration;
+  }
+
+  //! A cheap timestamp for instrumentation, in units that only tick_calibration() can turn into time.
+  //! \details Use it for measuring durations that are only reported later; use timestamp_ns() for
+  //! deadlines and anything else that is compared with real time as it runs.
+  static inline uint64_t ticks()
+  {
+#if defined( __x86_64__ ) || defined( __i386__ )
+    if ( tick_calibration().tsc ) {
+      return __rdtsc();
+    }
+#endif
+    return timestamp_ns();
+  }
+
+  static uint64_t ticks_to_ns( const uint64_t duration_ticks )
+  {
+    return uint64_t( duration_ticks * tick_calibration().ns_per_tick );
+  }
+
+  static uint64_t ns_to_ticks( const uint64_t duration_ns )
+  {
+    return uint64_t( duration_ns / tick_calibration().ns_per_tick );
+  }
+
+  //! The timestamp_ns() value at which ticks() returned `timestamp_ticks`
+  static uint64_t ticks_to_timestamp_ns( const uint64_t timestamp_ticks )
+  {
+    const TickCalibration& calibration = tick_calibration();
+    if ( timestamp_ticks >= calibration.origin_ticks ) {
+      return calibration.origin_ns + ticks_to_ns( timestamp_ticks - calibration.origin_ticks );
+    }
+    return calibration.origin_ns - ticks_to_ns( calibration.origin_ticks - timestamp_ticks );
+  }
+
   static std::string pp_ns( const uint64_t duration_ns );
+  static std::string pp_ticks( const uint64_t duration_ticks ) { return pp_ns( ticks_to_ns( duration_ticks ) ); }
 
+  //! \brief Log-linear (HDR-style) histogram of nonnegative integers, e.g. durations in ticks.
+  //! \details Values below 16 are counted exactly. Above that, each power of two is split into 16 equal
+  //! buckets, so any value is known to within 1/16 (6.25%). Values of 2^40 or more (minutes, in ticks of a
+  //! few GHz) share the last bucket. Recording is a count-leading-zeros, two shifts and an increment. One
+  //! thread records, and any thread may read (or copy) the counts.
+  class Histogram
+  {
+  public:
+    static constexpr unsigned int SUB_BUCKET_BITS = 4;
+    static constexpr unsigned int MAX_EXPONENT = 40;
+    static constexpr size_t SUB_BUCKETS = size_t { 1 } << SUB_BUCKET_BITS;
+    static constexpr size_t NUM_BUCKETS = ( MAX_EXPONENT - SUB_BUCKET_BITS + 1 ) * SUB_BUCKETS;
+
+  private:
+    std::array<RelaxedCounter, NUM_BUCKETS> buckets_ {};
+
+  public:
+    static size_t bucket_index( const uint64_t value )
+    {
+      if ( value < SUB_BUCKETS ) {
+        return value;
+      }
+
+      const unsigned int exponent = 63 - __builtin_clzll( value );
+      if ( exponent >= MAX_EXPONENT ) {
+        return NUM_BUCKETS - 1;
+      }
+
+      const unsigned int shift = exponent - SUB_BUCKET_BITS;
+      return ( size_t( shift + 1 ) << SUB_BUCKET_BITS ) | ( ( value >> shift ) & ( SUB_BUCKETS - 1 ) );
+    }
+
+    //! Smallest value that falls in bucket `index`
+    static uint64_t bucket_lower_bound( const size_t index );
+
+    //! Largest value that falls in bucket `index` (UINT64_MAX for the last one)
+    static uint64_t bucket_upper_bound( const size_t index );
+
+    void record( const uint64_t value ) { ++buckets_[bucket_index( value )]; }
+
+    //! Adds another histogram's counts to this one
+    void add( const Histogram& other );
+
+    uint64_t count() const;
+
+    //! Values recorded in the buckets up to and including the one that holds `value`
+    uint64_t count_at_most( const uint64_t value ) const;
+
+    //! \returns the upper bound of the bucket holding the value at quantile `q` (0 < q <= 1), or 0 if empty
+    uint64_t quantile( const double q ) const;
+  };
+
+  //! Durations, in ticks (logged by one thread, readable from any)
   struct Record
   {
-    uint64_t count;
-    uint64_t total_ns;
-    uint64_t max_ns;
+    RelaxedCounter count;
+    RelaxedCounter total_ticks;
+    RelaxedCounter max_ticks;
+    Histogram histogram;
 
-    void log( const uint64_t time_ns )
+    void log( const uint64_t time_ticks )
     {
-      count++;
-      total_ns += time_ns;
-      max_ns = std::max( max_ns, time_ns );
+      ++count;
+      total_ticks.add( time_ticks );
+      max_ticks.raise_to( time_ticks );
+      histogram.record( time_ticks );
     }
+
+    //! Adds another record's durations to this one
+    void add( const Record& other );
   };
 
   enum class Category
@@ -46,42 +166,74 @@ public:
     { "DNS", "Nonblocking operations", "Waiting for event" }
   };
 
+  static constexpr size_t MAX_DEPTH = 16;
+
 private:
-  uint64_t _beginning_timestamp = timestamp_ns();
-  std::array<Record, num_categories> _records {};
-  std::optional<Category> _current_category {};
-  uint64_t _start_time {};
+  //! A category that has been started and not yet stopped
+  struct Frame
+  {
+    Category category;
+    uint64_t start;
+    uint64_t children; //!< ticks spent in categories started (and stopped) inside this one
+  };
+
+  uint64_t _beginning_timestamp = ticks();
+  long _thread_id;
+  std::array<Record, num_categories> _records {}; //!< inclusive: each span from start to stop
+  std::array<RelaxedCounter, num_categories> _exclusive_ticks {}; //!< less the time in nested categories
+  std::array<Frame, MAX_DEPTH> _stack {};
+  size_t _depth { 0 };
+
+  static void write_breakdown( std::ostream& out,
+                               const uint64_t elapsed,
+                               const std::array<Record, num_categories>& records,
+                               const std::array<RelaxedCounter, num_categories>& exclusive_ticks );
 
 public:
+  Timer();
+
+  //! Starts timing `category`, inside any category already running
   template<Category category>
-  void start( const uint64_t now = timestamp_ns() )
+  void start( const uint64_t now = ticks() )
   {
-    if ( _current_category.has_value() ) {
-      throw std::runtime_error( "timer started when already running" );
+    if ( _depth == MAX_DEPTH ) {
+      throw std::runtime_error( "timer categories nested too deeply" );
     }
 
-    _current_category = category;
-    _start_time = now;
+    _stack[_depth++] = { category, now, 0 };
   }
 
+  //! Stops the most recently started category, which must be `category`
   template<Category category>
-  void stop( const uint64_t now = timestamp_ns() )
+  void stop( const uint64_t now = ticks() )
   {
-    if ( not _current_category.has_value() or _current_category.value() != category ) {
+    if ( _depth == 0 or _stack[_depth - 1].category != category ) {
       throw std::runtime_error( "timer stopped when not running, or with mismatched category" );
     }
 
-    _records[static_cast<size_t>( category )].log( now - _start_time );
-    _current_category.reset();
+    const Frame& frame = _stack[--_depth];
+    const uint64_t elapsed = now - frame.start;
+    _records[static_cast<size_t>( category )].log( elapsed );
+    _exclusive_ticks[static_cast<size_t>( category )].add( elapsed - frame.children );
+    if ( _depth ) {
+      _stack[_depth - 1].children += elapsed;
+    }
   }
 
-  std::string summary() const;
+  //! Time spent in each category, combined across every thread that has used global_timer(), then for each
+  //! of those threads if there is more than one
+  static std::string summary();
+
+  //! Adds the time spent in each category by every thread, as a histogram in seconds
+  static void write_metrics( PrometheusText& out );
 };
 
+//! \brief The calling thread's Timer.
+//! \details Each thread times itself, with no locks or shared cache lines; Timer::summary() and
+//! Timer::write_metrics() read every thread's records. Records outlive their threads.
 inline Timer& global_timer()
 {
-  static Timer the_global_timer;
-  return the_global_timer;
+  return PerThread<Timer>::local();
 }
 
 template<Timer::Category category>
@@ -101,14 +253,14 @@ class RecordScopeTimer
 public:
   RecordScopeTimer( Timer::Record& timer )
     : _timer( &timer )
-    , _start_time( Timer::timestamp_ns() )
+    , _start_time( Timer::ticks() )
   {
     global_timer().start<category>( _start_time );
   }
 
   ~RecordScopeTimer()
   {
-    const uint64_t now = Timer::timestamp_ns();
+    const uint64_t now = Timer::ticks();
     _timer->log( now - _start_time );
     global_timer().stop<category>( now );
   }
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <sstream>
+
+#include "timer.hh"
+#include "work_stealing_pool.hh"
+
+using namespace std;
+
+static constexpr int64_t INITIAL_DEQUE_CAPACITY = 256;
+static constexpr size_t MAX_INJECTED_BATCH = 32;
+
+// the pool (if any) whose worker is running on this thread
+static thread_local const WorkStealingPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+WorkStealingPool::Deque::Array::Array( const int64_t capacity )
+  : capacity( capacity )
+  , slots( make_unique<atomic<Job*>[]>( capacity ) )
+{}
+
+WorkStealingPool::Deque::Deque()
+  : array_( nullptr )
+{
+  arrays_.push_back( make_unique<Array>( INITIAL_DEQUE_CAPACITY ) );
+  array_.store( arrays_.back().get(), memory_order_relaxed );
+}
+
+void WorkStealingPool::Deque::push( Job* job )
+{
+  const int64_t bottom = bottom_.load( memory_order_relaxed );
+  const int64_t top = top_.load( memory_order_acquire );
+  Array* array = array_.load( memory_order_relaxed );
+
+  if ( bottom - top > array->capacity - 1 ) {
+    arrays_.push_back( make_unique<Array>( array->capacity * 2 ) );
+    Array* const bigger = arrays_.back().get();
+    for ( int64_t i = top; i < bottom; i++ ) {
+      bigger->put( i, array->get( i ) );
+    }
+    array_.store( bigger, memory_order_release );
+    array = bigger;
+  }
+
+  array->put( bottom, job );
+  atomic_thread_fence( memory_order_release );
+  bottom_.store( bottom + 1, memory_order_relaxed );
+}
+
+WorkStealingPool::Job* WorkStealingPool::Deque::pop()
+{
+  const int64_t bottom = bottom_.load( memory_order_relaxed ) - 1;
+  Array* const array = array_.load( memory_order_relaxed );
+  bottom_.store( bottom, memory_order_relaxed );
+  atomic_thread_fence( memory_order_seq_cst );
+  int64_t top = top_.load( memory_order_relaxed );
+
+  if ( top > bottom ) {
+    // empty
+    bottom_.store( bottom + 1, memory_order_relaxed );
+    return nullptr;
+  }
+
+  Job* job = array->get( bottom );
+  if ( top == bottom ) {
+    // the last job: race the thieves for it
+    if ( not top_.compare_exchange_strong( top, top + 1, memory_order_seq_cst, memory_order_relaxed ) ) {
+      job = nullptr;
+    }
+    bottom_.store( bottom + 1, memory_order_relaxed );
+  }
+
+  return job;
+}
+
+WorkStealingPool::Job* WorkStealingPool::Deque::steal()
+{
+  int64_t top = top_.load( memory_order_acquire );
+  atomic_thread_fence( memory_order_seq_cst );
+  const int64_t bottom = bottom_.load( memory_order_acquire );
+
+  if ( top >= bottom ) {
+    return nullptr;
+  }
+
+  Job* const job = array_.load( memory_order_acquire )->get( top );
+  if ( not top_.compare_exchange_strong( top, top + 1, memory_order_seq_cst, memory_order_relaxed ) ) {
+    return nullptr;
+  }
+
+  return job;
+}
+
+size_t WorkStealingPool::Deque::size() const
+{
+  const int64_t bottom = bottom_.load( memory_order_seq_cst );
+  const int64_t top = top_.load( memory_order_seq_cst );
+  return bottom > top ? bottom - top : 0;
+}
+
+WorkStealingPool::WorkStealingPool( const size_t threads )
+{
+  if ( threads == 0 ) {
+    throw runtime_error( "WorkStealingPool: need at least one thread" );
+  }
+
+  // every worker must exist before any of them starts looking for jobs to steal
+  for ( size_t i = 0; i < threads; i++ ) {
+    workers_.push_back( make_unique<Worker>() );
+  }
+
+  for ( size_t i = 0; i < threads; i++ ) {
+    workers_[i]->thread = thread( [this, i] { work( i ); } );
+  }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+  {
+    lock_guard<mutex> lock { mutex_ };
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+
+  for ( auto& worker : workers_ ) {
+    worker->thread.join();
+  }
+}
+
+void WorkStealingPool::enqueue( Job* job )
+{
+  if ( current_pool == this ) {
+    Worker& self = *workers_[current_worker];
+    self.deque.push( job );
+    self.max_depth.store( max<uint64_t>( self.max_depth.load( memory_order_relaxed ), self.deque.size() ),
+                          memory_order_relaxed );
+
+    // pairs with the fence in work(): either we see the sleeper, or it sees the job
+    atomic_thread_fence( memory_order_seq_cst );
+    if ( sleeping_.load( memory_order_relaxed ) ) {
+      wake_one_sleeper();
+    }
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock { mutex_ };
+    injected_.push_back( job );
+  }
+  wakeup_.notify_one();
+}
+
+void WorkStealingPool::wake_one_sleeper()
+{
+  // taking the lock means the sleeper is either waiting already or hasn't yet checked for work
+  lock_guard<mutex> lock { mutex_ };
+  wakeup_.notify_one();
+}
+
+WorkStealingPool::Job* WorkStealingPool::take_injected( Worker& self )
+{
+  lock_guard<mutex> lock { mutex_ };
+  if ( injected_.empty() ) {
+    return nullptr;
+  }
+
+  // take a share of the queue, so that other workers can steal from us instead of queueing on the lock
+  const size_t batch = min( MAX_INJECTED_BATCH, max<size_t>( 1, injected_.size() / workers_.size() ) );
+  Job* const first = injected_.front();
+  injected_.pop_front();
+  for ( size_t i = 1; i < batch; i++ ) {
+    self.deque.push( injected_.front() );
+    injected_.pop_front();
+  }
+
+  self.max_depth.store( max<uint64_t>( self.max_depth.load( memory_order_relaxed ), self.deque.size() ),
+                        memory_order_relaxed );
+
+  // someone else could be stealing the rest of the batch
+  if ( batch > 1 and sleeping_.load( memory_order_relaxed ) ) {
+    wakeup_.notify_one();
+  }
+
+  return first;
+}
+
+WorkStealingPool::Job* WorkStealingPool::find_job( const size_t index )
+{
+  Worker& self = *workers_[index];
+
+  if ( Job* job = self.deque.pop() ) {
+    return job;
+  }
+
+  if ( Job* job = take_injected( self ) ) {
+    return job;
+  }
+
+  for ( size_t i = 1; i < workers_.size(); i++ ) {
+    if ( Job* job = workers_[( index + i ) % workers_.size()]->deque.steal() ) {
+      self.steals.fetch_add( 1, memory_order_relaxed );
+      return job;
+    }
+  }
+
+  return nullptr;
+}
+
+bool WorkStealingPool::any_queued()
+{
+  if ( not injected_.empty() ) {
+    return true;
+  }
+
+  return any_of( workers_.begin(), workers_.end(), []( const auto& worker ) { return worker->deque.size() > 0; } );
+}
+
+void WorkStealingPool::work( const size_t index )
+{
+  current_pool = this;
+  current_worker = index;
+  Worker& self = *workers_[index];
+
+  while ( true ) {
+    if ( Job* const job = find_job( index ) ) {
+      const uint64_t start = Timer::ticks();
+      job->run();
+      delete job;
+      self.busy_ticks.fetch_add( Timer::ticks() - start, memory_order_relaxed );
+      self.jobs.fetch_add( 1, memory_order_relaxed );
+      continue;
+    }
+
+    unique_lock<mutex> lock { mutex_ };
+    sleeping_.fetch_add( 1, memory_order_relaxed );
+    atomic_thread_fence( memory_order_seq_cst );
+
+    // a steal may have lost a race for a job that's still there, so look again before sleeping
+    if ( not any_queued() ) {
+      if ( stopping_ ) {
+        sleeping_.fetch_sub( 1, memory_order_relaxed );
+        return;
+      }
+      wakeup_.wait( lock );
+    }
+
+    sleeping_.fetch_sub( 1, memory_order_relaxed );
+  }
+}
+
+string WorkStealingPool::summary()
+{
+  ostringstream out;
+
+  out << "WorkStealingPool summary\n------------------------\n\n";
+
+  uint64_t total_jobs = 0, total_steals = 0;
+  for ( size_t i = 0; i < workers_.size(); i++ ) {
+    const Worker& worker = *workers_[i];
+    const string name = "worker " + to_string( i );
+    const uint64_t jobs = worker.jobs.load( memory_order_relaxed );
+    const uint64_t steals = worker.steals.load( memory_order_relaxed );
+    total_jobs += jobs;
+    total_steals += steals;
+
+    out << "   " << name << ": ";
+    out << string( 32 - name.size(), ' ' );
+    out << Timer::pp_ticks( worker.busy_ticks.load( memory_order_relaxed ) ) << " busy";
+
+    out << "     [jobs=" << jobs << "]";
+    out << " [steals=" << steals << "]";
+    out << " [depth=" << worker.deque.size() << "]";
+    out << " [max depth=" << worker.max_depth.load( memory_order_relaxed ) << "]";
+    out << "\n";
+  }
+
+  size_t injected;
+  {
+    lock_guard<mutex> lock { mutex_ };
+    injected = injected_.size();
+  }
+
+  out << "\n   Total: " << total_jobs << " jobs, " << total_steals << " steals, " << injected
+      << " waiting in the injection queue\n";
+
+  return out.str();
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "eventloop.hh"
+
+//! \brief Runs CPU-heavy jobs on a set of worker threads, and delivers their results back to an EventLoop.
+//! \details Each worker owns a Chase-Lev deque: it pushes and pops jobs at the bottom, and idle workers steal
+//! from the top. Jobs submitted from outside the pool go to a shared injection queue, from which a worker
+//! takes a batch (running one job and pushing the rest on its deque, where others can steal them); jobs
+//! submitted from inside a job go straight to the submitting worker's deque. Workers with nothing to run or
+//! steal sleep on a condition variable.
+class WorkStealingPool
+{
+public:
+  //! A unit of work; the pool deletes it after running it
+  struct Job
+  {
+    virtual void run() = 0;
+    virtual ~Job() = default;
+  };
+
+private:
+  template<class Work>
+  struct JobOf : public Job
+  {
+    Work work;
+
+    explicit JobOf( Work&& w )
+      : work( std::move( w ) )
+    {}
+
+    explicit JobOf( const Work& w )
+      : work( w )
+    {}
+
+    void run() override { work(); }
+  };
+
+  //! Chase-Lev work-stealing deque (Lê, Pop, Cohen and Zappa Nardelli's C11 formulation).
+  //! \details The owner calls push() and pop(); any thread may call steal(). The array doubles when full;
+  //! retired arrays are kept until the deque is destroyed, since a thief may still be reading one.
+  class Deque
+  {
+    struct Array
+    {
+      const int64_t capacity;
+      std::unique_ptr<std::atomic<Job*>[]> slots;
+
+      explicit Array( const int64_t capacity );
+
+      Job* get( const int64_t i ) const { return slots[i & ( capacity - 1 )].load( std::memory_order_relaxed ); }
+      void put( const int64_t i, Job* job ) { slots[i & ( capacity - 1 )].store( job, std::memory_order_relaxed ); }
+    };
+
+    alignas( 64 ) std::atomic<int64_t> top_ { 0 };
+    alignas( 64 ) std::atomic<int64_t> bottom_ { 0 };
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> arrays_ {}; //!< the current array and every retired one (owner only)
+
+  public:
+    Deque();
+
+    void push( Job* job );
+    Job* pop();
+    Job* steal(); //!< nullptr if the deque is empty or another thread won the race
+    size_t size() const;
+  };
+
+  struct alignas( 64 ) Worker
+  {
+    Deque deque {};
+    std::atomic<uint64_t> jobs { 0 };
+    std::atomic<uint64_t> steals { 0 };
+    std::atomic<uint64_t> busy_ticks { 0 };
+    std::atomic<uint64_t> max_depth { 0 };
+    std::thread thread {};
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_ {};
+
+  std::mutex mutex_ {};
+  std::condition_variable wakeup_ {};
+  std::deque<Job*> injected_ {}; //!< guarded by mutex_
+  bool stopping_ { false };      //!< guarded by mutex_
+  std::atomic<size_t> sleeping_ { 0 };
+
+  void enqueue( Job* job );
+  void wake_one_sleeper();
+  Job* find_job( const size_t index );
+  Job* take_injected( Worker& self );
+  bool any_queued();
+  void work( const size_t index );
+
+public:
+  //! \param[in] threads is the number of workers to start
+  explicit WorkStealingPool( const size_t threads = std::thread::hardware_concurrency() );
+
+  //! Waits until every queued job has run, then stops the workers
+  ~WorkStealingPool();
+
+  /* Disallow copying */
+  WorkStealingPool( const WorkStealingPool& other ) = delete;
+  WorkStealingPool& operator=( const WorkStealingPool& other ) = delete;
+
+  //! Runs `work` on a worker (from any thread). `work` must not throw.
+  template<class Work>
+  void submit( Work&& work )
+  {
+    enqueue( new JobOf<std::decay_t<Work>>( std::forward<Work>( work ) ) );
+  }
+
+  //! Runs `work` on a worker, then `completion` on `loop`'s thread, passing it what `work` returned (if anything).
+  //! \details If `work` throws, the exception is rethrown on `loop`'s thread, out of EventLoop::wait_next_event.
+  //! `loop` won't exit while the job is outstanding, and must outlive it.
+  template<class Work, class Completion>
+  void submit( EventLoop& loop, Work&& work, Completion&& completion )
+  {
+    loop.reserve_post();
+    submit( [&loop,
+             work = std::forward<Work>( work ),
+             completion = std::forward<Completion>( completion )]() mutable {
+      try {
+        if constexpr ( std::is_void_v<std::invoke_result_t<decltype( work )&>> ) {
+          work();
+          loop.post_reserved( std::move( completion ) );
+        } else {
+          loop.post_reserved( [completion = std::move( completion ), result = work()]() mutable {
+            completion( std::move( result ) );
+          } );
+        }
+      } catch ( ... ) {
+        loop.post_reserved( [error = std::current_exception()] { std::rethrow_exception( error ); } );
+      }
+    } );
+  }
+
+  size_t worker_count() const { return workers_.size(); }
+
+  std::string summary();
+};
@@ -0,0 +1,265 @@
+#include "write_ahead_log.hh"
+#include "crc32c.hh"
+#include "eventloop.hh"
+#include "exception.hh"
+#include "prometheus.hh"
+#include "ring_buffer.hh"
+#include "timer.hh"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static_assert( sizeof( WriteAheadLog::FileHeader ) == 16 and sizeof( WriteAheadLog::RecordHeader ) == 8 );
+
+// Op and key length, between the RecordHeader and the key
+static constexpr size_t PAYLOAD_PREFIX = sizeof( WriteAheadLog::Op ) + sizeof( uint32_t );
+
+static uint32_t record_crc( const uint32_t length, const string_view payload )
+{
+  return crc32c( crc32c( 0, { reinterpret_cast<const char*>( &length ), sizeof( length ) } ), payload );
+}
+
+static void write_all( FileDescriptor& file, string_view data )
+{
+  while ( not data.empty() ) {
+    data.remove_prefix( file.write( data ) );
+  }
+}
+
+static string directory_of( const string& path )
+{
+  const size_t slash = path.rfind( '/' );
+  if ( slash == string::npos ) {
+    return ".";
+  }
+  return slash == 0 ? "/" : path.substr( 0, slash );
+}
+
+WriteAheadLog::WriteAheadLog( const string& path,
+                              EventLoop& event_loop,
+                              const Config& config,
+                              DurableCallback&& on_durable )
+  : event_loop_( event_loop )
+  , config_( config )
+  , on_durable_( move( on_durable ) )
+  , file_( CheckSystemCall( "open " + path,
+                            open( path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 ) ) )
+{
+  if ( config_.max_batch_records == 0 ) {
+    throw invalid_argument( "WriteAheadLog: max batch records must be nonzero" );
+  }
+
+  struct stat st {};
+  CheckSystemCall( "fstat " + path, fstat( file_.fd_num(), &st ) );
+  if ( st.st_size == 0 ) {
+    // a new log: its header, and its name in the directory, must be durable before any record is
+    FileHeader header {};
+    memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+    header.version = VERSION;
+    write_all( file_, { reinterpret_cast<const char*>( &header ), sizeof( header ) } );
+    CheckSystemCall( "fdatasync " + path, fdatasync( file_.fd_num() ) );
+
+    const string directory = directory_of( path );
+    FileDescriptor directory_fd { CheckSystemCall(
+      "open " + directory, open( directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) };
+    CheckSystemCall( "fsync " + directory, fsync( directory_fd.fd_num() ) );
+  }
+
+  io_thread_ = thread( [this] { io_loop(); } );
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+  {
+    lock_guard<mutex> lock { mutex_ };
+    stopping_ = true;
+  }
+  pending_ready_.notify_one();
+  io_thread_.join();
+}
+
+uint64_t WriteAheadLog::replay( const string& path, const ReplayCallback& apply )
+{
+  const int fd = open( path.c_str(), O_RDWR | O_CLOEXEC );
+  if ( fd < 0 and errno == ENOENT ) {
+    return 0;
+  }
+  FileDescriptor file { CheckSystemCall( "open " + path, fd ) };
+
+  struct stat st {};
+  CheckSystemCall( "fstat " + path, fstat( file.fd_num(), &st ) );
+  const uint64_t size = st.st_size;
+  if ( size == 0 ) {
+    return 0;
+  }
+  if ( size < sizeof( FileHeader ) ) {
+    throw runtime_error( "write-ahead log: " + path + " is too short" );
+  }
+
+  const MMap_Region mapping { nullptr, size, PROT_READ, MAP_PRIVATE, file.fd_num() };
+  const string_view data { mapping.addr(), size };
+
+  FileHeader header {};
+  memcpy( &header, data.data(), sizeof( header ) );
+  if ( memcmp( header.magic, MAGIC, sizeof( MAGIC ) ) or header.version != VERSION ) {
+    throw runtime_error( "write-ahead log: " + path + " is not a version " + to_string( VERSION )
+                         + " mycached write-ahead log" );
+  }
+
+  uint64_t records = 0;
+  string_view rest = data.substr( sizeof( header ) );
+  while ( rest.size() >= sizeof( RecordHeader ) ) {
+    RecordHeader record {};
+    memcpy( &record, rest.data(), sizeof( record ) );
+    if ( record.length < PAYLOAD_PREFIX or record.length > rest.size() - sizeof( record ) ) {
+      break;
+    }
+
+    const string_view payload = rest.substr( sizeof( record ), record.length );
+    if ( record_crc( record.length, payload ) != record.crc ) {
+      break;
+    }
+
+    Op op {};
+    uint32_t key_length = 0;
+    memcpy( &op, payload.data(), sizeof( op ) );
+    memcpy( &key_length, payload.data() + sizeof( op ), sizeof( key_length ) );
+    if ( key_length > payload.size() - PAYLOAD_PREFIX or ( op != Op::Put and op != Op::Erase ) ) {
+      break;
+    }
+
+    apply( op, payload.substr( PAYLOAD_PREFIX, key_length ), payload.substr( PAYLOAD_PREFIX + key_length ) );
+    records++;
+    rest.remove_prefix( sizeof( record ) + record.length );
+  }
+
+  // whatever follows the last intact record was never acknowledged: a commit the crash interrupted
+  if ( not rest.empty() ) {
+    CheckSystemCall( "ftruncate " + path, ftruncate( file.fd_num(), size - rest.size() ) );
+    CheckSystemCall( "fdatasync " + path, fdatasync( file.fd_num() ) );
+  }
+
+  return records;
+}
+
+uint64_t WriteAheadLog::append( const Op op, const string_view key, const string_view value )
+{
+  if ( key.size() > UINT32_MAX or PAYLOAD_PREFIX + key.size() + value.size() > UINT32_MAX ) {
+    throw runtime_error( "write-ahead log: record too large" );
+  }
+
+  const uint32_t key_length = key.size();
+  const uint32_t length = PAYLOAD_PREFIX + key.size() + value.size();
+
+  bool wake = false;
+  uint64_t lsn = 0;
+  {
+    lock_guard<mutex> lock { mutex_ };
+
+    // the payload goes in first, so that the CRC can be computed over it in place
+    const size_t start = pending_.size();
+    pending_.resize( start + sizeof( RecordHeader ) );
+    pending_.append( reinterpret_cast<const char*>( &op ), sizeof( op ) );
+    pending_.append( reinterpret_cast<const char*>( &key_length ), sizeof( key_length ) );
+    pending_.append( key );
+    pending_.append( value );
+
+    const RecordHeader header {
+      length, record_crc( length, string_view { pending_ }.substr( start + sizeof( RecordHeader ) ) ) };
+    memcpy( pending_.data() + start, &header, sizeof( header ) );
+
+    if ( pending_records_ == 0 ) {
+      pending_since_ns_ = Timer::timestamp_ns();
+      wake = true;
+    }
+    pending_records_++;
+    wake |= pending_records_ == config_.max_batch_records;
+    lsn = ++last_lsn_;
+  }
+
+  if ( wake ) {
+    pending_ready_.notify_one();
+  }
+  return lsn;
+}
+
+void WriteAheadLog::io_loop()
+{
+  // an I/O error ends the process (the exception escapes the thread): a change that can't be made durable
+  // must not be acknowledged
+  string batch;
+  unique_lock<mutex> lock { mutex_ };
+
+  while ( true ) {
+    pending_ready_.wait( lock, [&] { return stopping_ or pending_records_ > 0; } );
+    if ( pending_records_ == 0 ) {
+      return;
+    }
+
+    // group commit: let more records join the batch until the interval is up or the batch is full
+    if ( config_.commit_interval_us ) {
+      const chrono::steady_clock::time_point deadline {
+        chrono::nanoseconds( pending_since_ns_ + config_.commit_interval_us * 1000 ) };
+      pending_ready_.wait_until(
+        lock, deadline, [&] { return stopping_ or pending_records_ >= config_.max_batch_records; } );
+    }
+
+    batch.swap( pending_ );
+    const uint64_t records = pending_records_;
+    const uint64_t lsn = last_lsn_;
+    pending_records_ = 0;
+    lock.unlock();
+
+    {
+      lock_guard<mutex> file_lock { file_mutex_ };
+      write_all( file_, batch );
+      const uint64_t sync_start = Timer::timestamp_ns();
+      CheckSystemCall( "fdatasync", fdatasync( file_.fd_num() ) );
+      sync_ns_.fetch_add( Timer::timestamp_ns() - sync_start, memory_order_relaxed );
+    }
+
+    commits_.fetch_add( 1, memory_order_relaxed );
+    records_written_.fetch_add( records, memory_order_relaxed );
+    bytes_written_.fetch_add( batch.size(), memory_order_relaxed );
+    batch.clear();
+
+    event_loop_.post( [this, lsn] { on_durable_( lsn ); } );
+
+    lock.lock();
+  }
+}
+
+void WriteAheadLog::checkpoint()
+{
+  lock_guard<mutex> file_lock { file_mutex_ };
+  CheckSystemCall( "ftruncate", ftruncate( file_.fd_num(), sizeof( FileHeader ) ) );
+  CheckSystemCall( "fdatasync", fdatasync( file_.fd_num() ) );
+  checkpoints_.fetch_add( 1, memory_order_relaxed );
+}
+
+void WriteAheadLog::write_metrics( PrometheusText& out )
+{
+  out.family( "mycached_wal_commits_total", "counter", "Group commits (one write and one fdatasync each)" );
+  out.sample( "mycached_wal_commits_total", "", commits_.load( memory_order_relaxed ) );
+
+  out.family( "mycached_wal_records_total", "counter", "Records written to the write-ahead log" );
+  out.sample( "mycached_wal_records_total", "", records_written_.load( memory_order_relaxed ) );
+
+  out.family( "mycached_wal_written_bytes_total", "counter", "Bytes written to the write-ahead log" );
+  out.sample( "mycached_wal_written_bytes_total", "", bytes_written_.load( memory_order_relaxed ) );
+
+  out.family( "mycached_wal_sync_seconds_total", "counter", "Time spent in fdatasync" );
+  out.sample( "mycached_wal_sync_seconds_total", "", sync_ns_.load( memory_order_relaxed ) / 1e9 );
+
+  out.family( "mycached_wal_checkpoints_total", "counter", "Times the log was emptied after a snapshot" );
+  out.sample( "mycached_wal_checkpoints_total", "", checkpoints_.load( memory_order_relaxed ) );
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "file_descriptor.hh"
+
+class EventLoop;
+class PrometheusText;
+
+//! \brief An append-only log of changes to a key-value store, made durable in batches (group commit).
+//! \details The event loop's thread calls append(), which copies the record into a pending batch and returns its
+//! log sequence number (LSN). An I/O thread takes the whole pending batch, writes it with one write and makes it
+//! durable with one fdatasync, then posts a task to the event loop that calls `on_durable` with the batch's last
+//! LSN. A caller that must not answer before its change is durable holds the answer until then.
+//!
+//! The I/O thread commits as soon as there is something to commit and `commit_interval_us` has passed since the
+//! oldest pending record was appended (so 0 commits at once, and whatever arrives during an fdatasync waits for
+//! the next one), or sooner once `max_batch_records` are pending. A longer interval means fewer, larger
+//! fdatasyncs for more latency per change.
+//!
+//! The file is a FileHeader, then records: a RecordHeader, the Op, the key's length (32 bits) and the key and
+//! value bytes, in the machine's byte order. Each record's CRC-32C covers its length and payload, so replay()
+//! stops at a torn or damaged tail (and truncates it) rather than applying garbage.
+class WriteAheadLog
+{
+public:
+  enum class Op : uint8_t
+  {
+    Put,
+    Erase,
+  };
+
+  struct FileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+  };
+
+  struct RecordHeader
+  {
+    uint32_t length; //!< of the payload (Op, key length, key and value)
+    uint32_t crc;    //!< CRC-32C of `length` and the payload
+  };
+
+  static constexpr char MAGIC[8] = { 'M', 'Y', 'C', 'W', 'A', 'L', '0', '1' };
+  static constexpr uint32_t VERSION = 1;
+
+  struct Config
+  {
+    uint64_t commit_interval_us;
+    uint64_t max_batch_records;
+  };
+
+  using DurableCallback = std::function<void( const uint64_t lsn )>;
+  using ReplayCallback = std::function<void( const Op op, const std::string_view key, const std::string_view value )>;
+
+private:
+  EventLoop& event_loop_;
+  Config config_;
+  DurableCallback on_durable_;
+  FileDescriptor file_;
+
+  std::mutex mutex_ {};
+  std::condition_variable pending_ready_ {};
+  std::string pending_ {};       //!< encoded records waiting for the I/O thread
+  uint64_t pending_records_ {};  //!< in pending_
+  uint64_t pending_since_ns_ {}; //!< Timer::timestamp_ns() when the oldest record in pending_ was appended
+  uint64_t last_lsn_ {};         //!< LSN of the last record appended
+  bool stopping_ {};
+
+  //! Held by the I/O thread while it writes and syncs, and by checkpoint() while it truncates
+  std::mutex file_mutex_ {};
+
+  std::atomic<uint64_t> commits_ { 0 };
+  std::atomic<uint64_t> records_written_ { 0 };
+  std::atomic<uint64_t> bytes_written_ { 0 };
+  std::atomic<uint64_t> sync_ns_ { 0 }; //!< total time in fdatasync
+  std::atomic<uint64_t> checkpoints_ { 0 };
+
+  std::thread io_thread_ {};
+
+  void io_loop();
+
+public:
+  //! Opens (or creates) the log at `path` and starts the I/O thread. Call replay() first to recover what the
+  //! log already holds. `on_durable` runs on `event_loop`'s thread.
+  WriteAheadLog( const std::string& path, EventLoop& event_loop, const Config& config, DurableCallback&& on_durable );
+
+  //! Commits what is pending, then stops the I/O thread (the event loop must not run the last `on_durable`
+  //! tasks after this)
+  ~WriteAheadLog();
+
+  //! Calls `apply` for each intact record of the log at `path` (if it exists), in order, and truncates the log
+  //! after the last one
+  //! \returns the number of records applied
+  static uint64_t replay( const std::string& path, const ReplayCallback& apply );
+
+  //! Queues a record for the next commit (event loop thread)
+  //! \returns its LSN; `on_durable` is called with it or a later one once it is on disk
+  uint64_t append( const Op op, const std::string_view key, const std::string_view value );
+
+  //! LSN of the last record appended
+  uint64_t last_lsn() const { return last_lsn_; }
+
+  //! Group commits so far
+  uint64_t commits() const { return commits_.load( std::memory_order_relaxed ); }
+
+  //! Empties the log, once its changes are safely in a snapshot taken after they were appended (event loop
+  //! thread). Records still pending are written afterwards; replaying them on top of the snapshot is harmless.
+  void checkpoint();
+
+  //! Commits, records and bytes written, time in fdatasync and checkpoints
+  void write_metrics( PrometheusText& out );
+
+  WriteAheadLog( const WriteAheadLog& other ) = delete;
+  WriteAheadLog& operator=( const WriteAheadLog& other ) = delete;
+};